@@ -0,0 +1,13 @@
+#pragma once
+
+/*!
+ * heap allocation counter of the ALLOC_COUNTER build (env lolin32_lite_alloc), malloc, calloc
+ * and realloc are wrapped by the linker and count per task of TASK_TABLE
+ */
+void allocExempt(bool on);
+
+void allocSample();
+
+void allocPrint();
+
+const char *allocSteadyOffender();
\ No newline at end of file
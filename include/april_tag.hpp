@@ -13,8 +13,12 @@ struct AprilTag
     double size();
 };
 
-bool testApril(AsyncUDPPacket packet);
-void parseApril(AsyncUDPPacket packet);
+bool testApril(AsyncUDPPacket &packet);
+void parseApril(const uint8_t *data, size_t length, uint16_t frame);
+void aprilTagPost(const uint8_t *data, size_t length, uint16_t frame);
+void aprilTagInit();
 void testTimeout();
+bool tagLastBearing(long &bearing);
+float tagCenterBearing(unsigned center);
 
 
@@ -0,0 +1,99 @@
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+#include "follow_decision.hpp"
+
+/*!
+ * black box of the inputs of controlCarTask: tag frames, ultrasonic readings,
+ * telnet and station commands, stepper completions and parameter changes,
+ * together with the follow decisions made on them. Inputs that did not change
+ * are not recorded. A dump starts with one BB_PARAM record per parameter holding
+ * its value at the time of the oldest record, then one BB_TAG and one BB_US record
+ * per sensor with the inputs at that time, all carrying the sequence of the last
+ * input record before the oldest record, followed by the records in order.
+ * While a dump runs the inputs stay current for the decisions but no records are
+ * stored, they still use up their sequence. Inputs that changed meanwhile are
+ * recorded with their current value when the dump ended.
+ */
+enum blackBoxType
+{
+    BB_TAG = 1,
+    BB_US = 2,
+    BB_COMMAND = 3,
+    BB_STEPPER = 4,
+    BB_PARAM = 5,
+    BB_DECISION = 6,
+};
+
+enum blackBoxSource
+{
+    BB_SOURCE_TELNET,
+    BB_SOURCE_STATION,
+};
+
+struct __attribute__((packed)) blackBoxRecord
+{
+    uint32_t time; // ms
+    // counts every record, a gap means the ring overwrote records
+    uint16_t sequence;
+    uint8_t type;
+    // sensor, command source, stepper state, parameter index or follow action
+    uint8_t arg;
+    union __attribute__((packed))
+    {
+        struct __attribute__((packed))
+        {
+            uint16_t center;
+            float size;
+            int16_t id;
+        } tag;
+        float distance; // cm
+        // telnet line or station message starting with its type
+        char command[8];
+        int32_t steps;
+        struct __attribute__((packed))
+        {
+            float oldValue;
+            float newValue;
+        } param;
+        struct __attribute__((packed))
+        {
+            // sequence of the last input record the decision saw
+            uint16_t inputs;
+            // FollowState before and after the decision, see blackBoxStateFlags
+            uint8_t before;
+            uint8_t after;
+            uint8_t stop;
+        } decision;
+    };
+};
+
+inline uint8_t blackBoxStateFlags(const FollowState &state)
+{
+    return state.lockedOn | state.innerCircle << 1;
+}
+
+void blackBoxInit();
+
+void blackBoxTag(unsigned center, float size, int id);
+
+void blackBoxUs(unsigned sensor, float distance);
+
+void blackBoxCommand(uint8_t source, const char *data, size_t length);
+
+void blackBoxStepper(uint8_t state, long steps);
+
+uint16_t blackBoxInputs(ControlInputs &inputs);
+
+void blackBoxDecision(uint16_t inputSequence, const FollowState &before, const FollowDecision &decision,
+                      const FollowState &after);
+
+void blackBoxDump(bool fromFlash);
+
+void blackBoxSend();
+
+bool blackBoxSave();
+
+void blackBoxClear();
+
+void blackBoxPrint();
@@ -1,3 +1,14 @@
 #pragma once
+#include "loop_timing.hpp"
 
-void controlCarTask(void *argument);
\ No newline at end of file
+void controlCarTask(void *argument);
+
+void printSearchStats();
+
+void printPose();
+
+void printControlTiming(bool reset = false);
+
+void printDockStats();
+
+const LoopTiming &controlLoopTiming();
\ No newline at end of file
@@ -0,0 +1,33 @@
+#pragma once
+#include <stdint.h>
+
+#define CLASSIFIER_FEATURES 3
+#define CLASSIFIER_MAX_CLASSES 8
+
+/**
+ * @brief gaussian class model with a diagonal covariance
+ *
+ */
+struct CargoCentroid
+{
+    uint8_t cargoClass;
+    float mean[CLASSIFIER_FEATURES];
+    float stddev[CLASSIFIER_FEATURES];
+};
+
+struct CargoClassifier
+{
+    uint8_t version;
+    uint8_t numCentroids;
+    CargoCentroid centroids[CLASSIFIER_MAX_CLASSES];
+};
+
+void cargoFeatures(const uint16_t lit[4], const uint16_t ambient[4], float fullScale, float features[CLASSIFIER_FEATURES]);
+
+unsigned cargoClassify(const CargoClassifier &classifier, const float features[CLASSIFIER_FEATURES], float *confidence);
+
+void cargoLogLikelihoods(const CargoClassifier &classifier, const float features[CLASSIFIER_FEATURES], float *logLikelihood);
+
+void cargoClassifierDefaults(CargoClassifier &classifier);
+
+bool cargoClassifierSet(CargoClassifier &classifier, const CargoCentroid &centroid);
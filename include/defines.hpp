@@ -1,4 +1,7 @@
 #pragma once
+#include "params.hpp"
+// tuning macros mapped to params are changeable at runtime, their defaults are in params.hpp
+
 /*!
  * Pin Definitions
  */
@@ -26,48 +29,156 @@
 #define PIN_SDA_COLOR 13
 
 /*!Tag Configuration Settings */
-#define TAG_CENTER 600
-#define TAG_CENTER_DEADZONE_SMALL 50
-#define TAG_CENTER_DEADZONE 100
-#define TAG_CLOSE_SIZE 160
-#define TAG_SEARCH_TIMEOUT 20000
-#define TAG_LAST_SEEN_TIMEOUT 1000
-#define REPOSITION_MAX_STOPS 5
-#define REPOSITION_MAX_TIME 10000
+#define TAG_CENTER (params.tagCenter)
+#define TAG_CENTER_DEADZONE_SMALL (params.tagCenterDeadzoneSmall)
+#define TAG_CENTER_DEADZONE (params.tagCenterDeadzone)
+#define TAG_CLOSE_SIZE (params.tagCloseSize)
+#define TAG_SEARCH_TIMEOUT (params.tagSearchTimeout)
+#define TAG_LAST_SEEN_TIMEOUT (params.tagLastSeenTimeout)
+#define TAG_MEMORY_TIMEOUT 5000
+#define CAMERA_FOV 60
+#define REPOSITION_MAX_STOPS (params.repositionMaxStops)
+#define REPOSITION_MAX_TIME (params.repositionMaxTime)
 
 /*wifi Configuration Settings */
+#define ROBOT_ID 1 // unique in a fleet, sent in every station message
 #define WIFI_SSID "AGV1"
+// with a fleet network the robot joins it instead of opening its own AP
+// #define WIFI_FLEET_SSID "AGV-FLEET"
+// #define WIFI_FLEET_PASSWORD ""
 #define TELNET_PORT 23
 #define UDP_PORT 7709
 #define UDP_COMM_PORT 7708
+#define UDP_TELEMETRY_PORT 7710
+#define UDP_LOG_PORT 7711
+#define UDP_BLACK_BOX_PORT 7712
+#define PROFILER_PERIOD 2000
+#define AGV_HEARTBEAT_PERIOD 2000 // agvMsg repeat interval without changes
+#define AGV_STATUS_POLL 20 // also the resolution of the agvMsg retransmits
+#define COMM_MAX_PEERS 8
+#define SLOT_REPLY_TIMEOUT 1000 // without an answer the station does not arbitrate
+#define SLOT_WAIT_RESEND 10000 // the slot request is repeated while waiting for the grant
+#define SLOT_WAIT_TIMEOUT 120000 // without a grant the leg is aborted
+#define TELEMETRY_RATE 20 // state records per second
+#define TELEMETRY_MIN_RATE 10
+#define TELEMETRY_MAX_RATE 100
 #define UDP_TIMEOUT 1000
+#define APRIL_MAX_PACKET 1472 // one UDP datagram
 #define SERIAL_BAUDRATE 115200
 
 /*!Stepper Motor Configuration Settings */
 #define STEPER_STEPS_PER_ROT 2048
-#define WHEEL_ROTS_360 2.75
+#define WHEEL_ROTS_360 (params.wheelRots360)
+#define WHEEL_DIAMETER 6.5 // cm
+#define STEPS_PER_CM (STEPER_STEPS_PER_ROT / (PI * WHEEL_DIAMETER))
 #define STEPS_360 (STEPER_STEPS_PER_ROT * WHEEL_ROTS_360)
 #define STEPS_90 (STEPS_360 * 0.25)
 #define STEPS_45 (STEPS_90 * 0.5)
-#define STEPPER_MAX_RPM 20
-#define STEPPER_TURN_RPM 5
-#define STEPPER_SLOW_TURN_RPM 3
-#define DRIVE_BACK_TIMEOUT 6000
+#define STEPPER_MAX_RPM (params.stepperMaxRpm)
+#define STEPPER_TURN_RPM (params.stepperTurnRpm)
+#define STEPPER_SLOW_TURN_RPM (params.stepperSlowTurnRpm)
+#define SEARCH_SWEEP_MARGIN (STEPS_45 * 0.25)
+#define DRIVE_BACK_TIMEOUT (params.driveBackTimeout)
+#define STEPPER_CURVE_LIMIT 0.8 // largest wheel speed difference of a curve, share of the center speed
+#define STEPPER_CURVE_RESOLUTION 0.02 // smaller changes of a curve are not commanded
+#define STEPPER_WAKE_EARLY_US 100 // the stepper task sleeps until this long before a step and waits for the exact time
+
+/*!docking settings */
+#define DOCK_STOP_DISTANCE (params.dockStopDistance)
+#define DOCK_TAG_RANGE_K 4800.0  // cm * px, tag range = K / tag size
+#define DOCK_TAG_MIN_RANGE 15.0  // cm, the tag is cropped below this range
+#define DOCK_US_VARIANCE 1.0     // cm^2
+#define DOCK_TAG_VARIANCE 0.01   // relative, scaled with range^2
+#define DOCK_ODOMETRY_NOISE 0.05 // cm^2 per cm driven
+#define DOCK_DECELERATION (params.dockDeceleration)
+#define DOCK_MAX_RPM (params.dockMaxRpm)
+#define DOCK_MIN_RPM (params.dockMinRpm)
+#define DOCK_TIMEOUT 15000
+
+/*!control loop settings */
+#define CONTROL_LOOP_BUDGET_US 20000
+#define STEP_LATENESS_BUDGET_US 100
+#define TASK_POLL_TICKS 1 // busy waits sleep a tick so the lower priority tasks of the core can run
+
+/*!pose estimator settings */
+#define POSE_PERIOD 20 // ms, the estimate is published at the control rate
+#define POSE_DISTANCE_NOISE 0.05 // cm^2 per cm driven
+#define POSE_TURN_NOISE 0.001 // rad^2 per rad turned on the spot
+#define POSE_DRIFT_NOISE 0.00005 // rad^2 per cm driven, unequal wheels
+#define POSE_START_VARIANCE 4.0 // cm^2, placement of the robot on the start and dock pose
+#define POSE_START_HEADING_VARIANCE 0.003 // rad^2
+#define POSE_BEARING_VARIANCE 0.0012 // rad^2 of the tag bearing, about 2 deg
+#define POSE_US_VARIANCE 4.0 // cm^2 of the ultrasonic range to a mapped wall
+#define POSE_GATE 6.63 // chi^2 of one degree of freedom at 99%, larger innovations are rejected
+
+/*!obstacle avoidance settings */
+#define VFH_SECTORS 36 // sectors of the polar histogram, 10 deg each
+#define VFH_RANGE 80 // cm, obstacles further away do not count
+#define VFH_ROBOT_RADIUS 10 // cm, obstacles are widened by this angle
+#define VFH_THRESHOLD_HIGH 0.30 // a sector gets blocked above this density
+#define VFH_THRESHOLD_LOW 0.15 // and free again below this
+#define VFH_WIDE_VALLEY 4 // sectors, gaps at least this wide are entered half of it from their border
+#define VFH_MEMORY_DISTANCE 40 // cm driven until a direction that is no longer measured fades to 37%
+#define VFH_LOOKAHEAD 30 // cm, the curve reaches the chosen direction within this distance
+#define VFH_MAX_CURVATURE 0.08 // 1/cm
+#define VFH_SPIN_ANGLE 1.3 // rad, directions further off are turned to on the spot
+#define VFH_MIN_SPEED 0.3 // share of STEPPER_MAX_RPM
+#define VFH_TIMEOUT 20000 // ms
 
-/*!telnet setings */
-#define DEBUG_ON 1
-#define DEBUG_USE_SERIAL 1
-#define DEBUG_USE_TELNET 1
+/*!log settings */
+#define LOG_LEVEL 0 // records below are compiled out: 0 debug, 1 info, 2 warn, 3 error
+#define LOG_USE_SERIAL 1
+#define LOG_USE_TELNET 1
+#define LOG_USE_UDP 0
+#define LOG_RING_SIZE 128 // records per core, power of two
+#define LOG_DRAIN_PERIOD 20 // ms
+
+/*!floor map settings */
+#define FLOOR_MAP_CELL_SIZE 10 // cm
+#define FLOOR_MAP_WIDTH 30 // cells
+#define FLOOR_MAP_HEIGHT 20
+#define ROUTE_MAX_WAYPOINTS 16
 
 /*!ultrasonic settings */
 #define US_MAX_DIST 200
-#define US_MIN_TRIGGER 7
+#define US_MIN_TRIGGER (params.usMinTrigger)
 #define US_BASE_TRIGGER 5
-#define US_NEAR_TRIGGER 15
+#define US_NEAR_TRIGGER (params.usNearTrigger)
+#define US_SENSOR_BEARINGS {90, 45, 0, -45, -90} // deg from the heading, left positive, order of US_Sensors
+#define US_BEAM_WIDTH 30 // deg, a sensor measures the closest echo within the beam
 
 
 /*!colorSensor settings */
 #define NUM_CO_SAMPLES  5
+#define COLOR_MAX_SAMPLES NUM_CO_SAMPLES
+#define COLOR_AMBIENT_WINDOW 3
+#define COLOR_FRAMES_PER_CYCLE 2
+#define COLOR_DECISION_CONFIDENCE (params.colorDecisionConfidence)
+#define COLOR_MIN_CONFIDENCE (params.colorMinConfidence)
+#define COLOR_CONFIRM_PERIOD 1000
+#define COLOR_RANGE_HIGH 0.8 // share of full scale
+#define COLOR_RANGE_LOW 0.1
+#define COLOR_PRESENCE_BAND 0.1 // share of the baseline lux below it before cargo counts as present
+#define COLOR_STABLE_TIME 500
+#define COLOR_MONITOR_DEBOUNCE (params.colorMonitorDebounce)
+#define CARGO_LOAD_TIMEOUT 10000
+
+/*!black box settings */
+#define BLACK_BOX_SIZE 2048 // records of 16 bytes
+#define BLACK_BOX_MAX_PARAMS 32
+#define BLACK_BOX_PACKET_RECORDS 64
+#define BLACK_BOX_PARTITION "blackbox"
+
+/*!trace settings */
+#define TRACE_SIZE 1024 // records of 8 bytes
+
+/*!mission settings */
+#define MISSION_QUEUE_LENGTH 16
+
+/*!memory settings */
+#define TASK_STACK_MARGIN 512 // bytes a stack must keep free
+#define HEAP_MIN_FREE 32768   // budget for the heap low water mark, wifi and lwip allocate at runtime
+#define ALLOC_SETTLE_TIME 30000 // ms after boot before the allocation free tasks are checked
 
 /*!
  * helpers
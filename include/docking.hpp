@@ -0,0 +1,38 @@
+#pragma once
+
+/**
+ * @brief one dimensional kalman filter for the distance to the dock,
+ * predicted by odometry and corrected by ultrasonic and tag range measurements
+ *
+ */
+struct DockEstimator
+{
+    float distance;
+    float variance;
+    void reset(float d, float var);
+    void predict(float driven);
+    void update(float measured, float var);
+};
+
+float dockTagRange(double tagSize);
+
+unsigned dockProfileRpm(float remaining);
+
+/**
+ * @brief final docking error of all finished runs, runs that timed out are only counted
+ *
+ */
+struct DockStats
+{
+    unsigned count;
+    unsigned timeouts;
+    float lastError;
+    float sumError;
+    float sumAbsError;
+    float maxAbsError;
+    unsigned long lastDuration;
+};
+
+void dockRecord(DockStats &stats, float error, unsigned long duration);
+
+void dockPrint(const DockStats &stats);
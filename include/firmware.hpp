@@ -0,0 +1,3 @@
+#pragma once
+
+void firmwareStart(bool waitForTelnet);
\ No newline at end of file
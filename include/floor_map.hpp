@@ -0,0 +1,34 @@
+#pragma once
+
+/**
+ * @brief known pose of a station in map coordinates (cm, rad)
+ * the approach point is where the station tag is in camera range,
+ * the dock pose is where the robot stands when it reached the station,
+ * the wait point is where robots queue while another robot is docked,
+ * the tag is the AprilTag mounted on the station
+ */
+struct StationPose
+{
+    int id;
+    float approachX;
+    float approachY;
+    float dockX;
+    float dockY;
+    float dockHeading;
+    float waitX;
+    float waitY;
+    float tagX;
+    float tagY;
+};
+
+int floorMapWidth();
+
+int floorMapHeight();
+
+bool floorMapOccupied(int cx, int cy);
+
+float floorMapRayCast(float x, float y, float angle, float maxRange);
+
+const StationPose *floorMapStation(int id);
+
+void floorMapStartPose(float &x, float &y, float &heading);
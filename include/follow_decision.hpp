@@ -0,0 +1,47 @@
+#pragma once
+#include <stdint.h>
+#include "defines.hpp"
+
+/**
+ * @brief the sensor values one follow step decides on, a snapshot taken from the black box
+ *
+ */
+struct ControlInputs
+{
+    uint16_t tagCenter; // 0 if no tag is in view
+    float tagSize;
+    float us[NUM_SENSORS]; // cm
+};
+
+enum followAction
+{
+    FOLLOW_LOST,
+    FOLLOW_WAIT, // the tag is to the side but the turn is blocked
+    FOLLOW_TURN_RIGHT,
+    FOLLOW_TURN_LEFT,
+    FOLLOW_DOCK,
+    FOLLOW_STRAIGHT,
+    FOLLOW_AVOID,
+};
+
+struct FollowState
+{
+    bool lockedOn;
+    bool innerCircle;
+};
+
+/**
+ * @brief result of one follow step, stop is set when the lock on the tag changed
+ *
+ */
+struct FollowDecision
+{
+    uint8_t action;
+    bool stop;
+};
+
+FollowDecision followDecide(const ControlInputs &in, FollowState &state);
+
+bool followInnerLock(unsigned tagCenter);
+
+const char *followActionName(uint8_t action);
@@ -0,0 +1,88 @@
+#pragma once
+#include <stdint.h>
+#include <string.h>
+#include "defines.hpp"
+
+/*!
+ * deferred logging: the LOG_ macros only copy the timestamp, the format string
+ * pointer and up to LOG_MAX_ARGS arguments into a lock free ring of the calling
+ * core, the log task formats and sends the records later. A full ring drops the
+ * record and counts it instead of blocking the caller.
+ * The format must be a string literal, a conversion like %d or %f marks the
+ * place of the next argument which is printed according to its type.
+ * String arguments must point to constant strings.
+ */
+#define LOG_LEVEL_DEBUG 0
+#define LOG_LEVEL_INFO 1
+#define LOG_LEVEL_WARN 2
+#define LOG_LEVEL_ERROR 3
+
+#define LOG_MAX_ARGS 3
+
+enum logArgType
+{
+    LOG_ARG_INT,
+    LOG_ARG_UINT,
+    LOG_ARG_FLOAT,
+    LOG_ARG_STRING,
+};
+
+struct LogArg
+{
+    uint8_t type;
+    uint32_t value;
+};
+
+inline LogArg logArg(int value) { return {LOG_ARG_INT, (uint32_t)value}; }
+inline LogArg logArg(long value) { return {LOG_ARG_INT, (uint32_t)value}; }
+inline LogArg logArg(unsigned value) { return {LOG_ARG_UINT, value}; }
+inline LogArg logArg(unsigned long value) { return {LOG_ARG_UINT, (uint32_t)value}; }
+inline LogArg logArg(uint8_t value) { return {LOG_ARG_UINT, value}; }
+inline LogArg logArg(bool value) { return {LOG_ARG_UINT, value}; }
+inline LogArg logArg(const char *value) { return {LOG_ARG_STRING, (uint32_t)(uintptr_t)value}; }
+inline LogArg logArg(double value)
+{
+    float f = value;
+    LogArg arg = {LOG_ARG_FLOAT, 0};
+    memcpy(&arg.value, &f, sizeof(f));
+    return arg;
+}
+
+void logWrite(uint8_t level, const char *format, const LogArg *args, unsigned count);
+
+inline void logRecord(uint8_t level, const char *format)
+{
+    logWrite(level, format, NULL, 0);
+}
+
+template <typename... T>
+inline void logRecord(uint8_t level, const char *format, T... values)
+{
+    static_assert(sizeof...(T) <= LOG_MAX_ARGS, "too many log arguments");
+    const LogArg args[] = {logArg(values)...};
+    logWrite(level, format, args, sizeof...(T));
+}
+
+#if LOG_LEVEL <= LOG_LEVEL_DEBUG
+#define LOG_DEBUG(...) logRecord(LOG_LEVEL_DEBUG, __VA_ARGS__)
+#else
+#define LOG_DEBUG(...) do {} while (0)
+#endif
+
+#if LOG_LEVEL <= LOG_LEVEL_INFO
+#define LOG_INFO(...) logRecord(LOG_LEVEL_INFO, __VA_ARGS__)
+#else
+#define LOG_INFO(...) do {} while (0)
+#endif
+
+#if LOG_LEVEL <= LOG_LEVEL_WARN
+#define LOG_WARN(...) logRecord(LOG_LEVEL_WARN, __VA_ARGS__)
+#else
+#define LOG_WARN(...) do {} while (0)
+#endif
+
+#define LOG_ERROR(...) logRecord(LOG_LEVEL_ERROR, __VA_ARGS__)
+
+void logInit();
+
+void logPrint();
\ No newline at end of file
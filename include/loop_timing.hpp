@@ -0,0 +1,41 @@
+#pragma once
+#include <stdint.h>
+
+/*! 4 buckets per power of two up to 2^31 us */
+#define LOOP_TIMING_SUB_BUCKETS 4
+#define LOOP_TIMING_BUCKETS (32 * LOOP_TIMING_SUB_BUCKETS)
+
+/**
+ * @brief period statistics of a periodically evaluated loop
+ *
+ */
+struct LoopTiming
+{
+    const char *name;
+    uint32_t budgetUs;
+    uint64_t lastTick;
+    bool running;
+    uint32_t count;
+    uint32_t minUs;
+    uint32_t maxUs;
+    uint64_t totalUs;
+    uint32_t misses;
+    uint32_t lastUs;
+    uint32_t histogram[LOOP_TIMING_BUCKETS];
+};
+
+uint64_t loopTimingNow();
+
+uint32_t loopTimingElapsedUs(uint64_t start, uint64_t end);
+
+void loopTimingRecord(LoopTiming &timing, uint32_t us);
+
+void loopTimingTick(LoopTiming &timing);
+
+void loopTimingPause(LoopTiming &timing);
+
+void loopTimingReset(LoopTiming &timing);
+
+uint32_t loopTimingPercentile(const LoopTiming &timing, unsigned percent);
+
+void loopTimingPrint(const LoopTiming &timing);
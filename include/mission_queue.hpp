@@ -0,0 +1,33 @@
+#pragma once
+#include <stdint.h>
+
+/*! station id that matches every visible tag */
+#define ANY_STATION -1
+
+/**
+ * @brief a single leg of a trip: what to do and at which station (AprilTag id)
+ *
+ */
+struct MissionLeg
+{
+    uint8_t mission;
+    int station;
+};
+
+void missionQueueInit();
+
+bool missionQueuePush(uint8_t mission, int station = ANY_STATION);
+
+bool missionQueuePop(MissionLeg &leg);
+
+unsigned missionQueueCount();
+
+void missionQueueClear();
+
+void missionQueuePrint();
+
+uint8_t missionFromCode(const char *code);
+
+const char *missionName(uint8_t mission);
+
+bool missionQueueParse(const char *trip);
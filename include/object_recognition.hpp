@@ -9,10 +9,42 @@ enum RecognitedObject
     RECOGNITION_COTTON
 };
 
+enum CargoEvent
+{
+    CARGO_EVENT_NONE,
+    CARGO_EVENT_LOST,
+    CARGO_EVENT_CHANGED
+};
+
+/**
+ * @brief cargo state published by the color sampler task
+ *
+ */
+struct ColorSnapshot
+{
+    bool present;
+    unsigned cargoClass;
+    float confidence;
+    unsigned lux;
+    unsigned long timestamp;
+    unsigned long stableSince;
+};
+
 bool colorSensorInit();
 
+ColorSnapshot colorSnapshot();
+
 unsigned measureObject();
 
 void calibrateLux();
 
-bool objectLoaded();
\ No newline at end of file
+bool objectLoaded();
+
+CargoEvent cargoMonitor(unsigned expectedClass);
+
+
+void colorPrint();
+
+void colorPrintModel();
+
+bool colorCommand(const char *args);
\ No newline at end of file
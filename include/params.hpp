@@ -0,0 +1,63 @@
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+
+/*!
+ * tuning parameters that can be changed at runtime over telnet or UDP and are persisted in nvs,
+ * defines.hpp maps the former tuning macros to the fields of params so every read is a plain load.
+ * X(field, type, name, default, min, max, help)
+ */
+#define PARAM_TABLE(X)                                                                                      \
+    X(tagCenter, int32_t, "TAG_CENTER", 600, 100, 1280, "tag x position straight ahead, px")                 \
+    X(tagCenterDeadzoneSmall, int32_t, "TAG_CENTER_DEADZONE_SMALL", 50, 0, 600, "lock on band, px")          \
+    X(tagCenterDeadzone, int32_t, "TAG_CENTER_DEADZONE", 100, 0, 600, "lock lost band, px")                  \
+    X(tagCloseSize, int32_t, "TAG_CLOSE_SIZE", 160, 10, 1000, "tag size of the inner circle, px")            \
+    X(tagSearchTimeout, int32_t, "TAG_SEARCH_TIMEOUT", 20000, 1000, 120000, "search before reposition, ms")  \
+    X(tagLastSeenTimeout, int32_t, "TAG_LAST_SEEN_TIMEOUT", 1000, 100, 10000, "tag lost after, ms")          \
+    X(repositionMaxStops, int32_t, "REPOSITION_MAX_STOPS", 5, 1, 50, "straight moves per reposition")        \
+    X(repositionMaxTime, int32_t, "REPOSITION_MAX_TIME", 10000, 1000, 60000, "straight move limit, ms")      \
+    X(wheelRots360, float, "WHEEL_ROTS_360", 2.75, 1, 5, "wheel rotations per robot turn")                   \
+    X(stepperMaxRpm, int32_t, "STEPPER_MAX_RPM", 20, 1, 40, "straight speed, rpm")                           \
+    X(stepperTurnRpm, int32_t, "STEPPER_TURN_RPM", 5, 1, 40, "turn speed, rpm")                              \
+    X(stepperSlowTurnRpm, int32_t, "STEPPER_SLOW_TURN_RPM", 3, 1, 40, "tag following turn speed, rpm")       \
+    X(driveBackTimeout, int32_t, "DRIVE_BACK_TIMEOUT", 6000, 0, 60000, "drive away from a station, ms")      \
+    X(usMinTrigger, int32_t, "US_MIN_TRIGGER", 7, 1, 100, "obstacle distance, cm")                           \
+    X(usNearTrigger, int32_t, "US_NEAR_TRIGGER", 15, 1, 200, "free distance to go straight, cm")             \
+    X(dockStopDistance, float, "DOCK_STOP_DISTANCE", 2.0, 0, 20, "front distance at the dock, cm")           \
+    X(dockDeceleration, float, "DOCK_DECELERATION", 5.0, 0.5, 50, "docking deceleration, cm/s^2")            \
+    X(dockMaxRpm, int32_t, "DOCK_MAX_RPM", 15, 1, 40, "docking start speed, rpm")                            \
+    X(dockMinRpm, int32_t, "DOCK_MIN_RPM", 2, 1, 40, "docking creep speed, rpm")                             \
+    X(colorDecisionConfidence, float, "COLOR_DECISION_CONFIDENCE", 0.95, 0.5, 1, "cargo class posterior")    \
+    X(colorMinConfidence, float, "COLOR_MIN_CONFIDENCE", 0.8, 0, 1, "cargo accepted as loaded")              \
+    X(colorMonitorDebounce, int32_t, "COLOR_MONITOR_DEBOUNCE", 300, 0, 5000, "cargo change debounce, ms")
+
+#define PARAM_FIELD(field, type, name, def, min, max, help) type field;
+struct Params
+{
+    PARAM_TABLE(PARAM_FIELD)
+};
+#undef PARAM_FIELD
+
+extern Params params;
+
+#define PARAM_MAX_LISTENERS 4
+
+void paramsInit();
+
+unsigned paramCount();
+
+int paramFind(const char *name);
+
+const char *paramName(unsigned index);
+
+float paramGet(unsigned index);
+
+bool paramSet(unsigned index, float value);
+
+void paramsReset();
+
+bool paramsSave();
+
+bool paramOnChange(void (*listener)(unsigned index));
+
+void paramPrint(unsigned index);
\ No newline at end of file
@@ -0,0 +1,49 @@
+#pragma once
+#include <stdint.h>
+
+/**
+ * @brief extended kalman filter for the pose on the floor map (cm, rad),
+ * predicted by the wheel steps and corrected by tag fixes and ultrasonic ranges to mapped walls
+ *
+ */
+struct PoseEstimator
+{
+    float x;
+    float y;
+    float heading;
+    // covariance of x, y and heading
+    float P[3][3];
+    void reset(float x0, float y0, float heading0, float var, float headingVar);
+    void predict(float driven, float turned);
+    bool update(float innovation, const float H[3], float var);
+    int updateTag(float tagX, float tagY, float range, float bearing);
+    bool updateRange(float sensorBearing, float measured, float maxRange);
+};
+
+/**
+ * @brief pose estimate published by the pose estimator task
+ *
+ */
+struct PoseEstimate
+{
+    bool valid;
+    float x;
+    float y;
+    float heading;
+    // upper triangle of the covariance: xx, xy, xh, yy, yh, hh
+    float covariance[6];
+    uint32_t timestamp;
+    uint32_t tagFixes;
+    uint32_t rangeFixes;
+    uint32_t rejected;
+};
+
+void poseEstimatorTask(void *argument);
+
+PoseEstimate poseEstimate();
+
+bool poseEstimatePose(float &x, float &y, float &heading);
+
+void poseEstimatorSet(float x, float y, float heading);
+
+void poseEstimatorPrint();
\ No newline at end of file
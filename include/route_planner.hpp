@@ -0,0 +1,9 @@
+#pragma once
+
+struct Waypoint
+{
+    float x;
+    float y;
+};
+
+int planRoute(float fromX, float fromY, float toX, float toY, Waypoint *waypoints, int maxWaypoints);
@@ -0,0 +1,195 @@
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+
+const uint8_t PREAMBLE[3] = {0x41, 0x47, 0x56};
+
+/*!
+ * station <-> AGV messages on UDP_COMM_PORT, all fields little endian.
+ * Every message starts with a commHeader and ends with a CRC-16/CCITT of all
+ * bytes before it. Every message except an ack is acknowledged by the receiver
+ * with a commAck of the same session and sequence and retransmitted until then.
+ */
+#define COMM_PROTOCOL_VERSION 3
+
+/*! robot id of station messages addressed to every robot */
+#define COMM_ALL_ROBOTS 0xFF
+
+enum commType
+{
+    COMM_AGV_STATUS = 1,
+    COMM_STATION_STATUS = 2,
+    COMM_MISSION = 3,
+    COMM_ACK = 4,
+    COMM_SLOT_REQUEST = 5,
+    COMM_SLOT_RELEASE = 6,
+    COMM_SLOT_STATE = 7,
+    COMM_PARAM_SET = 8,
+};
+
+/*!
+ * reservation of a station: the robot requests the slot before docking,
+ * the station answers with granted or queued and grants it later to the
+ * queued robots in order, the robot releases it after driving away
+ */
+enum slotState
+{
+    SLOT_NONE,
+    SLOT_REQUESTED,
+    SLOT_GRANTED,
+    SLOT_QUEUED,
+};
+
+#define COMM_MAX_MSG 16
+#define COMM_RETRY_MIN 40 // ms until the first retransmit, doubles with every retry
+#define COMM_RETRY_MAX 640
+#define COMM_MAX_RETRIES 8
+#define COMM_REPLAY_WINDOW 32 // sequences behind the newest one that are still accepted once
+#define COMM_OUTBOX_LENGTH 4
+
+struct __attribute__((packed)) commHeader
+{
+    uint8_t preamble[3];
+    uint8_t version;
+    uint8_t type;
+    // sending robot or the addressed robot for station messages
+    uint8_t robot;
+    // random per boot, a new session resets the duplicate detection of the receiver
+    uint8_t session;
+    uint16_t sequence;
+};
+
+struct __attribute__((packed)) agvMsg
+{
+    commHeader header;
+    uint8_t station;
+    uint8_t robotStatus;
+    uint8_t cargo;
+    uint8_t request;
+    uint16_t crc;
+};
+
+struct __attribute__((packed)) stationMsg
+{
+    commHeader header;
+    uint8_t station;
+    uint8_t stationStatus;
+    uint16_t crc;
+};
+
+/*! queues a mission leg, station 0xFF means any station */
+struct __attribute__((packed)) missionMsg
+{
+    commHeader header;
+    uint8_t mission;
+    uint8_t station;
+    uint16_t crc;
+};
+
+/*! request, release or the state of a slot, position is the place in the queue */
+struct __attribute__((packed)) slotMsg
+{
+    commHeader header;
+    uint8_t station;
+    uint8_t state;
+    uint8_t position;
+    uint16_t crc;
+};
+
+/*! changes a runtime parameter, index is the position in PARAM_TABLE */
+struct __attribute__((packed)) paramMsg
+{
+    commHeader header;
+    uint8_t index;
+    float value;
+    uint16_t crc;
+};
+
+/*! acknowledges the message with the session and sequence of the header, robot is the acknowledging robot */
+struct __attribute__((packed)) commAck
+{
+    commHeader header;
+    uint8_t ackedType;
+    uint16_t crc;
+};
+
+/**
+ * @brief reliable sending of the latest message, a new message replaces an unacknowledged one
+ *
+ */
+struct CommSender
+{
+    uint8_t robot;
+    uint8_t session;
+    uint16_t nextSequence;
+    bool pending;
+    uint8_t buffer[COMM_MAX_MSG];
+    size_t length;
+    uint32_t nextSend;
+    uint32_t backoff;
+    unsigned retries;
+    // statistics
+    uint32_t sent;
+    uint32_t retransmits;
+    uint32_t acked;
+    uint32_t dropped;
+};
+
+/**
+ * @brief reliable sending of every message in order, the next message is sealed once the previous one
+ * was acknowledged or its retries ran out
+ *
+ */
+struct CommOutbox
+{
+    CommSender sender;
+    uint8_t messages[COMM_OUTBOX_LENGTH][COMM_MAX_MSG];
+    uint8_t lengths[COMM_OUTBOX_LENGTH];
+    uint8_t types[COMM_OUTBOX_LENGTH];
+    unsigned head;
+    unsigned count;
+};
+
+/**
+ * @brief duplicate detection of the messages of one peer, a message that arrives after a newer one
+ * is still accepted once if it is within COMM_REPLAY_WINDOW of the newest sequence
+ *
+ */
+struct CommReceiver
+{
+    bool synced;
+    uint8_t session;
+    uint16_t lastSequence;
+    // bit n is set if lastSequence - n was accepted
+    uint32_t window;
+    // statistics
+    uint32_t accepted;
+    uint32_t late;
+    uint32_t duplicates;
+};
+
+uint16_t commCrc(const uint8_t *data, size_t length);
+
+void commSeal(uint8_t *msg, size_t length, uint8_t type, uint8_t robot, uint8_t session, uint16_t sequence);
+
+size_t commMessageSize(uint8_t type);
+
+bool commCheck(const uint8_t *data, size_t length, uint8_t &type);
+
+void commAckFor(const commHeader &header, uint8_t robot, commAck &ack);
+
+void commSenderInit(CommSender &sender, uint8_t robot, uint8_t session);
+
+void commSenderQueue(CommSender &sender, uint8_t *msg, size_t length, uint8_t type, uint32_t now);
+
+bool commSenderPoll(CommSender &sender, uint32_t now);
+
+bool commSenderAck(CommSender &sender, const commAck &ack);
+
+void commOutboxInit(CommOutbox &outbox, uint8_t robot, uint8_t session);
+
+bool commOutboxQueue(CommOutbox &outbox, const uint8_t *msg, size_t length, uint8_t type);
+
+bool commOutboxPoll(CommOutbox &outbox, uint32_t now);
+
+bool commReceiverAccept(CommReceiver &receiver, const commHeader &header);
\ No newline at end of file
@@ -10,6 +10,10 @@ void stepperStartTurnRight(unsigned int rpm = 0);
 
 void stepperStartStraight(unsigned int rpm = 0);
 
+void stepperSetStraightRpm(unsigned int rpm);
+
+void stepperStartCurve(float curvature, unsigned int rpm = 0);
+
 void stepperStartBackwards(unsigned int rpm = 0);
 
 void stepperStop();
@@ -22,4 +26,16 @@ void setRpmStepperR(int rpm);
 
 void stepperUpdate();
 
-unsigned long returnSteps();
\ No newline at end of file
+void printStepTiming(bool reset);
+
+unsigned stepperState();
+
+unsigned long returnSteps();
+
+long stepperHeadingSteps();
+
+void stepperPose(float &x, float &y, float &heading);
+
+void stepperSetPose(float x, float y, float heading);
+
+float stepperDistance();
\ No newline at end of file
@@ -0,0 +1,14 @@
+#pragma once
+#include "telemetry.hpp"
+
+unsigned profilerRegister();
+
+void profilerLoop(unsigned slot);
+
+void profilerSample();
+
+void profilerPrint();
+
+const telemetryProfile &profilerSnapshot();
+
+unsigned profilerSnapshotSize();
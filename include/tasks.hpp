@@ -0,0 +1,48 @@
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+
+/*!
+ * every task of the firmware with its stack in bytes, priority and core, the stacks and
+ * task control blocks are static so they are part of the memory budget of the build and
+ * nothing is taken from the heap. The stack sizes are estimates that were not measured yet:
+ * after a full mission copy the "size" column of "mem" (peak use + TASK_STACK_MARGIN) here.
+ * Core 0 runs the network side next to wifi and lwip (priority 18 and up), core 1 the
+ * motion side with the step timing first, then the sensors and the pose estimate and the
+ * control loop they feed. A task must block or sleep in every loop iteration, vTaskDelay(0) only
+ * yields to tasks of the same priority.
+ * The placement only separates the network work from the motion work, it makes no claim
+ * about the control loop or step timing jitter, none was measured ("timing" reports it).
+ * X(id, name, stack, priority, core)
+ */
+#define TASK_TABLE(X)                                            \
+    X(TASK_TAG_PARSE, "tagParseTask", 2560, 5, 0)                \
+    X(TASK_UDP_COMM, "udpCommTask", 3072, 4, 0)                  \
+    X(TASK_UDP_TIMEOUT, "udpTimeoutTask", 4096, 3, 0)            \
+    X(TASK_TELEMETRY_STREAM, "telemetryStreamTask", 3072, 2, 0)  \
+    X(TASK_LOG, "logTask", 3072, 1, 0)                           \
+    X(TASK_STEPPERS_CONTROL, "steppersControlTask", 3072, 6, 1)  \
+    X(TASK_ULTRASONIC, "ultrasonicTask", 2560, 5, 1)             \
+    X(TASK_POSE_ESTIMATOR, "poseEstimatorTask", 3072, 5, 1)      \
+    X(TASK_CONTROL_CAR, "controlCarTask", 4096, 4, 1)            \
+    X(TASK_COLOR_SAMPLER, "colorSamplerTask", 3072, 3, 1)
+
+#define TASK_ID(id, name, stack, priority, core) id,
+enum taskId
+{
+    TASK_TABLE(TASK_ID)
+    TASK_COUNT
+};
+#undef TASK_ID
+
+TaskHandle_t taskStart(taskId id, TaskFunction_t function);
+
+TaskHandle_t taskHandle(taskId id);
+
+const char *taskName(taskId id);
+
+void memoryCheck();
+
+void memoryPrint();
\ No newline at end of file
@@ -0,0 +1,124 @@
+#pragma once
+#include <stdint.h>
+
+/*!
+ * records broadcast on UDP_TELEMETRY_PORT, all fields little endian,
+ * every record starts with the PREAMBLE followed by the record type
+ */
+enum telemetryRecord
+{
+    TELEMETRY_PROFILE = 1,
+    TELEMETRY_STATE = 2,
+};
+
+#define TELEMETRY_MAX_TASKS 24
+#define TELEMETRY_TASK_NAME 16
+
+struct __attribute__((packed)) telemetryHeader
+{
+    uint8_t preamble[3];
+    uint8_t type;
+    uint32_t uptime;
+};
+
+struct __attribute__((packed)) telemetryTask
+{
+    char name[TELEMETRY_TASK_NAME];
+    uint16_t cpuPermille;
+    uint16_t stackFree;
+    uint8_t core;
+    uint8_t priority;
+    uint32_t loops;
+};
+
+struct __attribute__((packed)) telemetryProfile
+{
+    telemetryHeader header;
+    uint32_t heapFree;
+    uint32_t heapMinFree;
+    uint8_t numTasks;
+    telemetryTask tasks[TELEMETRY_MAX_TASKS];
+};
+
+/*!
+ * a state record only carries the fields that changed since the previous record,
+ * every TELEMETRY_KEYFRAME_INTERVAL records all fields are sent.
+ * The fields follow the telemetryStateHeader in the order of their mask bits
+ */
+enum telemetryStateField
+{
+    TELEMETRY_FIELD_US = 1 << 0,
+    TELEMETRY_FIELD_TAG = 1 << 1,
+    TELEMETRY_FIELD_STEPPER = 1 << 2,
+    TELEMETRY_FIELD_POSE = 1 << 3,
+    TELEMETRY_FIELD_MISSION = 1 << 4,
+    TELEMETRY_FIELD_TIMING = 1 << 5,
+};
+
+#define TELEMETRY_NUM_FIELDS 6
+#define TELEMETRY_ALL_FIELDS ((1 << TELEMETRY_NUM_FIELDS) - 1)
+#define TELEMETRY_KEYFRAME_INTERVAL 50
+
+struct __attribute__((packed)) telemetryStateHeader
+{
+    telemetryHeader header;
+    uint16_t sequence;
+    uint8_t fields;
+};
+
+/*! ultrasonic distances in mm */
+struct __attribute__((packed)) telemetryUs
+{
+    uint16_t distance[5];
+};
+
+/*! tag center in pixels and size in 1/100 pixels, center 0 means no tag in view */
+struct __attribute__((packed)) telemetryTag
+{
+    uint16_t center;
+    uint16_t size;
+    uint16_t frame;
+};
+
+struct __attribute__((packed)) telemetryStepper
+{
+    uint8_t state;
+    uint32_t steps;
+    int32_t headingSteps;
+};
+
+/*! odometry pose in mm and mrad */
+struct __attribute__((packed)) telemetryPose
+{
+    int16_t x;
+    int16_t y;
+    int16_t heading;
+};
+
+struct __attribute__((packed)) telemetryMission
+{
+    uint8_t mission;
+    uint8_t robotStatus;
+    uint8_t cargo;
+    uint8_t request;
+    uint8_t station; // tag id of the target station, 0xFF for any station
+    uint8_t queued;
+};
+
+/*! last control loop period and deadline misses */
+struct __attribute__((packed)) telemetryTiming
+{
+    uint32_t periodUs;
+    uint32_t misses;
+};
+
+struct __attribute__((packed)) telemetryState
+{
+    telemetryStateHeader header;
+    telemetryUs us;
+    telemetryTag tag;
+    telemetryStepper stepper;
+    telemetryPose pose;
+    telemetryMission mission;
+    telemetryTiming timing;
+};
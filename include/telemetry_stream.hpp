@@ -0,0 +1,7 @@
+#pragma once
+
+void telemetryStreamInit();
+
+bool telemetryStreamSetRate(unsigned hz);
+
+void telemetryStreamPrint();
\ No newline at end of file
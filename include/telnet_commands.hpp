@@ -0,0 +1,38 @@
+#pragma once
+
+#define COMMAND_MAX_LINE 96
+#define COMMAND_MAX_ARGS 8
+
+/**
+ * @brief tokenized command line, the words point into a static copy of the line
+ *
+ */
+struct CommandArgs
+{
+    unsigned count;
+    const char *words[COMMAND_MAX_ARGS];
+    // the untokenized text after the command name
+    const char *rest;
+};
+
+/**
+ * @brief a telnet command, the handler returns NULL on success or an error message
+ *
+ */
+struct Command
+{
+    const char *name;
+    const char *usage;
+    const char *help;
+    unsigned minArgs;
+    unsigned maxArgs;
+    const char *(*handler)(const CommandArgs &args);
+};
+
+bool argInt(const CommandArgs &args, unsigned index, long &value, long min, long max);
+
+bool argFloat(const CommandArgs &args, unsigned index, float &value, float min, float max);
+
+bool argIs(const CommandArgs &args, unsigned index, const char *word);
+
+void commandExecute(const char *line);
\ No newline at end of file
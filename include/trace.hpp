@@ -0,0 +1,42 @@
+#pragma once
+#include <stdint.h>
+
+/*!
+ * latency trace from a camera frame to the wheels: every stage records its event
+ * with the frame as correlation id into a ring, "trace dump" prints the ring and
+ * tools/trace_to_chrome.py turns the dump into a Chrome/Perfetto trace.
+ * A frame is numbered when its packet is received, the decisions refer to the
+ * newest parsed frame and the motor commands to the newest decision.
+ */
+enum traceEvent
+{
+    TRACE_UDP_RECEIVE = 1,
+    TRACE_TAG_PARSED = 2,
+    TRACE_DECISION = 3,
+    TRACE_MOTOR_COMMAND = 4,
+    TRACE_FIRST_STEP = 5,
+};
+
+struct __attribute__((packed)) traceRecord
+{
+    uint32_t time; // micros
+    uint16_t correlation;
+    uint8_t event;
+    uint8_t core;
+};
+
+void trace(uint8_t event, uint16_t correlation);
+
+uint16_t traceLast(uint8_t event);
+
+uint16_t traceReceive();
+
+void traceDecision();
+
+uint16_t traceMotorCommand();
+
+void traceDump();
+
+void traceClear();
+
+void tracePrint();
\ No newline at end of file
@@ -0,0 +1,41 @@
+#pragma once
+#include <stdint.h>
+#include "defines.hpp"
+
+/**
+ * @brief polar histogram of the obstacle density around the robot (vector field histogram),
+ * the sectors are map directions so readings are kept while the robot turns
+ *
+ */
+struct VfhHistogram
+{
+    float density[VFH_SECTORS];
+    bool blocked[VFH_SECTORS];
+    // odometry distance of the last decay in cm
+    float distance;
+    // direction steered to last in rad, NAN before the first step
+    float lastDirection;
+};
+
+/**
+ * @brief steering command of one avoidance step
+ *
+ */
+struct VfhCommand
+{
+    bool blocked;    // no free direction, back off
+    float direction; // chosen direction in rad, map frame
+    float curvature; // 1/cm, positive is left
+    int spin;        // turn on the spot first: 1 left, -1 right, 0 drive the curve
+    float speed;     // share of the maximum speed
+};
+
+void vfhReset(VfhHistogram &h, float distance);
+
+void vfhDecay(VfhHistogram &h, float distance);
+
+void vfhUpdate(VfhHistogram &h, float direction, float range);
+
+VfhCommand vfhSteer(VfhHistogram &h, float heading, float goal);
+
+bool vfhFree(const VfhHistogram &h, float direction);
\ No newline at end of file
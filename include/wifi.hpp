@@ -1,11 +1,13 @@
 #pragma once
+#include "station_protocol.hpp"
 
 enum robotStatus
 {
     ROBOT_IDLE,
     ROBOT_APPROACHING_STATION,
     ROBOT_STOPPED_NEAR_STATION,
-    ROBOT_DRIVING_AWAY
+    ROBOT_DRIVING_AWAY,
+    ROBOT_WAITING_FOR_SLOT
 };
 
 enum stationStatus
@@ -31,25 +33,25 @@ enum request
     REQUEST_LOAD_BALL
 };
 
-const uint8_t PREAMBLE[3] = {0x41, 0x47, 0x56};
-
-struct agvMsg
-{
-    uint8_t preamble[3];
-    uint8_t robotStatus;
-    uint8_t cargo;
-    uint8_t request;
-};
-
-struct stationMsg
-{
-    uint8_t preamble[3];
-    uint8_t stationStatus;
-};
-
 void wifiSetup();
 
 unsigned getNumClients();
 
 void sendAgvPck(uint8_t status, uint8_t cargo, uint8_t request);
 
+void agvStatusChanged();
+
+void stationSlotRequest(int station);
+
+void stationSlotRelease();
+
+uint8_t stationSlot(int station);
+
+void sendTelemetry(const uint8_t *data, size_t length);
+
+void sendLog(const char *line, size_t length);
+
+void sendBlackBox(const uint8_t *data, size_t length);
+
+void commPrint();
+
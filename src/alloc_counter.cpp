@@ -0,0 +1,165 @@
+#include <Arduino.h>
+#include <atomic>
+#include "defines.hpp"
+#include "tasks.hpp"
+#include "alloc_counter.hpp"
+#include "log.hpp"
+#include "telnet_debug.hpp"
+
+#ifdef ALLOC_COUNTER
+extern "C"
+{
+    void *__real_malloc(size_t size);
+    void *__real_calloc(size_t number, size_t size);
+    void *__real_realloc(void *pointer, size_t size);
+}
+
+namespace
+{
+    // one counter per task of TASK_TABLE and the last one for all other tasks (wifi, lwip, idle, loop)
+    const unsigned OTHER = TASK_COUNT;
+    std::atomic<uint32_t> allocations[TASK_COUNT + 1];
+    // allocations inside allocExempt, the lwip packet buffers of a send
+    std::atomic<uint32_t> exempted[TASK_COUNT + 1];
+    bool exempt[TASK_COUNT + 1];
+    uint32_t lastAllocations[TASK_COUNT + 1];
+    // allocations per second in the last sample period
+    uint32_t rates[TASK_COUNT + 1];
+    uint32_t lastSample = 0;
+    bool warned[TASK_COUNT];
+
+    // tasks that must not allocate in steady state, except for the lwip buffer of a send inside allocExempt
+    const taskId allocationFree[] = {TASK_TAG_PARSE, TASK_UDP_COMM, TASK_ULTRASONIC, TASK_STEPPERS_CONTROL,
+                                   TASK_POSE_ESTIMATOR, TASK_CONTROL_CAR, TASK_COLOR_SAMPLER};
+
+    unsigned taskIndex()
+    {
+        TaskHandle_t self = xTaskGetCurrentTaskHandle();
+        unsigned i = 0;
+        while (i < TASK_COUNT && (self == NULL || taskHandle((taskId)i) != self))
+        {
+            i++;
+        }
+        return i;
+    }
+
+    void count()
+    {
+        unsigned i = taskIndex();
+        (exempt[i] ? exempted[i] : allocations[i]).fetch_add(1, std::memory_order_relaxed);
+    }
+}
+
+/*!
+ * linked in place of malloc, calloc and realloc with -Wl,--wrap, this also covers the
+ * allocations of the framework libraries and of operator new
+ */
+extern "C"
+{
+    void *__wrap_malloc(size_t size)
+    {
+        count();
+        return __real_malloc(size);
+    }
+
+    void *__wrap_calloc(size_t number, size_t size)
+    {
+        count();
+        return __real_calloc(number, size);
+    }
+
+    void *__wrap_realloc(void *pointer, size_t size)
+    {
+        count();
+        return __real_realloc(pointer, size);
+    }
+}
+#endif
+
+/**
+ * @brief count the allocations of the calling task separately until allocExempt(false),
+ * for the packet buffer lwip allocates on every send
+ *
+ */
+void allocExempt(bool on)
+{
+#ifdef ALLOC_COUNTER
+    exempt[taskIndex()] = on;
+#endif
+}
+
+/**
+ * @brief update the allocation rates, warn once when an allocation free task allocates
+ * after ALLOC_SETTLE_TIME, called every PROFILER_PERIOD
+ *
+ */
+void allocSample()
+{
+#ifdef ALLOC_COUNTER
+    uint32_t now = millis();
+    uint32_t elapsed = now - lastSample;
+    if (elapsed == 0)
+    {
+        return;
+    }
+    uint32_t delta[TASK_COUNT + 1];
+    for (unsigned i = 0; i <= TASK_COUNT; i++)
+    {
+        uint32_t total = allocations[i].load(std::memory_order_relaxed);
+        delta[i] = total - lastAllocations[i];
+        rates[i] = (uint64_t)delta[i] * 1000 / elapsed;
+        lastAllocations[i] = total;
+    }
+    lastSample = now;
+    if (now < ALLOC_SETTLE_TIME)
+    {
+        return;
+    }
+    for (taskId id : allocationFree)
+    {
+        if (delta[id] > 0 && !warned[id])
+        {
+            warned[id] = true;
+            LOG_WARN("%s allocated %u times in steady state", taskName(id), delta[id]);
+        }
+    }
+#endif
+}
+
+/**
+ * @brief print the allocations per task to telnet
+ *
+ */
+void allocPrint()
+{
+#ifdef ALLOC_COUNTER
+    telnet.println("task                 allocs/s     total      lwip");
+    for (unsigned i = 0; i <= TASK_COUNT; i++)
+    {
+        telnet.printf("%-20s %8u %9u %9u\n", i == OTHER ? "other" : taskName((taskId)i), rates[i],
+                      allocations[i].load(std::memory_order_relaxed), exempted[i].load(std::memory_order_relaxed));
+    }
+    telnet.printf("steady state allocation free: %s\n", allocSteadyOffender() ? "NO" : "yes");
+#else
+    telnet.println("allocation counter not built, use the lolin32_lite_alloc environment");
+#endif
+}
+
+/**
+ * @brief the first allocation free task that allocated after ALLOC_SETTLE_TIME
+ *
+ * @return its name, NULL if there is none or the counter is not built
+ */
+const char *allocSteadyOffender()
+{
+#ifdef ALLOC_COUNTER
+    for (taskId id : allocationFree)
+    {
+        if (warned[id])
+        {
+            return taskName(id);
+        }
+    }
+#endif
+    return NULL;
+}
\ No newline at end of file
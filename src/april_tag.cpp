@@ -1,7 +1,14 @@
 #include <Arduino.h>
 #include "april_tag.hpp"
 #include "defines.hpp"
+#include "log.hpp"
+#include "black_box.hpp"
+#include "trace.hpp"
+#include "tasks.hpp"
 #include "telnet_debug.hpp"
+#include "mission_queue.hpp"
+#include "stepper_motor.hpp"
+#include "task_profiler.hpp"
 
 namespace
 {
@@ -10,22 +17,105 @@ namespace
     const uint8_t version[4] = {0x00, 0x01, 0x00, 0x02};
     unsigned long timeoutTimer = 0;
     unsigned long tagLastSeen = 0;
+    // tag position and robot heading of the last frame that contained the target tag
+    unsigned tagLastCenter = 0;
+    long tagLastHeading = 0;
+
+    // id, hamming and ncodes, center, corners and homography
+    const size_t APRIL_TAG_SIZE = 4 * (3 + 2 + 8 + 9);
+
+    /**
+     * @brief the newest packet not parsed yet, written by the udp handler
+     *
+     */
+    struct TagMailbox
+    {
+        uint8_t data[APRIL_MAX_PACKET];
+        size_t length;
+        uint16_t frame;
+    };
+    TagMailbox mailbox;
+    portMUX_TYPE mailboxMux = portMUX_INITIALIZER_UNLOCKED;
+    // the packet being parsed
+    TagMailbox parsing;
+
+    void tagParseTask(void *argument)
+    {
+        Serial.print("tagParseTask is running on: ");
+        Serial.println(xPortGetCoreID());
+        unsigned profilerSlot = profilerRegister();
+
+        for (;;)
+        {
+            profilerLoop(profilerSlot);
+            ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+            portENTER_CRITICAL(&mailboxMux);
+            parsing.length = mailbox.length;
+            parsing.frame = mailbox.frame;
+            memcpy(parsing.data, mailbox.data, mailbox.length);
+            mailbox.length = 0;
+            portEXIT_CRITICAL(&mailboxMux);
+            if (parsing.length > 0)
+            {
+                parseApril(parsing.data, parsing.length, parsing.frame);
+            }
+        }
+        Serial.println("tagParseTask closed");
+        vTaskDelete(NULL);
+    }
 };
 
 unsigned volatile int detectTagCenter = 0;
 double detectTagSize = 0;
 int numTags = 0;
 bool udpConnection = false;
+// number of received frames that contained the target tag
+volatile unsigned tagFrameCounter = 0;
+// only tags with this id are followed, ANY_STATION follows every tag
+volatile int targetTagId = ANY_STATION;
+// id of the last followed tag
+volatile int detectTagId = ANY_STATION;
 
 void testTimeout()
 {
     if (udpConnection && millis() - timeoutTimer > UDP_TIMEOUT)
     {
-        DEBUG_MSG("UDP timeout");
+        LOG_WARN("UDP timeout");
         udpConnection = false;
     }
 }
 
+/**
+ * @brief get the bearing of the last seen tag relative to the current heading,
+ * combining the side of TAG_CENTER it was last seen on with the turns made since
+ *
+ * @param bearing receives the bearing in stepper steps, positive is left
+ * @return false if no tag was seen within TAG_MEMORY_TIMEOUT
+ */
+bool tagLastBearing(long &bearing)
+{
+    if (tagLastCenter == 0 || millis() - tagLastSeen > TAG_MEMORY_TIMEOUT)
+    {
+        return false;
+    }
+    // a tag left of TAG_CENTER in the image is right of the robot
+    long imageBearing = ((long)tagLastCenter - TAG_CENTER) * (STEPS_360 * CAMERA_FOV / 360) / (2 * TAG_CENTER);
+    bearing = imageBearing - (stepperHeadingSteps() - tagLastHeading);
+    return true;
+}
+
+/**
+ * @brief bearing of a tag from the camera axis
+ *
+ * @param center tag center in px
+ * @return bearing in rad, positive is left
+ */
+float tagCenterBearing(unsigned center)
+{
+    // a tag left of TAG_CENTER in the image is right of the robot
+    return ((float)center - TAG_CENTER) * (CAMERA_FOV * PI / 180) / (2 * TAG_CENTER);
+}
+
 /**
  * @brief print the content of an AprilTag packet to the serial monitor
  *
@@ -75,7 +165,7 @@ double AprilTag::size()
  * @param buffer a pointer to an array of uint8_t
  * @return int
  */
-int buffToInteger(uint8_t *buffer)
+int buffToInteger(const uint8_t *buffer)
 {
     int i = 0;
     uint8_t *iPtr = (uint8_t *)&i;
@@ -92,7 +182,7 @@ int buffToInteger(uint8_t *buffer)
  * @param buffer a pointer to an array of uint8_t
  * @return int
  */
-float buffToFloat(uint8_t *buffer)
+float buffToFloat(const uint8_t *buffer)
 {
     float f;
     uint8_t *fPtr = (uint8_t *)&f;
@@ -109,7 +199,7 @@ float buffToFloat(uint8_t *buffer)
  * @param packet a AsyncUDPPacket
  * @return true or false
  */
-bool testApril(AsyncUDPPacket packet)
+bool testApril(AsyncUDPPacket &packet)
 {
     if (packet.length() < 24)
     {
@@ -140,32 +230,35 @@ bool testApril(AsyncUDPPacket packet)
 }
 
 /**
- * @brief parse a AsyncUDPPacket packet containing AprilTag data
+ * @brief parse a frame of AprilTag data that passed testApril
  *
- * @param packet a AsyncUDPPacket
+ * @param frame the trace correlation of the frame
  */
-void parseApril(AsyncUDPPacket packet)
+void parseApril(const uint8_t *data, size_t length, uint16_t frame)
 {
     if (!udpConnection)
     {
-        DEBUG_MSG("udp connected");
+        LOG_INFO("udp connected");
         udpConnection = true;
     }
     timeoutTimer = millis();
     // Serial.println("April Packet: ");
-    for (int i = 12; i < packet.length(); i++)
+    for (int i = 12; i < length; i++)
     {
-        // Serial.print(packet.data()[i], HEX);
+        // Serial.print(data[i], HEX);
         // Serial.print(":");
     }
     // Serial.println();
-    numTags = buffToInteger(packet.data() + 12);
+    numTags = buffToInteger(data + 12);
+    // ignore tags cut off by the end of the packet
+    numTags = min(numTags, (int)((length - 24) / APRIL_TAG_SIZE));
     double tagCenterTotal = 0;
     double tagSizetotal = 0;
+    int numTargetTags = 0;
+    int target = targetTagId;
     if (numTags > 0)
     {
-        tagLastSeen = millis();
-        uint8_t *tagPTemp = packet.data() + 24;
+        const uint8_t *tagPTemp = data + 24;
         for (int i = 0; i < numTags; i++)
         {
             AprilTag aTag;
@@ -192,21 +285,66 @@ void parseApril(AsyncUDPPacket packet)
                 aTag.H[i] = buffToFloat(tagPTemp);
                 tagPTemp += 4;
             }
+            if (target != ANY_STATION && aTag.id != target)
+            {
+                continue;
+            }
+            numTargetTags++;
+            detectTagId = aTag.id;
             tagCenterTotal += aTag.c[1];
             tagSizetotal += aTag.size();
             // Serial.printf("tagsizetotal: %f\n", tagSizetotal);
             //]aTag.print();
         }
-        detectTagCenter = tagCenterTotal / numTags;
-        detectTagSize = tagSizetotal / numTags;
+    }
+    if (numTargetTags > 0)
+    {
+        tagLastSeen = millis();
+        tagLastHeading = stepperHeadingSteps();
+        detectTagCenter = tagCenterTotal / numTargetTags;
+        tagLastCenter = detectTagCenter;
+        tagFrameCounter++;
+        detectTagSize = tagSizetotal / numTargetTags;
+        blackBoxTag(detectTagCenter, detectTagSize, detectTagId);
         // Serial.printf("detectTagSize: %f\n", detectTagSize);
     }
     else
     {
         if (detectTagCenter != 0 && millis() - tagLastSeen > TAG_LAST_SEEN_TIMEOUT)
         {
-            DEBUG_MSG("detectTagSeen timeout");
+            LOG_WARN("detectTagSeen timeout");
             detectTagCenter = 0;
+            blackBoxTag(0, detectTagSize, detectTagId);
         }
     }
+    trace(TRACE_TAG_PARSED, frame);
+}
+
+/**
+ * @brief hand a packet that passed testApril over to tagParseTask,
+ * a frame that was not parsed yet is replaced as only the newest one matters
+ *
+ * @param frame the trace correlation of the packet
+ */
+void aprilTagPost(const uint8_t *data, size_t length, uint16_t frame)
+{
+    if (length > APRIL_MAX_PACKET)
+    {
+        return;
+    }
+    portENTER_CRITICAL(&mailboxMux);
+    memcpy(mailbox.data, data, length);
+    mailbox.length = length;
+    mailbox.frame = frame;
+    portEXIT_CRITICAL(&mailboxMux);
+    xTaskNotifyGive(taskHandle(TASK_TAG_PARSE));
+}
+
+/**
+ * @brief start the task parsing the AprilTag packets next to the network stack
+ *
+ */
+void aprilTagInit()
+{
+    taskStart(TASK_TAG_PARSE, tagParseTask);
 }
\ No newline at end of file
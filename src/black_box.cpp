@@ -0,0 +1,476 @@
+#include <Arduino.h>
+#include "esp_partition.h"
+#include "defines.hpp"
+#include "black_box.hpp"
+#include "params.hpp"
+#include "wifi.hpp"
+#include "telnet_debug.hpp"
+
+namespace
+{
+    blackBoxRecord ring[BLACK_BOX_SIZE];
+    uint32_t written = 0;
+    uint16_t sequence = 0;
+    // records lost because a dump was running, they still use up their sequence
+    uint32_t dropped = 0;
+    bool frozen = false;
+    // inputs that changed while frozen: bit 0 the tag, bit 1 + n ultrasonic sensor n
+    unsigned unrecorded = 0;
+    portMUX_TYPE mux = portMUX_INITIALIZER_UNLOCKED;
+
+    // inputs as of the last input record
+    ControlInputs inputs;
+    int16_t tagId = 0;
+    // UINT16_MAX is the sequence before the first record
+    uint16_t lastInput = UINT16_MAX;
+    // inputs as of the oldest record in the ring and the sequence of the input record before it
+    ControlInputs baseInputs;
+    int16_t baseTagId = 0;
+    uint16_t baseInput = UINT16_MAX;
+    // the last recorded decision, repeated decisions on the same inputs are skipped
+    blackBoxRecord lastDecision;
+
+    float paramValues[BLACK_BOX_MAX_PARAMS];
+
+    const uint32_t FLASH_MAGIC = 0x42424f58;
+    struct FlashHeader
+    {
+        uint32_t magic;
+        uint32_t count;
+    };
+
+    /**
+     * @brief store a record, the caller holds mux
+     *
+     * @return the sequence of the record
+     */
+    uint16_t append(blackBoxRecord &record)
+    {
+        if (written >= BLACK_BOX_SIZE)
+        {
+            // the overwritten record becomes part of the inputs before the ring
+            const blackBoxRecord &old = ring[written % BLACK_BOX_SIZE];
+            if (old.type == BB_TAG)
+            {
+                baseInputs.tagCenter = old.tag.center;
+                baseInputs.tagSize = old.tag.size;
+                baseTagId = old.tag.id;
+                baseInput = old.sequence;
+            }
+            else if (old.type == BB_US && old.arg < NUM_SENSORS)
+            {
+                baseInputs.us[old.arg] = old.distance;
+                baseInput = old.sequence;
+            }
+        }
+        record.time = millis();
+        record.sequence = sequence++;
+        ring[written % BLACK_BOX_SIZE] = record;
+        written++;
+        return record.sequence;
+    }
+
+    /**
+     * @brief account for a record that is not stored while frozen, the caller holds mux
+     *
+     * @return the sequence the record would have had
+     */
+    uint16_t skip()
+    {
+        dropped++;
+        return sequence++;
+    }
+
+    void record(blackBoxRecord &record)
+    {
+        portENTER_CRITICAL(&mux);
+        if (frozen)
+        {
+            skip();
+        }
+        else
+        {
+            append(record);
+        }
+        portEXIT_CRITICAL(&mux);
+    }
+
+    /**
+     * @brief append a record of the current tag input, the caller holds mux
+     *
+     */
+    uint16_t appendTag()
+    {
+        blackBoxRecord r = {};
+        r.type = BB_TAG;
+        r.tag.center = inputs.tagCenter;
+        r.tag.size = inputs.tagSize;
+        r.tag.id = tagId;
+        return append(r);
+    }
+
+    /**
+     * @brief append a record of the current reading of an ultrasonic sensor, the caller holds mux
+     *
+     */
+    uint16_t appendUs(unsigned sensor)
+    {
+        blackBoxRecord r = {};
+        r.type = BB_US;
+        r.arg = sensor;
+        r.distance = inputs.us[sensor];
+        return append(r);
+    }
+
+    /**
+     * @brief resume recording, the inputs that changed while frozen are recorded with their current value
+     *
+     */
+    void unfreeze()
+    {
+        portENTER_CRITICAL(&mux);
+        frozen = false;
+        if (unrecorded & 1)
+        {
+            lastInput = appendTag();
+        }
+        for (unsigned i = 0; i < NUM_SENSORS; i++)
+        {
+            if (unrecorded & 1 << (i + 1))
+            {
+                lastInput = appendUs(i);
+            }
+        }
+        unrecorded = 0;
+        portEXIT_CRITICAL(&mux);
+    }
+
+    void onParamChanged(unsigned index)
+    {
+        if (index >= BLACK_BOX_MAX_PARAMS)
+        {
+            return;
+        }
+        blackBoxRecord r = {};
+        r.type = BB_PARAM;
+        r.arg = index;
+        r.param.oldValue = paramValues[index];
+        r.param.newValue = paramGet(index);
+        paramValues[index] = r.param.newValue;
+        record(r);
+    }
+
+    /**
+     * @brief call emit with the parameter records, the inputs as of the oldest record and then
+     * with the ring from the oldest record, the ring is not appended to meanwhile but the inputs stay current
+     *
+     */
+    template <typename F>
+    void forEachRecord(F emit)
+    {
+        portENTER_CRITICAL(&mux);
+        frozen = true;
+        uint32_t end = written;
+        ControlInputs base = baseInputs;
+        int16_t baseTag = baseTagId;
+        uint16_t baseSequence = baseInput;
+        portEXIT_CRITICAL(&mux);
+        uint32_t start = end > BLACK_BOX_SIZE ? end - BLACK_BOX_SIZE : 0;
+
+        // undo the recorded changes to get the values of the oldest record
+        float values[BLACK_BOX_MAX_PARAMS];
+        memcpy(values, paramValues, sizeof(values));
+        for (uint32_t i = end; i > start; i--)
+        {
+            const blackBoxRecord &r = ring[(i - 1) % BLACK_BOX_SIZE];
+            if (r.type == BB_PARAM && r.arg < BLACK_BOX_MAX_PARAMS)
+            {
+                values[r.arg] = r.param.oldValue;
+            }
+        }
+        uint32_t startTime = start < end ? ring[start % BLACK_BOX_SIZE].time : millis();
+        unsigned count = min(paramCount(), (unsigned)BLACK_BOX_MAX_PARAMS);
+        for (unsigned i = 0; i < count; i++)
+        {
+            blackBoxRecord r = {};
+            r.time = startTime;
+            r.type = BB_PARAM;
+            r.arg = i;
+            r.param.oldValue = values[i];
+            r.param.newValue = values[i];
+            emit(r);
+        }
+        // every input once, all with the sequence of the last input record before the ring
+        blackBoxRecord r = {};
+        r.time = startTime;
+        r.sequence = baseSequence;
+        r.type = BB_TAG;
+        r.tag.center = base.tagCenter;
+        r.tag.size = base.tagSize;
+        r.tag.id = baseTag;
+        emit(r);
+        for (unsigned i = 0; i < NUM_SENSORS; i++)
+        {
+            r = {};
+            r.time = startTime;
+            r.sequence = baseSequence;
+            r.type = BB_US;
+            r.arg = i;
+            r.distance = base.us[i];
+            emit(r);
+        }
+        for (uint32_t i = start; i < end; i++)
+        {
+            emit(ring[i % BLACK_BOX_SIZE]);
+        }
+        unfreeze();
+    }
+
+    void printRecord(const blackBoxRecord &r)
+    {
+        char hex[sizeof(blackBoxRecord) * 2 + 1];
+        const uint8_t *bytes = (const uint8_t *)&r;
+        for (size_t i = 0; i < sizeof(blackBoxRecord); i++)
+        {
+            sprintf(hex + 2 * i, "%02x", bytes[i]);
+        }
+        telnet.printf("bb %s\n", hex);
+    }
+
+    const esp_partition_t *flashPartition()
+    {
+        return esp_partition_find_first(ESP_PARTITION_TYPE_DATA, ESP_PARTITION_SUBTYPE_ANY, BLACK_BOX_PARTITION);
+    }
+}
+
+/**
+ * @brief start recording the parameter changes, the other inputs are recorded by their sources
+ *
+ */
+void blackBoxInit()
+{
+    for (unsigned i = 0; i < paramCount() && i < BLACK_BOX_MAX_PARAMS; i++)
+    {
+        paramValues[i] = paramGet(i);
+    }
+    paramOnChange(onParamChanged);
+}
+
+/**
+ * @brief record a parsed tag frame, call after detectTagCenter and detectTagSize were updated
+ *
+ * @param center 0 if the tag was lost
+ */
+void blackBoxTag(unsigned center, float size, int id)
+{
+    portENTER_CRITICAL(&mux);
+    if (center != inputs.tagCenter || size != inputs.tagSize)
+    {
+        inputs.tagCenter = center;
+        inputs.tagSize = size;
+        tagId = id;
+        if (frozen)
+        {
+            unrecorded |= 1;
+            lastInput = skip();
+        }
+        else
+        {
+            lastInput = appendTag();
+        }
+    }
+    portEXIT_CRITICAL(&mux);
+}
+
+/**
+ * @brief record an ultrasonic reading in cm
+ *
+ */
+void blackBoxUs(unsigned sensor, float distance)
+{
+    portENTER_CRITICAL(&mux);
+    if (sensor < NUM_SENSORS && distance != inputs.us[sensor])
+    {
+        inputs.us[sensor] = distance;
+        if (frozen)
+        {
+            unrecorded |= 1 << (sensor + 1);
+            lastInput = skip();
+        }
+        else
+        {
+            lastInput = appendUs(sensor);
+        }
+    }
+    portEXIT_CRITICAL(&mux);
+}
+
+/**
+ * @brief record the start of a telnet line or a station message
+ *
+ */
+void blackBoxCommand(uint8_t source, const char *data, size_t length)
+{
+    blackBoxRecord r = {};
+    r.type = BB_COMMAND;
+    r.arg = source;
+    memcpy(r.command, data, min(length, sizeof(r.command)));
+    record(r);
+}
+
+/**
+ * @brief record a finished stepper move
+ *
+ * @param state the stepper state of the move
+ * @param steps driven
+ */
+void blackBoxStepper(uint8_t state, long steps)
+{
+    blackBoxRecord r = {};
+    r.type = BB_STEPPER;
+    r.arg = state;
+    r.steps = steps;
+    record(r);
+}
+
+/**
+ * @brief copy the recorded inputs, decisions must only use these to be replayable
+ *
+ * @return the sequence of the last input record to pass to blackBoxDecision
+ */
+uint16_t blackBoxInputs(ControlInputs &snapshot)
+{
+    portENTER_CRITICAL(&mux);
+    snapshot = inputs;
+    uint16_t last = lastInput;
+    portEXIT_CRITICAL(&mux);
+    return last;
+}
+
+/**
+ * @brief record a follow decision unless it repeats the last one on the same inputs
+ *
+ * @param inputSequence from blackBoxInputs
+ * @param before the state passed to followDecide
+ * @param after the state followDecide returned
+ */
+void blackBoxDecision(uint16_t inputSequence, const FollowState &before, const FollowDecision &decision,
+                      const FollowState &after)
+{
+    blackBoxRecord r = {};
+    r.type = BB_DECISION;
+    r.arg = decision.action;
+    r.decision.inputs = inputSequence;
+    r.decision.before = blackBoxStateFlags(before);
+    r.decision.after = blackBoxStateFlags(after);
+    r.decision.stop = decision.stop;
+    if (memcmp(&r.arg, &lastDecision.arg, sizeof(r) - offsetof(blackBoxRecord, arg)) == 0)
+    {
+        return;
+    }
+    lastDecision = r;
+    record(r);
+}
+
+/**
+ * @brief print the recording as hex lines "bb <record>" to telnet
+ *
+ * @param fromFlash print the recording saved with blackBoxSave instead
+ */
+void blackBoxDump(bool fromFlash)
+{
+    if (!fromFlash)
+    {
+        forEachRecord(printRecord);
+        return;
+    }
+    const esp_partition_t *partition = flashPartition();
+    FlashHeader header;
+    if (partition == NULL || esp_partition_read(partition, 0, &header, sizeof(header)) != ESP_OK ||
+        header.magic != FLASH_MAGIC)
+    {
+        telnet.println("no black box recording in flash");
+        return;
+    }
+    for (uint32_t i = 0; i < header.count; i++)
+    {
+        blackBoxRecord r;
+        if (esp_partition_read(partition, sizeof(header) + i * sizeof(r), &r, sizeof(r)) != ESP_OK)
+        {
+            break;
+        }
+        printRecord(r);
+    }
+}
+
+/**
+ * @brief broadcast the recording on UDP_BLACK_BOX_PORT, the packets are the records back to back
+ *
+ */
+void blackBoxSend()
+{
+    static blackBoxRecord packet[BLACK_BOX_PACKET_RECORDS];
+    unsigned n = 0;
+    forEachRecord([&](const blackBoxRecord &r)
+                  {
+                      packet[n++] = r;
+                      if (n == BLACK_BOX_PACKET_RECORDS)
+                      {
+                          sendBlackBox((const uint8_t *)packet, sizeof(packet));
+                          n = 0;
+                          // let the network stack drain the packet
+                          vTaskDelay(5);
+                      } });
+    if (n > 0)
+    {
+        sendBlackBox((const uint8_t *)packet, n * sizeof(blackBoxRecord));
+    }
+}
+
+/**
+ * @brief write the recording to the BLACK_BOX_PARTITION flash partition so it survives a reset,
+ * blocks for the erase
+ *
+ * @return false without the partition or on a flash error
+ */
+bool blackBoxSave()
+{
+    const esp_partition_t *partition = flashPartition();
+    size_t needed = sizeof(FlashHeader) + (BLACK_BOX_SIZE + BLACK_BOX_MAX_PARAMS + 1 + NUM_SENSORS) * sizeof(blackBoxRecord);
+    if (partition == NULL || partition->size < needed ||
+        esp_partition_erase_range(partition, 0, partition->size) != ESP_OK)
+    {
+        return false;
+    }
+    FlashHeader header = {FLASH_MAGIC, 0};
+    bool ok = true;
+    forEachRecord([&](const blackBoxRecord &r)
+                  { ok = ok && esp_partition_write(partition, sizeof(header) + header.count++ * sizeof(r),
+                                                   &r, sizeof(r)) == ESP_OK; });
+    // the header last, an interrupted save leaves no valid recording
+    return ok && esp_partition_write(partition, 0, &header, sizeof(header)) == ESP_OK;
+}
+
+void blackBoxClear()
+{
+    portENTER_CRITICAL(&mux);
+    written = 0;
+    dropped = 0;
+    baseInputs = inputs;
+    baseTagId = tagId;
+    baseInput = lastInput;
+    portEXIT_CRITICAL(&mux);
+}
+
+/**
+ * @brief print the recorder statistics to telnet
+ *
+ */
+void blackBoxPrint()
+{
+    uint32_t n = written;
+    uint32_t first = n > BLACK_BOX_SIZE ? ring[n % BLACK_BOX_SIZE].time : (n ? ring[0].time : 0);
+    uint32_t span = n ? millis() - first : 0;
+    telnet.printf("black box: records=%u/%u written=%u dropped=%u span=%ums\n",
+                  min(n, (uint32_t)BLACK_BOX_SIZE), BLACK_BOX_SIZE, n, dropped, span);
+}
\ No newline at end of file
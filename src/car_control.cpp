@@ -1,21 +1,37 @@
 #include <Arduino.h>
 #include "defines.hpp"
+#include "log.hpp"
+#include "black_box.hpp"
+#include "trace.hpp"
+#include "follow_decision.hpp"
 #include "car_control.hpp"
 #include "stepper_motor.hpp"
 #include "april_tag.hpp"
 #include "telnet_debug.hpp"
+#include "task_profiler.hpp"
 #include "ultrasonic.hpp"
 #include "wifi.hpp"
 #include "object_recognition.hpp"
+#include "mission_queue.hpp"
+#include "floor_map.hpp"
+#include "route_planner.hpp"
+#include "loop_timing.hpp"
+#include "docking.hpp"
+#include "pose_estimator.hpp"
+#include "vfh_avoidance.hpp"
 
 extern unsigned volatile detectTagCenter;
 extern double detectTagSize;
 extern bool udpConnection;
 extern bool telnetConnection;
 extern uint8_t missionMode;
+extern volatile int targetTagId;
+extern volatile int detectTagId;
 extern bool ultrasonicEnable;
 extern bool ultrasonicStarted;
 extern double usDistances[NUM_SENSORS];
+extern unsigned long usTimestamps[NUM_SENSORS];
+extern volatile unsigned tagFrameCounter;
 
 extern unsigned robotStatus;
 extern unsigned robotCargo;
@@ -35,22 +51,28 @@ namespace
     };
     bool tagLock = false;
     bool innerCircle = false;
+    // period of every sensor evaluation in the control loops
+    LoopTiming controlTiming = {"control", CONTROL_LOOP_BUDGET_US};
+    DockStats dockStats = {0};
+
+    void monitorCargo();
 
     bool stopMode()
     {
+        monitorCargo();
         if (missionMode == NO_MISSION)
         {
-            DEBUG_MSG("stopMode because NO_MISSION");
+            LOG_DEBUG("stopMode because NO_MISSION");
             return true;
         }
         if (!telnetConnection)
         {
-            DEBUG_MSG("stopMode because telnet");
+            LOG_DEBUG("stopMode because telnet");
             return true;
         }
         if (!udpConnection)
         {
-            DEBUG_MSG("stopMode because udp");
+            LOG_DEBUG("stopMode because udp");
             return true;
         }
         return false;
@@ -64,7 +86,7 @@ namespace
             {
                 break;
             }
-            vTaskDelay(0);
+            vTaskDelay(TASK_POLL_TICKS);
         }
     };
 
@@ -74,7 +96,7 @@ namespace
         while (returnSteps() < steps)
         {
             stepperStartTurnLeft(STEPPER_TURN_RPM);
-            vTaskDelay(0);
+            vTaskDelay(TASK_POLL_TICKS);
         }
     };
 
@@ -84,7 +106,7 @@ namespace
         while (returnSteps() < steps)
         {
             stepperStartTurnRight(STEPPER_TURN_RPM);
-            vTaskDelay(0);
+            vTaskDelay(TASK_POLL_TICKS);
         }
     };
 
@@ -94,7 +116,7 @@ namespace
         while (returnSteps() < steps)
         {
             stepperStartStraight(STEPPER_MAX_RPM);
-            vTaskDelay(0);
+            vTaskDelay(TASK_POLL_TICKS);
         }
     };
 
@@ -104,7 +126,7 @@ namespace
         while (returnSteps() < steps)
         {
             stepperStartBackwards(STEPPER_MAX_RPM);
-            vTaskDelay(0);
+            vTaskDelay(TASK_POLL_TICKS);
         }
     };
 
@@ -143,97 +165,304 @@ namespace
         return min(usDistances[SENSOR_RIGHT], usDistances[SENSOR_FRONTR]);
     }
 
+    /**
+     * @brief measure the loaded object and store it as robotCargo
+     *
+     */
+    void measureCargo()
+    {
+        switch (measureObject())
+        {
+        case RECOGNITION_BALL:
+            robotCargo = CARGO_BALL;
+            LOG_INFO("BALL loaded");
+            break;
+        case RECOGNITION_GUMMY:
+            robotCargo = CARGO_GUMMY;
+            LOG_INFO("GUMMY loaded");
+            break;
+        case RECOGNITION_COTTON:
+            robotCargo = CARGO_COTTON;
+            LOG_INFO("COTTON loaded");
+            break;
+        default:
+            LOG_WARN("object reconition error");
+            robotCargo = CARGO_EMPTY;
+            break;
+        }
+        agvStatusChanged();
+    }
+
+    unsigned recognitionFromCargo(unsigned cargo)
+    {
+        switch (cargo)
+        {
+        case CARGO_BALL:
+            return RECOGNITION_BALL;
+        case CARGO_GUMMY:
+            return RECOGNITION_GUMMY;
+        case CARGO_COTTON:
+            return RECOGNITION_COTTON;
+        default:
+            return RECOGNITION_NONE;
+        }
+    }
+
+    /**
+     * @brief watch the container while driving to a station,
+     * a lost cargo aborts the current leg and a changed cargo is reported in the next agvMsg
+     *
+     */
+    void monitorCargo()
+    {
+        if (robotStatus != ROBOT_APPROACHING_STATION)
+        {
+            return;
+        }
+        switch (cargoMonitor(recognitionFromCargo(robotCargo)))
+        {
+        case CARGO_EVENT_LOST:
+            LOG_WARN("cargo lost, aborting leg");
+            stepperStop();
+            robotCargo = CARGO_EMPTY;
+            missionMode = missions::NO_MISSION;
+            agvStatusChanged();
+            break;
+        case CARGO_EVENT_CHANGED:
+            LOG_INFO("cargo changed while driving");
+            measureCargo();
+            break;
+        default:
+            break;
+        }
+    }
+
+    /**
+     * @brief give the operator CARGO_LOAD_TIMEOUT to load or empty the container,
+     * only polls the color sampler and never blocks on the sensor
+     *
+     * @param loaded the wanted cargo presence
+     * @return true if the cargo state was reached and is stable
+     */
+    bool waitForCargo(bool loaded)
+    {
+        unsigned long start = millis();
+        bool asked = false;
+        while (millis() - start < CARGO_LOAD_TIMEOUT)
+        {
+            ColorSnapshot cargo = colorSnapshot();
+            if (cargo.present == loaded && millis() - cargo.stableSince > COLOR_STABLE_TIME &&
+                (!loaded || cargo.confidence >= COLOR_MIN_CONFIDENCE))
+            {
+                return true;
+            }
+            if (!asked)
+            {
+                LOG_INFO("%s", loaded ? "please load an object..." : "make sure container is empty...");
+                asked = true;
+            }
+            vTaskDelay(50);
+        }
+        return false;
+    }
+
     void askForMission()
     {
+        loopTimingPause(controlTiming);
+        // an aborted leg may still hold a station
+        stationSlotRelease();
         missionMode = missions::NO_MISSION;
         robotStatus = ROBOT_IDLE;
-        robotCargo = CARGO_EMPTY;
         robotRequest = REQUEST_NO_REQUEST;
+        targetTagId = ANY_STATION;
+        agvStatusChanged();
 
-        DEBUG_MSG("ask for mission");
-        telnet.println("please choose a mission:");
-        telnet.println("d-> deliver");
-        telnet.println("gg -> get gummy bear");
-        telnet.println("gc -> get cotton wool");
-        telnet.println("gb -> get ping pong ball");
-        while (missionMode == missions::NO_MISSION)
-            vTaskDelay(0);
+        MissionLeg leg;
+        if (!missionQueuePop(leg))
+        {
+            LOG_INFO("ask for mission");
+            telnet.println("please choose a mission:");
+            telnet.println("d-> deliver");
+            telnet.println("gg -> get gummy bear");
+            telnet.println("gc -> get cotton wool");
+            telnet.println("gb -> get ping pong ball");
+            telnet.println("q <mission> [station] ... -> queue a trip");
+            while (!missionQueuePop(leg))
+                vTaskDelay(10);
+        }
+        LOG_INFO("next leg: %s station %d", missionName(leg.mission), leg.station);
+        targetTagId = leg.station;
+        missionMode = leg.mission;
 
         robotStatus = ROBOT_APPROACHING_STATION;
+        agvStatusChanged();
         if (missionMode == missions::DELIVER)
         {
-            bool l;
-            for (int i = 0; i < 5; i++)
+            // cargo picked up on a previous leg is already known
+            if (robotCargo != CARGO_EMPTY && objectLoaded())
             {
-                l = objectLoaded();
-                if (l == true)
-                    break;
-                DEBUG_MSG("please load an object...");
-                delay(2000);
-            }
-            unsigned c = measureObject();
-
-            switch (c)
-            {
-            case RECOGNITION_BALL:
-                robotCargo = CARGO_BALL;
-                DEBUG_MSG("BALL loaded");
-                break;
-            case RECOGNITION_GUMMY:
-                robotCargo = CARGO_GUMMY;
-                DEBUG_MSG("GUMMY loaded");
-                break;
-            case RECOGNITION_COTTON:
-                robotCargo = CARGO_COTTON;
-                DEBUG_MSG("COTTON loaded");
-                break;
-            case RECOGNITION_ERROR:
-                DEBUG_MSG("object reconition error");
-                robotCargo = CARGO_EMPTY;
-                break;
+                return;
             }
-            delay(2000);
+            waitForCargo(true);
+            measureCargo();
         }
         else
         {
-            for (int i = 0; i < 5; i++)
-            {
-                if (objectLoaded() == false)
-                    break;
-                DEBUG_MSG("make sure container is empty...");
-                delay(2000);
-            }
+            waitForCargo(false);
+            robotCargo = CARGO_EMPTY;
             if (missionMode == missions::GET_BALL)
             {
-                robotCargo = CARGO_EMPTY;
                 robotRequest = REQUEST_LOAD_BALL;
             }
             else if (missionMode == missions::GET_GUMMY)
             {
-                robotCargo = CARGO_EMPTY;
                 robotRequest = REQUEST_LOAD_GUMMY;
             }
             else if (missionMode == missions::GET_COTTON)
             {
-                robotCargo = CARGO_EMPTY;
                 robotRequest = REQUEST_LOAD_COTTON;
             }
-            delay(2000);
+            agvStatusChanged();
+        }
+    }
+
+    /**
+     * @brief turn on the spot until the estimated heading points in the given direction
+     *
+     * @param heading in rad
+     * @param stopAtTag interrupt the turn when a tag comes into view
+     * @return false if the turn was interrupted by a tag, an obstacle or stopMode
+     */
+    bool turnToHeading(float heading, bool stopAtTag = true)
+    {
+        float x, y, h;
+        poseEstimatePose(x, y, h);
+        float diff = remainderf(heading - h, 2 * PI);
+        unsigned steps = fabsf(diff) * STEPS_360 / (2 * PI);
+        auto startTurn = [diff]()
+        {
+            if (diff > 0)
+                stepperStartTurnLeft(STEPPER_TURN_RPM);
+            else
+                stepperStartTurnRight(STEPPER_TURN_RPM);
+        };
+        stepperStop();
+        startTurn();
+        while (returnSteps() < steps)
+        {
+            loopTimingTick(controlTiming);
+            startTurn();
+            if ((stopAtTag && detectTagCenter != 0) || stopMode())
+            {
+                return false;
+            }
+            if ((diff > 0 ? sensor_left_all() : sensor_right_all()) < US_MIN_TRIGGER)
+            {
+                LOG_DEBUG("route: cant turn");
+                stepperStop();
+                return false;
+            }
+            vTaskDelay(10);
         }
+        stepperStop();
+        return true;
+    }
+
+    /**
+     * @brief drive along a route planned on the floor map
+     *
+     * @param toX goal in cm
+     * @param toY goal in cm
+     * @param stopAtTag end the route as soon as a tag is in view
+     * @return true if the tag came into view or the goal was reached
+     */
+    bool driveTo(float toX, float toY, bool stopAtTag)
+    {
+        float x, y, h;
+        poseEstimatePose(x, y, h);
+        Waypoint waypoints[ROUTE_MAX_WAYPOINTS];
+        int n = planRoute(x, y, toX, toY, waypoints, ROUTE_MAX_WAYPOINTS);
+        if (n == 0)
+        {
+            LOG_WARN("route: no route");
+            return false;
+        }
+        LOG_INFO("route: start with %d waypoints", n);
+        for (int i = 0; i < n; i++)
+        {
+            poseEstimatePose(x, y, h);
+            float dx = waypoints[i].x - x;
+            float dy = waypoints[i].y - y;
+            if (!turnToHeading(atan2f(dy, dx), stopAtTag))
+            {
+                return stopAtTag && detectTagCenter != 0;
+            }
+            unsigned steps = sqrtf(dx * dx + dy * dy) * STEPS_PER_CM;
+            stepperStartStraight(STEPPER_MAX_RPM);
+            while (returnSteps() < steps)
+            {
+                loopTimingTick(controlTiming);
+                stepperStartStraight(STEPPER_MAX_RPM);
+                if (stopAtTag && detectTagCenter != 0)
+                {
+                    LOG_DEBUG("route: tag in view");
+                    return true;
+                }
+                if (stopMode())
+                {
+                    return false;
+                }
+                if (sensor_front_all() < US_NEAR_TRIGGER)
+                {
+                    LOG_DEBUG("route: blocked");
+                    stepperStop();
+                    return false;
+                }
+                vTaskDelay(10);
+            }
+            stepperStop();
+        }
+        return true;
+    }
+
+    /**
+     * @brief drive along a route planned on the floor map to the approach point of a station
+     *
+     * @param station tag id of the target station
+     * @return true if the tag came into view or the approach point was reached
+     */
+    bool driveRoute(int station)
+    {
+        const StationPose *target = floorMapStation(station);
+        if (target == NULL || !driveTo(target->approachX, target->approachY, true))
+        {
+            return false;
+        }
+        if (detectTagCenter == 0)
+        {
+            LOG_INFO("route: reached approach point");
+            turnToHeading(atan2f(target->dockY - target->approachY, target->dockX - target->approachX));
+        }
+        return true;
     }
 
     void reposition()
     {
-        DEBUG_MSG("reposition: start");
+        LOG_DEBUG("reposition: start");
+        if (targetTagId != ANY_STATION && driveRoute(targetTagId))
+        {
+            return;
+        }
         int lastMove = NONE;
         int repositionMoved = 0;
         unsigned long reposTimer = 0;
 
         for (;;)
         {
+            loopTimingTick(controlTiming);
             if (stopMode())
             {
-                DEBUG_MSG("reposition: stopped");
+                LOG_DEBUG("reposition: stopped");
                 return;
             }
 
@@ -243,25 +472,23 @@ namespace
             {
                 if (detectTagCenter != 0)
                 {
-                    DEBUG_MSG("reposition: tag in view");
-                    DEBUG_VAR(detectTagSize);
+                    LOG_DEBUG("reposition: tag in view size=%f", detectTagSize);
                     return;
                 }
                 if (repositionMoved > REPOSITION_MAX_STOPS)
                 {
-                    DEBUG_MSG("reposition: ended");
+                    LOG_DEBUG("reposition: ended");
                     return;
                 }
                 if (lastMove != STRAIGHT)
                 {
-                    DEBUG_MSG("reposition: straight");
-                    DEBUG_VAR(detectTagSize);
+                    LOG_DEBUG("reposition: straight size=%f", detectTagSize);
                     reposTimer = millis();
                     repositionMoved++;
                 }
                 if (millis() - reposTimer > REPOSITION_MAX_TIME)
                 {
-                    DEBUG_MSG("reposition time ended");
+                    LOG_DEBUG("reposition time ended");
                     return;
                 }
                 lastMove = STRAIGHT;
@@ -270,7 +497,7 @@ namespace
             // check if you can go left instead
             else if (sensor_left_all() > US_NEAR_TRIGGER && lastMove != RIGHT)
             {
-                DEBUG_MSG("reposition: left");
+                LOG_DEBUG("reposition: left");
                 lastMove = LEFT;
                 stepperStartTurnLeft(STEPPER_TURN_RPM);
                 while (returnSteps() < STEPS_90 / 2)
@@ -278,21 +505,21 @@ namespace
                     stepperStartTurnLeft(STEPPER_TURN_RPM);
                     if (detectTagCenter != 0)
                     {
-                        DEBUG_MSG("reposition: tag in view");
+                        LOG_DEBUG("reposition: tag in view");
                         return;
                     }
                     if (sensor_left_all() < US_MIN_TRIGGER || stopMode())
                     {
-                        DEBUG_MSG("reposition: break left");
+                        LOG_DEBUG("reposition: break left");
                         break;
                     }
-                    vTaskDelay(0);
+                    vTaskDelay(TASK_POLL_TICKS);
                 }
             }
             // check if you can go right instead
             else if (sensor_right_all() > US_NEAR_TRIGGER && lastMove != LEFT)
             {
-                DEBUG_MSG("reposition: right");
+                LOG_DEBUG("reposition: right");
                 lastMove = RIGHT;
                 stepperStartTurnRight(STEPPER_TURN_RPM);
                 while (returnSteps() < STEPS_90)
@@ -300,21 +527,21 @@ namespace
                     stepperStartTurnRight(STEPPER_TURN_RPM);
                     if (detectTagCenter != 0)
                     {
-                        DEBUG_MSG("reposition: tag in view");
+                        LOG_DEBUG("reposition: tag in view");
                         return;
                     }
                     if (sensor_right_all() < US_MIN_TRIGGER || stopMode())
                     {
-                        DEBUG_MSG("reposition: break right");
+                        LOG_DEBUG("reposition: break right");
                         break;
                     }
-                    vTaskDelay(0);
+                    vTaskDelay(TASK_POLL_TICKS);
                 }
             }
             // must back off
             else
             {
-                DEBUG_MSG("reposition: back");
+                LOG_DEBUG("reposition: back");
                 ultrasonicPrint();
                 lastMove = BACKWARDS;
                 stepperStop();
@@ -324,61 +551,102 @@ namespace
                     stepperStartBackwards(STEPPER_MAX_RPM);
                     if (detectTagCenter != 0)
                     {
-                        DEBUG_MSG("reposition: tag in view");
+                        LOG_DEBUG("reposition: tag in view");
                         return;
                     }
                     if (stopMode())
                     {
-                        DEBUG_MSG("reposition: break back");
+                        LOG_DEBUG("reposition: break back");
                         break;
                     }
-                    vTaskDelay(0);
+                    vTaskDelay(TASK_POLL_TICKS);
                 }
                 delay(500);
             }
-            vTaskDelay(0);
+            vTaskDelay(TASK_POLL_TICKS);
         }
         stepperStop();
-        DEBUG_MSG(" reposition complete");
+        LOG_DEBUG("reposition: complete");
+    }
+
+    /**
+     * @brief time to reacquire a lost tag, split by wether the last seen bearing was known
+     *
+     */
+    struct SearchStats
+    {
+        unsigned count;
+        unsigned long totalMs;
+        unsigned long maxMs;
+    };
+    SearchStats searchStatsMemory = {0, 0, 0};
+    SearchStats searchStatsBlind = {0, 0, 0};
+    unsigned long searchLastMs = 0;
+
+    void recordSearch(SearchStats &stats, unsigned long ms)
+    {
+        stats.count++;
+        stats.totalMs += ms;
+        stats.maxMs = max(stats.maxMs, ms);
+        searchLastMs = ms;
     }
 
     void searchForTag(bool dir = true)
     {
-        DEBUG_MSG("search: start");
+        LOG_DEBUG("search: start");
         unsigned long searchStartTime = millis();
+        unsigned long reacquireStartTime = searchStartTime;
         unsigned numChanges = 0;
         int lastMove = NONE;
 
+        // sweep around the current heading, starting towards the last seen bearing
+        long sweepCenter = stepperHeadingSteps();
+        long sweepAmplitude = STEPS_360;
+        long bearing;
+        bool memory = tagLastBearing(bearing);
+        if (memory)
+        {
+            LOG_DEBUG("search: last seen bearing %d", bearing);
+            dir = bearing >= 0;
+            sweepAmplitude = abs(bearing) + SEARCH_SWEEP_MARGIN;
+        }
+
         for (;;)
         {
+            loopTimingTick(controlTiming);
             if (stopMode())
             {
-                DEBUG_MSG("search: stopped");
+                LOG_DEBUG("search: stopped");
                 return;
             }
             if (detectTagCenter != 0)
             {
-                DEBUG_MSG("search: tag in view");
-                DEBUG_VAR(detectTagSize);
+                LOG_DEBUG("search: tag in view size=%f", detectTagSize);
+                traceDecision();
+                recordSearch(memory ? searchStatsMemory : searchStatsBlind, millis() - reacquireStartTime);
                 tagLock = true;
                 return;
             }
             else if (millis() - searchStartTime > TAG_SEARCH_TIMEOUT)
             {
-                DEBUG_MSG("search: timeout");
+                LOG_WARN("search: timeout");
                 reposition();
                 searchStartTime = millis();
+                sweepCenter = stepperHeadingSteps();
+                sweepAmplitude = STEPS_360;
             }
             else if (numChanges > 2)
             {
-                DEBUG_MSG("search: to many changes");
+                LOG_DEBUG("search: to many changes");
                 reposition();
                 searchStartTime = millis();
                 numChanges = 0;
+                sweepCenter = stepperHeadingSteps();
+                sweepAmplitude = STEPS_360;
             }
             else if (sensor_front_all() < US_MIN_TRIGGER)
             {
-                DEBUG_MSG("search: back");
+                LOG_DEBUG("search: back");
                 stepperStop();
                 stepperStartBackwards(STEPPER_MAX_RPM);
                 while (returnSteps() < STEPER_STEPS_PER_ROT * 0.5)
@@ -386,7 +654,7 @@ namespace
                     stepperStartBackwards(STEPPER_MAX_RPM);
                     if (stopMode())
                     {
-                        DEBUG_MSG("search: back stop");
+                        LOG_DEBUG("search: back stop");
                         break;
                     }
                     vTaskDelay(10);
@@ -394,24 +662,28 @@ namespace
             }
             else if (sensor_left_all() < US_MIN_TRIGGER && sensor_right_all() < US_MIN_TRIGGER)
             {
-                DEBUG_MSG("search: cant turn");
+                LOG_DEBUG("search: cant turn");
                 stepperStop();
                 reposition();
                 searchStartTime = millis();
+                sweepCenter = stepperHeadingSteps();
+                sweepAmplitude = STEPS_360;
             }
             else
             {
+                bool sweepDone = false;
                 if (dir && sensor_left_all() > US_MIN_TRIGGER)
                 {
-                    DEBUG_MSG("search: turn left");
+                    LOG_DEBUG("search: turn left sweepAmplitude=%d", sweepAmplitude);
                     stepperStop();
                     stepperStartTurnLeft(STEPPER_TURN_RPM);
-                    while (returnSteps() < STEPS_360)
+                    while (!(sweepDone = stepperHeadingSteps() >= sweepCenter + sweepAmplitude))
                     {
+                        loopTimingTick(controlTiming);
                         stepperStartTurnLeft(STEPPER_TURN_RPM);
                         if (sensor_left_all() < US_MIN_TRIGGER || detectTagCenter != 0 || stopMode())
                         {
-                            DEBUG_MSG("search: turn left stop");
+                            LOG_DEBUG("search: turn left stop");
                             break;
                         }
                         vTaskDelay(10);
@@ -419,15 +691,16 @@ namespace
                 }
                 else if (!dir && sensor_right_all() > US_MIN_TRIGGER)
                 {
-                    DEBUG_MSG("search: turn right");
+                    LOG_DEBUG("search: turn right sweepAmplitude=%d", sweepAmplitude);
                     stepperStop();
                     stepperStartTurnRight(STEPPER_TURN_RPM);
-                    while (returnSteps() < STEPS_360)
+                    while (!(sweepDone = stepperHeadingSteps() <= sweepCenter - sweepAmplitude))
                     {
+                        loopTimingTick(controlTiming);
                         stepperStartTurnRight(STEPPER_TURN_RPM);
                         if (sensor_right_all() < US_MIN_TRIGGER || detectTagCenter != 0 || stopMode())
                         {
-                            DEBUG_MSG("search: turn right stop");
+                            LOG_DEBUG("search: turn right stop");
                             break;
                         }
                         vTaskDelay(10);
@@ -435,108 +708,317 @@ namespace
                 }
                 else
                 {
-                    DEBUG_MSG("search: obstacle, changing direction");
+                    LOG_DEBUG("search: obstacle, changing direction");
                     stepperStop();
                     numChanges++;
                     dir = !dir;
                 }
+
+                // widen the sweep and come back across the other side
+                if (sweepDone)
+                {
+                    LOG_DEBUG("search: widen sweep");
+                    stepperStop();
+                    dir = !dir;
+                    sweepAmplitude = min(sweepAmplitude * 2, (long)STEPS_360);
+                }
+            }
+            vTaskDelay(10);
+        }
+    }
+
+    /**
+     * @brief drive straight to the station and stop at DOCK_STOP_DISTANCE,
+     * slowing down along a constant deceleration profile
+     *
+     * @return false if docking was aborted because of stopMode or timed out
+     */
+    bool dockToStation()
+    {
+        const unsigned frontSensors[3] = {SENSOR_FRONTL, SENSOR_FRONTC, SENSOR_FRONTR};
+        unsigned long lastUs[3];
+        for (int i = 0; i < 3; i++)
+        {
+            lastUs[i] = usTimestamps[frontSensors[i]];
+        }
+        unsigned lastFrame = tagFrameCounter;
+        unsigned long startTime = millis();
+        DockEstimator estimator;
+        estimator.reset(sensor_front_all(), DOCK_US_VARIANCE);
+        float lastDistance = stepperDistance();
+        unsigned rpm = 0;
+        LOG_DEBUG("dock: start distance=%f", estimator.distance);
+
+        for (;;)
+        {
+            loopTimingTick(controlTiming);
+            if (stopMode())
+            {
+                LOG_DEBUG("dock: stopped");
+                stepperStop();
+                return false;
+            }
+            float driven = stepperDistance();
+            estimator.predict(driven - lastDistance);
+            lastDistance = driven;
+
+            // correct ultrasonic readings by the distance driven since they were taken
+            float speed = rpm * PI * WHEEL_DIAMETER / 60;
+            for (int i = 0; i < 3; i++)
+            {
+                unsigned long t = usTimestamps[frontSensors[i]];
+                if (t != lastUs[i])
+                {
+                    lastUs[i] = t;
+                    float age = (millis() - t) / 1000.0;
+                    estimator.update(usDistances[frontSensors[i]] - speed * age, DOCK_US_VARIANCE);
+                }
+            }
+            unsigned frame = tagFrameCounter;
+            float tagRange = dockTagRange(detectTagSize);
+            if (frame != lastFrame && tagRange > DOCK_TAG_MIN_RANGE)
+            {
+                estimator.update(tagRange, DOCK_TAG_VARIANCE * tagRange * tagRange);
+            }
+            lastFrame = frame;
+
+            float remaining = estimator.distance - DOCK_STOP_DISTANCE;
+            if (remaining <= 0)
+            {
+                break;
+            }
+            // a timed out approach is not a docking error, keep it out of the error statistics
+            if (millis() - startTime > DOCK_TIMEOUT)
+            {
+                stepperStop();
+                dockStats.timeouts++;
+                LOG_WARN("dock: timeout, %f cm left", remaining);
+                return false;
+            }
+            unsigned newRpm = dockProfileRpm(remaining);
+            if (newRpm != rpm)
+            {
+                rpm = newRpm;
+                stepperSetStraightRpm(rpm);
             }
             vTaskDelay(10);
         }
+        stepperStop();
+        unsigned long duration = millis() - startTime;
+
+        // wait for a fresh reading of all front sensors to measure the final error
+        unsigned long stopTime = millis();
+        while (millis() - stopTime < 1000)
+        {
+            bool fresh = true;
+            for (int i = 0; i < 3; i++)
+            {
+                fresh = fresh && usTimestamps[frontSensors[i]] > stopTime;
+            }
+            if (fresh)
+            {
+                break;
+            }
+            vTaskDelay(10);
+        }
+        dockRecord(dockStats, sensor_front_all() - DOCK_STOP_DISTANCE, duration);
+        LOG_INFO("dock: finished, error in cm: %f", dockStats.lastError);
+        return true;
+    }
+
+    /**
+     * @brief reserve the station before docking, while it is occupied by another robot
+     * wait at its wait point until the station grants the slot
+     *
+     * @param station tag id of the station
+     * @return true if the station may be docked now,
+     * false if the robot left the approach and has to search the tag again or the leg was aborted
+     */
+    bool reserveStation(int station)
+    {
+        if (stationSlot(station) == SLOT_GRANTED)
+        {
+            return true;
+        }
+        LOG_INFO("slot: request station=%d", station);
+        loopTimingPause(controlTiming);
+        stationSlotRequest(station);
+        unsigned long start = millis();
+        while (stationSlot(station) == SLOT_REQUESTED)
+        {
+            if (stopMode())
+            {
+                return false;
+            }
+            if (millis() - start > SLOT_REPLY_TIMEOUT)
+            {
+                LOG_WARN("slot: no answer, docking without reservation");
+                return true;
+            }
+            vTaskDelay(10);
+        }
+        if (stationSlot(station) == SLOT_GRANTED)
+        {
+            return true;
+        }
+
+        LOG_INFO("slot: station busy, going to wait point");
+        robotStatus = ROBOT_WAITING_FOR_SLOT;
+        agvStatusChanged();
+        const StationPose *pose = floorMapStation(station);
+        if (pose != NULL)
+        {
+            driveTo(pose->waitX, pose->waitY, false);
+            stepperStop();
+        }
+        loopTimingPause(controlTiming);
+        unsigned long waitStart = millis();
+        unsigned long lastRequest = waitStart;
+        while (stationSlot(station) != SLOT_GRANTED)
+        {
+            if (stopMode())
+            {
+                return false;
+            }
+            if (millis() - waitStart > SLOT_WAIT_TIMEOUT)
+            {
+                LOG_WARN("slot: no grant from station %d in %d ms, aborting leg", station, SLOT_WAIT_TIMEOUT);
+                stationSlotRelease();
+                missionMode = missions::NO_MISSION;
+                agvStatusChanged();
+                return false;
+            }
+            // the grant may have been lost or the station restarted
+            if (millis() - lastRequest > SLOT_WAIT_RESEND)
+            {
+                LOG_INFO("slot: still waiting, request station=%d again", station);
+                lastRequest = millis();
+                stationSlotRequest(station);
+            }
+            vTaskDelay(10);
+        }
+        LOG_INFO("slot: granted, approaching again");
+        robotStatus = ROBOT_APPROACHING_STATION;
+        agvStatusChanged();
+        tagLock = false;
+        innerCircle = false;
+        return false;
     }
 
     bool innerLock()
     {
-        unsigned localTagCenter = detectTagCenter;
-        return (localTagCenter > TAG_CENTER - TAG_CENTER_DEADZONE_SMALL &&
-                localTagCenter < TAG_CENTER + TAG_CENTER_DEADZONE_SMALL);
+        return followInnerLock(detectTagCenter);
     }
 
     void followTag()
     {
+        // steer around obstacles along curves picked from a polar obstacle histogram (vfh_avoidance)
+        // until the front is free with the tag in view or the robot is back on its course
         auto avoidObstacle = []()
         {
-            int lturns = 0;
-            int intendedMove = STRAIGHT;
-            int lastObMove = STRAIGHT;
+            const float sensorBearings[NUM_SENSORS] = US_SENSOR_BEARINGS;
+            unsigned long lastUs[NUM_SENSORS] = {0};
+            VfhHistogram vfh;
+            vfhReset(vfh, stepperDistance());
+            float x, y, heading;
+            poseEstimatePose(x, y, heading);
+            // the tag was ahead when the front got blocked
+            float goal = heading;
+            int lastSpin = 0;
+            unsigned long startTime = millis();
             while (1)
             {
-                DEBUG_VAR(lturns);
-                if (sensor_front_all() > US_NEAR_TRIGGER &&
-                    sensor_front_out() > US_MIN_TRIGGER)
+                loopTimingTick(controlTiming);
+                if (stopMode())
                 {
-                    DEBUG_MSG("obstacle: front is free");
-                    if (lturns == 0)
+                    LOG_DEBUG("obstacle: stopped");
+                    stepperStop();
+                    break;
+                }
+                if (millis() - startTime > VFH_TIMEOUT)
+                {
+                    LOG_WARN("obstacle: no way around");
+                    stepperStop();
+                    break;
+                }
+                poseEstimatePose(x, y, heading);
+                vfhDecay(vfh, stepperDistance());
+                for (int i = 0; i < NUM_SENSORS; i++)
+                {
+                    if (usTimestamps[i] != lastUs[i])
                     {
-                        DEBUG_MSG("obstacle: turned enough");
-                        break;
+                        lastUs[i] = usTimestamps[i];
+                        vfhUpdate(vfh, heading + sensorBearings[i] * PI / 180, usDistances[i]);
                     }
-                    else
-                    {
-                        DEBUG_MSG("obstacle: straight");
-                        stepperStartStraight(STEPPER_MAX_RPM);
-                        while (returnSteps() < STEPER_STEPS_PER_ROT * 2.0)
-                        {
-                            if (sensor_front() < US_MIN_TRIGGER || sensor_front_out() < 2)
-                            {
-                                DEBUG_MSG("obstacle: stopped straight");
-                                lastObMove = STRAIGHT;
-                                goBackSteps(STEPER_STEPS_PER_ROT * 0.1);
-                                stepperStop();
-                                break;
-                            }
-                            vTaskDelay(0);
-                        }
+                }
+                long bearing;
+                if (detectTagCenter != 0)
+                {
+                    goal = heading + tagCenterBearing(detectTagCenter);
+                }
+                else if (tagLastBearing(bearing))
+                {
+                    goal = heading + bearing * 2 * PI / STEPS_360;
+                }
 
-                        while (sensor_right_all() > US_MIN_TRIGGER && lturns > 0)
-                        {
-                            DEBUG_MSG("obstacle: right back");
-                            lturns -= 1;
-                            goRightSteps(STEPS_90 * 0.5);
-                        }
-                        while (sensor_left_all() > US_MIN_TRIGGER && lturns < 0)
-                        {
-                            DEBUG_MSG("obstacle: left back");
-                            lturns += 1;
-                            goLeftSteps(STEPS_90 * 0.5);
-                        }
-                    }
+                VfhCommand command = vfhSteer(vfh, heading, goal);
+                bool frontFree = sensor_front_all() > US_NEAR_TRIGGER && sensor_front_out() > US_MIN_TRIGGER;
+                bool onCourse = fabsf(remainderf(goal - heading, 2 * PI)) < PI / VFH_SECTORS;
+                if (frontFree && (detectTagCenter != 0 || onCourse))
+                {
+                    LOG_DEBUG("obstacle: passed");
+                    break;
                 }
-                else if (sensor_left_all() > US_MIN_TRIGGER && lastObMove != RIGHT)
+                if (command.blocked)
                 {
-                    DEBUG_MSG("obstacle: left");
-                    lastObMove = LEFT;
-                    lturns += 1;
-                    goLeftSteps(STEPS_90 * 0.5);
+                    LOG_DEBUG("obstacle: back");
+                    goBackSteps(STEPER_STEPS_PER_ROT);
+                    continue;
                 }
-                else if (sensor_right_all() > US_MIN_TRIGGER)
+                if (command.spin != 0)
                 {
-                    DEBUG_MSG("obstacle: right");
-                    lastObMove = RIGHT;
-                    lturns -= 1;
-                    goRightSteps(STEPS_90 * 0.5);
+                    if (command.spin != lastSpin)
+                    {
+                        LOG_DEBUG("obstacle: turn %s", command.spin > 0 ? "left" : "right");
+                    }
+                    if (command.spin > 0)
+                        stepperStartTurnLeft(STEPPER_SLOW_TURN_RPM);
+                    else
+                        stepperStartTurnRight(STEPPER_SLOW_TURN_RPM);
                 }
                 else
                 {
-                    DEBUG_MSG("obstacle: back");
-                    lastObMove = BACKWARDS;
-                    goBackSteps(STEPER_STEPS_PER_ROT);
+                    if (lastSpin != 0)
+                    {
+                        LOG_DEBUG("obstacle: curve");
+                    }
+                    stepperStartCurve(command.curvature, command.speed * STEPPER_MAX_RPM);
                 }
+                lastSpin = command.spin;
+                vTaskDelay(10);
             }
         };
 
-        DEBUG_MSG("follow: start");
+        LOG_DEBUG("follow: start");
         int lastMove = NONE;
         bool lockedOn = false;
-        int intendedMove = STRAIGHT;
-        unsigned long taglastSeen = 0;
 
         for (;;)
         {
+            loopTimingTick(controlTiming);
+            // decide on the recorded inputs only, so the black box can replay the decision
+            ControlInputs inputs;
+            uint16_t inputSequence = blackBoxInputs(inputs);
+            FollowState before = {lockedOn, innerCircle};
+            FollowState after = before;
+            FollowDecision decision = followDecide(inputs, after);
+            blackBoxDecision(inputSequence, before, decision, after);
+            traceDecision();
+
             // check if we lost tag or connection
-            if (detectTagCenter == 0)
+            if (decision.action == FOLLOW_LOST)
             {
-                DEBUG_MSG("follow: stopped because tag is no longer in view");
+                LOG_DEBUG("follow: stopped because tag is no longer in view");
                 tagLock = false;
                 stepperStop();
                 return;
@@ -544,195 +1026,185 @@ namespace
 
             if (stopMode())
             {
-                DEBUG_MSG("follow: stopped");
+                LOG_DEBUG("follow: stopped");
                 stepperStop();
                 return;
             }
 
-            // check if we left inner lock
-            unsigned temp = detectTagCenter;
-            if (lockedOn && (temp < TAG_CENTER - TAG_CENTER_DEADZONE ||
-                             temp > TAG_CENTER + TAG_CENTER_DEADZONE))
+            if (decision.stop)
             {
-                DEBUG_MSG("follow: lockedOn lost");
-                DEBUG_VAR(temp);
-                stepperStop();
-                lockedOn = false;
-            }
-
-            // check if we entered inner lock
-            else if (!lockedOn && innerLock())
-            {
-                DEBUG_MSG("follow: lockedOn");
-                DEBUG_VAR(detectTagCenter);
-                DEBUG_VAR(detectTagSize);
+                if (after.lockedOn)
+                {
+                    LOG_DEBUG("follow: lockedOn center=%d size=%f", inputs.tagCenter, inputs.tagSize);
+                }
+                else
+                {
+                    LOG_DEBUG("follow: lockedOn lost center=%d", inputs.tagCenter);
+                }
                 stepperStop();
-                lockedOn = true;
             }
-
-            // check if we are in inner circle
-            if (!innerCircle && detectTagSize > TAG_CLOSE_SIZE)
+            lockedOn = after.lockedOn;
+            if (!innerCircle && after.innerCircle)
             {
-                DEBUG_MSG("follow: we are inside inner circle");
-                DEBUG_VAR(detectTagSize);
-                innerCircle = true;
+                LOG_DEBUG("follow: we are inside inner circle size=%f", inputs.tagSize);
             }
+            innerCircle = after.innerCircle;
 
-            // what move to we want to do?
-            intendedMove = STRAIGHT;
-            if (!lockedOn && detectTagCenter < TAG_CENTER)
+            if (decision.action == FOLLOW_TURN_RIGHT)
             {
                 if (lastMove != RIGHT)
                 {
-                    DEBUG_MSG("follow: intend right");
+                    LOG_DEBUG("follow: turn right");
                 }
-                intendedMove = (sensor_right_all() < US_MIN_TRIGGER) ? STRAIGHT : RIGHT;
-                if (intendedMove == RIGHT)
+                lastMove = RIGHT;
+                stepperStartTurnRight(STEPPER_SLOW_TURN_RPM);
+                while (sensor_right_all() > US_MIN_TRIGGER)
                 {
-                    DEBUG_MSG("follow: turn right");
-                    lastMove = RIGHT;
+                    loopTimingTick(controlTiming);
                     stepperStartTurnRight(STEPPER_SLOW_TURN_RPM);
-                    while (sensor_right_all() > US_MIN_TRIGGER)
+                    if (stopMode() || innerLock())
                     {
-                        stepperStartTurnRight(STEPPER_SLOW_TURN_RPM);
-                        if (stopMode() || innerLock())
-                        {
-                            DEBUG_MSG("follow: stopped turning right");
-                            break;
-                        }
-                        vTaskDelay(10);
+                        LOG_DEBUG("follow: stopped turning right");
+                        break;
                     }
-                }
-                else
-                {
-                    DEBUG_MSG("follow: cant turn right -> intend straight");
+                    vTaskDelay(10);
                 }
             }
-            else if (!lockedOn && detectTagCenter > TAG_CENTER)
+            else if (decision.action == FOLLOW_TURN_LEFT)
             {
                 if (lastMove != LEFT)
                 {
-                    DEBUG_MSG("follow: intend left");
+                    LOG_DEBUG("follow: turn left");
                 }
-                intendedMove = (sensor_left_all() < US_MIN_TRIGGER) ? STRAIGHT : LEFT;
-                if (intendedMove == LEFT)
+                lastMove = LEFT;
+                stepperStartTurnLeft(STEPPER_SLOW_TURN_RPM);
+                while (sensor_left_all() > US_MIN_TRIGGER)
                 {
-                    DEBUG_MSG("follow: turn left");
-                    lastMove = LEFT;
+                    loopTimingTick(controlTiming);
                     stepperStartTurnLeft(STEPPER_SLOW_TURN_RPM);
-                    while (sensor_left_all() > US_MIN_TRIGGER)
+                    if (stopMode() || innerLock())
                     {
-                        stepperStartTurnLeft(STEPPER_SLOW_TURN_RPM);
-                        if (stopMode() || innerLock())
-                        {
-                            DEBUG_MSG("follow: stopped turning left");
-                            break;
-                        }
-                        vTaskDelay(10);
+                        LOG_DEBUG("follow: stopped turning left");
+                        break;
                     }
+                    vTaskDelay(10);
                 }
-                else
-                {
-                    DEBUG_MSG("follow: cant turn left -> intend Straight");
-                }
+            }
+            else if (decision.action == FOLLOW_WAIT)
+            {
+                LOG_DEBUG("follow: cant turn towards the tag");
             }
 
             // check if we are near station
-            else if (innerCircle && sensor_front() < 25)
+            else if (decision.action == FOLLOW_DOCK)
             {
-                DEBUG_MSG("follow: near station!");
+                LOG_DEBUG("follow: near station!");
                 stepperStop();
-                stepperStartStraight(15);
-                while (1)
+                if (!reserveStation(targetTagId != ANY_STATION ? targetTagId : detectTagId))
                 {
-                    if (sensor_front_all() < US_BASE_TRIGGER)
-                    {
-                        break;
-                    }
-                    vTaskDelay(0);
+                    return;
                 }
-                DEBUG_MSG("follow: stopped because we reached station");
-                goStraightSteps(STEPER_STEPS_PER_ROT * 0.15);
-                stepperStop();
+                if (!dockToStation())
+                {
+                    return;
+                }
+                LOG_INFO("follow: stopped because we reached station");
+                const StationPose *station = floorMapStation(targetTagId);
+                if (station != NULL)
+                {
+                    stepperSetPose(station->dockX, station->dockY, station->dockHeading);
+                    poseEstimatorSet(station->dockX, station->dockY, station->dockHeading);
+                }
+                // give up the station when the mission is stopped while at the station
+                auto abortDriveBack = []()
+                {
+                    LOG_DEBUG("DriveBack: stopped");
+                    stepperStop();
+                    stationSlotRelease();
+                    innerCircle = false;
+                    tagLock = false;
+                };
+                // wait for the station before it learns that we arrived
+                missionMode = missions::WAITING;
                 robotStatus = ROBOT_STOPPED_NEAR_STATION;
-                missionMode == missions::WAITING;
+                agvStatusChanged();
                 while (missionMode != missions::DRIVING_AWAY)
                 {
+                    if (stopMode())
+                    {
+                        abortDriveBack();
+                        return;
+                    }
                     vTaskDelay(10);
                 }
-                DEBUG_MSG("DriveBack: started ");
+                LOG_DEBUG("DriveBack: started");
+                goBackSteps(STEPER_STEPS_PER_ROT * 0.5);
+                LOG_DEBUG("DriveBack: turn around");
+                goLeftSteps(STEPS_90 * 2);
+                // the sampler window has been refreshed with the new cargo by now
                 if (objectLoaded())
                 {
-                    int cargo = measureObject();
-                    if (cargo == CARGO_BALL)
-                    {
-                        DEBUG_MSG("new cargo: BALL");
-                    }
-                    else if (cargo == CARGO_GUMMY)
-                    {
-                        DEBUG_MSG("new cargo: GUMMY");
-                    }
-                    else if (cargo == CARGO_COTTON)
-                    {
-                        DEBUG_MSG("new cargo: COTTON");
-                    }
-                    else
-                    {
-                        DEBUG_MSG("new cargo: UNKNOWN");
-                    }
+                    measureCargo();
                 }
                 else
                 {
-                    DEBUG_MSG("new cargo: NONE");
+                    LOG_DEBUG("new cargo: NONE");
+                    robotCargo = CARGO_EMPTY;
+                    agvStatusChanged();
                 }
-                goBackSteps(STEPER_STEPS_PER_ROT * 0.5);
-                DEBUG_MSG("DriveBack: turn around");
-                goLeftSteps(STEPS_90 * 2);
                 long startTime = millis();
                 while (true)
                 {
                     if (millis() - startTime > DRIVE_BACK_TIMEOUT)
                     {
-                        DEBUG_MSG("DriveBack: timeout");
+                        LOG_WARN("DriveBack: timeout");
                         break;
                     }
                     if (sensor_front_all() < US_MIN_TRIGGER)
                     {
-                        DEBUG_MSG("DriveBack: obstacle");
+                        LOG_DEBUG("DriveBack: obstacle");
                         break;
                     }
+                    if (stopMode())
+                    {
+                        abortDriveBack();
+                        return;
+                    }
+                    stepperStartStraight(STEPPER_MAX_RPM);
+                    vTaskDelay(TASK_POLL_TICKS);
                 }
-                DEBUG_MSG("DriveBack: turn around");
+                LOG_DEBUG("DriveBack: turn around");
                 goLeftSteps(STEPS_90 * 2);
-                DEBUG_MSG("DriveBack: finished");
+                LOG_INFO("DriveBack: finished");
                 stepperStop();
+                stationSlotRelease();
                 innerCircle = false;
+                loopTimingPause(controlTiming);
                 tagLock = false;
                 missionMode = NO_MISSION;
                 return;
             }
 
             // go straight if possible
-            else if (intendedMove == STRAIGHT && sensor_front() > US_NEAR_TRIGGER &&
-                     sensor_front_out() > 5)
+            else if (decision.action == FOLLOW_STRAIGHT)
             {
                 while (sensor_left() < 2 && sensor_right() < 2)
                 {
-                    DEBUG_MSG("follow: make space -> back");
+                    LOG_DEBUG("follow: make space -> back");
                     stepperStartBackwards(STEPPER_MAX_RPM);
                     vTaskDelay(10);
                     stepperStop();
                 }
                 while (sensor_left() < 2)
                 {
-                    DEBUG_MSG("follow: make space -> right");
+                    LOG_DEBUG("follow: make space -> right");
                     stepperStartTurnRight(STEPPER_TURN_RPM);
                     vTaskDelay(10);
                     stepperStop();
                 }
                 while (sensor_right() < 2)
                 {
-                    DEBUG_MSG("follow: make space -> left");
+                    LOG_DEBUG("follow: make space -> left");
                     stepperStartTurnLeft(STEPPER_TURN_RPM);
                     vTaskDelay(10);
                     stepperStop();
@@ -741,7 +1213,7 @@ namespace
                 if (lastMove != STRAIGHT)
                 {
                     stepperStop();
-                    DEBUG_MSG("follow: go straight");
+                    LOG_DEBUG("follow: go straight");
                 }
                 lastMove = STRAIGHT;
                 stepperStartStraight(STEPPER_MAX_RPM);
@@ -751,7 +1223,7 @@ namespace
             // cant go straight
             else
             {
-                DEBUG_MSG("follow: cant go straight -> drive around obstacle");
+                LOG_DEBUG("follow: cant go straight -> drive around obstacle");
                 stepperStop();
                 avoidObstacle();
             }
@@ -761,44 +1233,113 @@ namespace
 
     void waitForUDP()
     {
+        loopTimingPause(controlTiming);
         while (udpConnection == false)
         {
-            DEBUG_MSG("carControlTask is waiting for UDP stream");
+            LOG_INFO("carControlTask is waiting for UDP stream");
             vTaskDelay(1000);
         }
     }
 
     void waitForTelnet()
     {
+        loopTimingPause(controlTiming);
         while (telnetConnection == false)
         {
-            DEBUG_MSG("carControlTask is waiting for telnet");
+            LOG_INFO("carControlTask is waiting for telnet");
             vTaskDelay(1000);
         }
     }
 
     void waitForUs()
     {
+        loopTimingPause(controlTiming);
         while (ultrasonicStarted == false)
         {
-            DEBUG_MSG("waiting for us sensors...");
+            LOG_INFO("waiting for us sensors...");
             vTaskDelay(1000);
         }
         delay(1000); // additional delay needed for ultrasonic sensors
     }
 }
 
+/**
+ * @brief print time-to-reacquire statistics of searchForTag to telnet
+ *
+ */
+void printSearchStats()
+{
+    const SearchStats *stats[2] = {&searchStatsMemory, &searchStatsBlind};
+    const char *names[2] = {"memory", "blind"};
+    for (int i = 0; i < 2; i++)
+    {
+        unsigned long mean = stats[i]->count ? stats[i]->totalMs / stats[i]->count : 0;
+        telnet.printf("search %s: n=%u mean=%lums max=%lums\n", names[i], stats[i]->count, mean, stats[i]->maxMs);
+    }
+    telnet.printf("search last: %lums\n", searchLastMs);
+}
+
+/**
+ * @brief print the odometry pose to telnet
+ *
+ */
+void printPose()
+{
+    float x, y, heading;
+    stepperPose(x, y, heading);
+    telnet.printf("pose: x=%.1fcm y=%.1fcm heading=%.1fdeg\n", x, y, heading * 180 / PI);
+    poseEstimatorPrint();
+}
+
+/**
+ * @brief print the control loop timing statistics to telnet
+ *
+ * @param reset clear the statistics after printing
+ */
+void printControlTiming(bool reset)
+{
+    loopTimingPrint(controlTiming);
+    if (reset)
+    {
+        loopTimingReset(controlTiming);
+    }
+}
+
+/**
+ * @brief timing statistics of the control loop for the telemetry stream
+ *
+ */
+const LoopTiming &controlLoopTiming()
+{
+    return controlTiming;
+}
+
+/**
+ * @brief print the final docking error statistics to telnet
+ *
+ */
+void printDockStats()
+{
+    dockPrint(dockStats);
+}
+
 void controlCarTask(void *argument)
 {
     Serial.print("carControlTask is running on: ");
     Serial.println(xPortGetCoreID());
+    unsigned profilerSlot = profilerRegister();
     unsigned long tagTimeoutTimer = 0;
+    float x, y, heading;
+    floorMapStartPose(x, y, heading);
+    stepperSetPose(x, y, heading);
     robotStatus = ROBOT_IDLE;
     robotCargo = CARGO_EMPTY;
     robotRequest = REQUEST_NO_REQUEST;
 
     for (;;)
     {
+        profilerLoop(profilerSlot);
+        loopTimingTick(controlTiming);
         if (telnetConnection == false)
         {
             tagLock = false;
@@ -841,10 +1382,10 @@ void controlCarTask(void *argument)
         }
         else if (millis() - tagTimeoutTimer > 1000)
         {
-            DEBUG_MSG("tagTimeout: tag lock lost");
+            LOG_WARN("tagTimeout: tag lock lost");
             tagLock = false;
         }
-        vTaskDelay(0);
+        vTaskDelay(TASK_POLL_TICKS);
     }
     Serial.println("carControlTask closed");
     vTaskDelete(NULL);
@@ -0,0 +1,119 @@
+#include <math.h>
+#include "cargo_classifier.hpp"
+#include "object_recognition.hpp"
+
+/**
+ * @brief feature vector of one measurement: red and green chromaticity
+ * of the ambient subtracted light and its clear channel relative to full scale
+ *
+ * @param lit r, g, b, c with the led on
+ * @param ambient r, g, b, c with the led off
+ * @param fullScale maximum count of the current integration time
+ * @param features receives the features
+ */
+void cargoFeatures(const uint16_t lit[4], const uint16_t ambient[4], float fullScale, float features[CLASSIFIER_FEATURES])
+{
+    float rgbc[4];
+    for (int i = 0; i < 4; i++)
+    {
+        rgbc[i] = lit[i] > ambient[i] ? lit[i] - ambient[i] : 0;
+    }
+    float sum = rgbc[0] + rgbc[1] + rgbc[2];
+    features[0] = sum > 0 ? rgbc[0] / sum : 0;
+    features[1] = sum > 0 ? rgbc[1] / sum : 0;
+    features[2] = rgbc[3] / fullScale;
+}
+
+/**
+ * @brief log likelihood of the features for every centroid
+ *
+ * @param logLikelihood receives numCentroids values
+ */
+void cargoLogLikelihoods(const CargoClassifier &classifier, const float features[CLASSIFIER_FEATURES], float *logLikelihood)
+{
+    for (unsigned k = 0; k < classifier.numCentroids; k++)
+    {
+        const CargoCentroid &centroid = classifier.centroids[k];
+        float ll = 0;
+        for (int i = 0; i < CLASSIFIER_FEATURES; i++)
+        {
+            float z = (features[i] - centroid.mean[i]) / centroid.stddev[i];
+            ll -= 0.5f * z * z + logf(centroid.stddev[i]);
+        }
+        logLikelihood[k] = ll;
+    }
+}
+
+/**
+ * @brief nearest centroid classification
+ *
+ * @param confidence receives the posterior of the chosen class with equal priors, may be NULL
+ * @return a RecognitedObject, RECOGNITION_ERROR if there are no centroids
+ */
+unsigned cargoClassify(const CargoClassifier &classifier, const float features[CLASSIFIER_FEATURES], float *confidence)
+{
+    float ll[CLASSIFIER_MAX_CLASSES];
+    cargoLogLikelihoods(classifier, features, ll);
+    unsigned best = 0;
+    for (unsigned k = 1; k < classifier.numCentroids; k++)
+    {
+        if (ll[k] > ll[best])
+            best = k;
+    }
+    if (classifier.numCentroids == 0)
+    {
+        if (confidence)
+            *confidence = 0;
+        return RECOGNITION_ERROR;
+    }
+    if (confidence)
+    {
+        float sum = 0;
+        for (unsigned k = 0; k < classifier.numCentroids; k++)
+        {
+            sum += expf(ll[k] - ll[best]);
+        }
+        *confidence = 1 / sum;
+    }
+    return classifier.centroids[best].cargoClass;
+}
+
+/**
+ * @brief untrained defaults derived from the old red/blue and green/blue thresholds,
+ * replace them with centroids trained by tools/train_classifier.py
+ *
+ */
+void cargoClassifierDefaults(CargoClassifier &classifier)
+{
+    classifier.version = 1;
+    classifier.numCentroids = 3;
+    classifier.centroids[0] = {RECOGNITION_COTTON, {0.25f, 0.33f, 0.5f}, {0.04f, 0.04f, 0.3f}};
+    classifier.centroids[1] = {RECOGNITION_GUMMY, {0.30f, 0.45f, 0.2f}, {0.04f, 0.04f, 0.3f}};
+    classifier.centroids[2] = {RECOGNITION_BALL, {0.43f, 0.37f, 0.6f}, {0.04f, 0.04f, 0.3f}};
+}
+
+/**
+ * @brief replace the centroid of a class or add it as a new class
+ *
+ * @return false if there is no space for another class or a stddev is not positive
+ */
+bool cargoClassifierSet(CargoClassifier &classifier, const CargoCentroid &centroid)
+{
+    for (int i = 0; i < CLASSIFIER_FEATURES; i++)
+    {
+        if (!(centroid.stddev[i] > 0))
+            return false;
+    }
+    for (unsigned k = 0; k < classifier.numCentroids; k++)
+    {
+        if (classifier.centroids[k].cargoClass == centroid.cargoClass)
+        {
+            classifier.centroids[k] = centroid;
+            return true;
+        }
+    }
+    if (classifier.numCentroids >= CLASSIFIER_MAX_CLASSES)
+        return false;
+    classifier.centroids[classifier.numCentroids++] = centroid;
+    return true;
+}
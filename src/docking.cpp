@@ -0,0 +1,85 @@
+#include <math.h>
+#include "defines.hpp"
+#include "docking.hpp"
+#ifdef ARDUINO
+#include "telnet_debug.hpp"
+#else
+#include <stdio.h>
+#endif
+
+void DockEstimator::reset(float d, float var)
+{
+    distance = d;
+    variance = var;
+}
+
+/**
+ * @brief move the estimate by the distance driven since the last prediction
+ *
+ * @param driven in cm, positive towards the dock
+ */
+void DockEstimator::predict(float driven)
+{
+    distance -= driven;
+    variance += DOCK_ODOMETRY_NOISE * fabsf(driven);
+}
+
+/**
+ * @brief fuse a distance measurement into the estimate
+ *
+ * @param measured in cm
+ * @param var variance of the measurement in cm^2
+ */
+void DockEstimator::update(float measured, float var)
+{
+    float k = variance / (variance + var);
+    distance += k * (measured - distance);
+    variance *= 1 - k;
+}
+
+/**
+ * @brief pinhole estimate of the tag range from its apparent size
+ *
+ * @param tagSize longest tag side in px
+ * @return range in cm or 0 if no tag is visible
+ */
+float dockTagRange(double tagSize)
+{
+    return tagSize > 0 ? DOCK_TAG_RANGE_K / tagSize : 0;
+}
+
+/**
+ * @brief speed that still allows to stop within the remaining distance at DOCK_DECELERATION
+ *
+ * @param remaining distance to the stop point in cm
+ * @return rpm between DOCK_MIN_RPM and DOCK_MAX_RPM
+ */
+unsigned dockProfileRpm(float remaining)
+{
+    float v = sqrtf(2 * DOCK_DECELERATION * fmaxf(remaining, 0));
+    float rpm = v * 60 / (M_PI * WHEEL_DIAMETER);
+    return fminf(fmaxf(rpm, DOCK_MIN_RPM), DOCK_MAX_RPM);
+}
+
+void dockRecord(DockStats &stats, float error, unsigned long duration)
+{
+    stats.count++;
+    stats.lastError = error;
+    stats.sumError += error;
+    stats.sumAbsError += fabsf(error);
+    stats.maxAbsError = fmaxf(stats.maxAbsError, fabsf(error));
+    stats.lastDuration = duration;
+}
+
+void dockPrint(const DockStats &stats)
+{
+    float n = stats.count ? stats.count : 1;
+#ifdef ARDUINO
+    telnet.printf(
+#else
+    printf(
+#endif
+        "dock: n=%u last=%.1fcm bias=%.1fcm mean abs=%.1fcm max abs=%.1fcm last duration=%lums timeouts=%u\n",
+        stats.count, stats.lastError, stats.sumError / n, stats.sumAbsError / n, stats.maxAbsError,
+        stats.lastDuration, stats.timeouts);
+}
@@ -0,0 +1,156 @@
+#include <math.h>
+#include "defines.hpp"
+#include "floor_map.hpp"
+
+namespace
+{
+    /**
+     * @brief static layout of the cell, stored in flash
+     * one character per FLOOR_MAP_CELL_SIZE cell, '#' is occupied, row 0 is y = 0,
+     * obstacles are already inflated by half the robot width
+     */
+    const int MAP_WIDTH = FLOOR_MAP_WIDTH;
+    const int MAP_HEIGHT = FLOOR_MAP_HEIGHT;
+    const char *const floorMap[MAP_HEIGHT] = {
+        "##############################",
+        "#............................#",
+        "#............................#",
+        "#............................#",
+        "#............................#",
+        "#.........######.............#",
+        "#.........######.............#",
+        "#.........######.............#",
+        "#............................#",
+        "#............................#",
+        "#............................#",
+        "#............................#",
+        "#...................####.....#",
+        "#...................####.....#",
+        "#............................#",
+        "#............................#",
+        "#............................#",
+        "#............................#",
+        "#............................#",
+        "##############################",
+    };
+
+    const StationPose stations[] = {
+        // id, approach x/y, dock x/y, dock heading, wait x/y, tag x/y
+        {0, 50, 150, 50, 185, M_PI_2, 100, 120, 50, 200},
+        {1, 250, 150, 250, 185, M_PI_2, 270, 110, 250, 200},
+        {2, 150, 40, 150, 15, -M_PI_2, 200, 40, 150, 0},
+    };
+
+    const float START_X = 150;
+    const float START_Y = 100;
+    const float START_HEADING = 0;
+}
+
+int floorMapWidth()
+{
+    return MAP_WIDTH;
+}
+
+int floorMapHeight()
+{
+    return MAP_HEIGHT;
+}
+
+/**
+ * @brief returns wether a map cell is blocked, cells outside of the map are blocked
+ *
+ * @param cx cell column
+ * @param cy cell row
+ * @return true||false
+ */
+bool floorMapOccupied(int cx, int cy)
+{
+    if (cx < 0 || cy < 0 || cx >= MAP_WIDTH || cy >= MAP_HEIGHT)
+    {
+        return true;
+    }
+    return floorMap[cy][cx] == '#';
+}
+
+/**
+ * @brief distance along a ray to the first occupied cell, walks the cells the ray crosses
+ *
+ * @param x start in cm
+ * @param y start in cm
+ * @param angle direction of the ray in rad
+ * @param maxRange in cm
+ * @return distance in cm, maxRange if no occupied cell is closer
+ */
+float floorMapRayCast(float x, float y, float angle, float maxRange)
+{
+    const float size = FLOOR_MAP_CELL_SIZE;
+    int cx = floorf(x / size);
+    int cy = floorf(y / size);
+    if (floorMapOccupied(cx, cy))
+    {
+        return 0;
+    }
+    float dx = cosf(angle);
+    float dy = sinf(angle);
+    int stepX = dx > 0 ? 1 : -1;
+    int stepY = dy > 0 ? 1 : -1;
+    // distance along the ray to the next cell border in x and y and between two borders
+    float nextX = dx != 0 ? ((cx + (dx > 0)) * size - x) / dx : INFINITY;
+    float nextY = dy != 0 ? ((cy + (dy > 0)) * size - y) / dy : INFINITY;
+    float deltaX = dx != 0 ? size / fabsf(dx) : INFINITY;
+    float deltaY = dy != 0 ? size / fabsf(dy) : INFINITY;
+    // cells outside of the map are occupied, so the walk always ends
+    for (;;)
+    {
+        float t;
+        if (nextX < nextY)
+        {
+            t = nextX;
+            nextX += deltaX;
+            cx += stepX;
+        }
+        else
+        {
+            t = nextY;
+            nextY += deltaY;
+            cy += stepY;
+        }
+        if (t >= maxRange)
+        {
+            return maxRange;
+        }
+        if (floorMapOccupied(cx, cy))
+        {
+            return t;
+        }
+    }
+}
+
+/**
+ * @brief look up the pose of a station by its tag id
+ *
+ * @param id tag id of the station
+ * @return the station or NULL if it is not on the map
+ */
+const StationPose *floorMapStation(int id)
+{
+    for (const StationPose &station : stations)
+    {
+        if (station.id == id)
+        {
+            return &station;
+        }
+    }
+    return NULL;
+}
+
+/**
+ * @brief the pose the robot is placed at on power up
+ *
+ */
+void floorMapStartPose(float &x, float &y, float &heading)
+{
+    x = START_X;
+    y = START_Y;
+    heading = START_HEADING;
+}
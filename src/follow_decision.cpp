@@ -0,0 +1,97 @@
+#include <math.h>
+#include "defines.hpp"
+#include "ultrasonic.hpp"
+#include "follow_decision.hpp"
+
+namespace
+{
+    float leftAll(const ControlInputs &in)
+    {
+        return fminf(in.us[SENSOR_LEFT], in.us[SENSOR_FRONTL]);
+    }
+
+    float rightAll(const ControlInputs &in)
+    {
+        return fminf(in.us[SENSOR_RIGHT], in.us[SENSOR_FRONTR]);
+    }
+
+    float frontOut(const ControlInputs &in)
+    {
+        return fminf(in.us[SENSOR_FRONTL], in.us[SENSOR_FRONTR]);
+    }
+}
+
+/**
+ * @brief true if the tag is inside the small lock on band around TAG_CENTER
+ *
+ */
+bool followInnerLock(unsigned tagCenter)
+{
+    int center = tagCenter;
+    return center != 0 && center > TAG_CENTER - TAG_CENTER_DEADZONE_SMALL &&
+           center < TAG_CENTER + TAG_CENTER_DEADZONE_SMALL;
+}
+
+/**
+ * @brief one step of following the tag, depends only on the inputs and the state
+ * so a recorded run can be replayed on the host
+ *
+ * @param in sensor snapshot
+ * @param state lock and inner circle, updated
+ * @return the move to start
+ */
+FollowDecision followDecide(const ControlInputs &in, FollowState &state)
+{
+    FollowDecision decision = {FOLLOW_LOST, false};
+    unsigned center = in.tagCenter;
+    if (center == 0)
+    {
+        return decision;
+    }
+
+    // leave the lock outside the wide band, enter it inside the small one
+    if (state.lockedOn && ((int)center < TAG_CENTER - TAG_CENTER_DEADZONE ||
+                           (int)center > TAG_CENTER + TAG_CENTER_DEADZONE))
+    {
+        state.lockedOn = false;
+        decision.stop = true;
+    }
+    else if (!state.lockedOn && followInnerLock(center))
+    {
+        state.lockedOn = true;
+        decision.stop = true;
+    }
+
+    if (!state.innerCircle && in.tagSize > TAG_CLOSE_SIZE)
+    {
+        state.innerCircle = true;
+    }
+
+    if (!state.lockedOn && (int)center < TAG_CENTER)
+    {
+        decision.action = rightAll(in) < US_MIN_TRIGGER ? FOLLOW_WAIT : FOLLOW_TURN_RIGHT;
+    }
+    else if (!state.lockedOn && (int)center > TAG_CENTER)
+    {
+        decision.action = leftAll(in) < US_MIN_TRIGGER ? FOLLOW_WAIT : FOLLOW_TURN_LEFT;
+    }
+    else if (state.innerCircle && in.us[SENSOR_FRONTC] < 25)
+    {
+        decision.action = FOLLOW_DOCK;
+    }
+    else if (in.us[SENSOR_FRONTC] > US_NEAR_TRIGGER && frontOut(in) > 5)
+    {
+        decision.action = FOLLOW_STRAIGHT;
+    }
+    else
+    {
+        decision.action = FOLLOW_AVOID;
+    }
+    return decision;
+}
+
+const char *followActionName(uint8_t action)
+{
+    static const char *names[] = {"lost", "wait", "right", "left", "dock", "straight", "avoid"};
+    return action < sizeof(names) / sizeof(names[0]) ? names[action] : "unknown";
+}
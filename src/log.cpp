@@ -0,0 +1,226 @@
+#include <Arduino.h>
+#include <atomic>
+#include "defines.hpp"
+#include "tasks.hpp"
+#include "log.hpp"
+#include "wifi.hpp"
+#include "telnet_debug.hpp"
+
+extern bool telnetConnection;
+
+namespace
+{
+    struct LogRecord
+    {
+        // lap of the slot, the position without the index bits: free for writing
+        // at lap, readable at lap + 1, zero initialized slots are free in the first lap
+        std::atomic<uint32_t> sequence;
+        uint32_t time; // micros
+        const char *format;
+        uint8_t level;
+        uint8_t count;
+        LogArg args[LOG_MAX_ARGS];
+    };
+
+    /**
+     * @brief bounded ring with several writers (the tasks and interrupts of one core)
+     * and the log task as the only reader, writers claim a slot with compare and swap
+     * and publish it through the slot sequence
+     */
+    struct LogRing
+    {
+        LogRecord records[LOG_RING_SIZE];
+        std::atomic<uint32_t> head;
+        uint32_t tail;
+        // statistics
+        std::atomic<uint32_t> written;
+        std::atomic<uint32_t> dropped;
+        uint32_t maxUsed;
+    };
+    static_assert((LOG_RING_SIZE & (LOG_RING_SIZE - 1)) == 0, "LOG_RING_SIZE must be a power of two");
+
+    LogRing rings[portNUM_PROCESSORS];
+    char line[128];
+    const char levelNames[] = "DIWE";
+
+    uint32_t lapOf(uint32_t position)
+    {
+        return position & ~(uint32_t)(LOG_RING_SIZE - 1);
+    }
+
+    bool ringWrite(LogRing &ring, uint8_t level, const char *format, const LogArg *args, unsigned count)
+    {
+        uint32_t position = ring.head.load(std::memory_order_relaxed);
+        LogRecord *record;
+        for (;;)
+        {
+            record = &ring.records[position & (LOG_RING_SIZE - 1)];
+            int32_t diff = record->sequence.load(std::memory_order_acquire) - lapOf(position);
+            if (diff < 0)
+            {
+                return false;
+            }
+            if (diff == 0 && ring.head.compare_exchange_weak(position, position + 1, std::memory_order_relaxed))
+            {
+                break;
+            }
+            if (diff > 0)
+            {
+                position = ring.head.load(std::memory_order_relaxed);
+            }
+        }
+        record->time = micros();
+        record->format = format;
+        record->level = level;
+        record->count = count;
+        memcpy(record->args, args, count * sizeof(LogArg));
+        record->sequence.store(lapOf(position) + 1, std::memory_order_release);
+        return true;
+    }
+
+    bool ringRead(LogRing &ring, LogRecord &out)
+    {
+        LogRecord &record = ring.records[ring.tail & (LOG_RING_SIZE - 1)];
+        if (record.sequence.load(std::memory_order_acquire) != lapOf(ring.tail) + 1)
+        {
+            return false;
+        }
+        uint32_t used = ring.head.load(std::memory_order_relaxed) - ring.tail;
+        ring.maxUsed = max(ring.maxUsed, used);
+        out.time = record.time;
+        out.format = record.format;
+        out.level = record.level;
+        out.count = record.count;
+        memcpy(out.args, record.args, sizeof(out.args));
+        record.sequence.store(lapOf(ring.tail) + LOG_RING_SIZE, std::memory_order_release);
+        ring.tail++;
+        return true;
+    }
+
+    size_t formatArg(char *out, size_t size, const LogArg &arg)
+    {
+        switch (arg.type)
+        {
+        case LOG_ARG_INT:
+            return snprintf(out, size, "%ld", (long)(int32_t)arg.value);
+        case LOG_ARG_UINT:
+            return snprintf(out, size, "%lu", (unsigned long)arg.value);
+        case LOG_ARG_FLOAT:
+        {
+            float f;
+            memcpy(&f, &arg.value, sizeof(f));
+            return snprintf(out, size, "%.2f", f);
+        }
+        default:
+            return snprintf(out, size, "%s", (const char *)(uintptr_t)arg.value);
+        }
+    }
+
+    /**
+     * @brief format a record as "seconds level message" into line
+     *
+     * @return the line length
+     */
+    size_t format(const LogRecord &record)
+    {
+        size_t length = snprintf(line, sizeof(line), "%lu.%06lu %c ", (unsigned long)(record.time / 1000000),
+                                 (unsigned long)(record.time % 1000000), levelNames[record.level & 3]);
+        unsigned arg = 0;
+        for (const char *c = record.format; *c && length < sizeof(line) - 2; c++)
+        {
+            if (c[0] == '%' && c[1] != '\0' && arg < record.count)
+            {
+                c++;
+                length += formatArg(line + length, sizeof(line) - 1 - length, record.args[arg++]);
+                length = min(length, sizeof(line) - 2);
+                continue;
+            }
+            line[length++] = *c;
+        }
+        line[length++] = '\n';
+        line[length] = '\0';
+        return length;
+    }
+
+    void emit(size_t length)
+    {
+#if LOG_USE_SERIAL
+        Serial.print(line);
+#endif
+#if LOG_USE_TELNET
+        if (telnetConnection)
+        {
+            telnet.print(line);
+        }
+#endif
+#if LOG_USE_UDP
+        sendLog(line, length);
+#endif
+    }
+
+    void logTask(void *argument)
+    {
+        Serial.print("logTask is running on: ");
+        Serial.println(xPortGetCoreID());
+        LogRecord record;
+        for (;;)
+        {
+            bool any = false;
+            for (LogRing &ring : rings)
+            {
+                while (ringRead(ring, record))
+                {
+                    emit(format(record));
+                    any = true;
+                }
+            }
+            if (!any)
+            {
+                vTaskDelay(LOG_DRAIN_PERIOD);
+            }
+        }
+        Serial.println("logTask closed");
+        vTaskDelete(NULL);
+    }
+}
+
+/**
+ * @brief store a record in the ring of the calling core, never blocks
+ *
+ */
+void logWrite(uint8_t level, const char *format, const LogArg *args, unsigned count)
+{
+    LogRing &ring = rings[xPortGetCoreID()];
+    if (ringWrite(ring, level, format, args, count))
+    {
+        ring.written.fetch_add(1, std::memory_order_relaxed);
+    }
+    else
+    {
+        ring.dropped.fetch_add(1, std::memory_order_relaxed);
+    }
+}
+
+/**
+ * @brief start the log task on the core of the network tasks, records written before are kept
+ *
+ */
+void logInit()
+{
+    taskStart(TASK_LOG, logTask);
+}
+
+/**
+ * @brief print the ring statistics to telnet
+ *
+ */
+void logPrint()
+{
+    telnet.printf("log: level=%c ring=%u\n", levelNames[LOG_LEVEL], LOG_RING_SIZE);
+    for (unsigned core = 0; core < portNUM_PROCESSORS; core++)
+    {
+        const LogRing &ring = rings[core];
+        telnet.printf("  core %u: written=%u dropped=%u maxUsed=%u\n", core, ring.written.load(),
+                      ring.dropped.load(), ring.maxUsed);
+    }
+}
\ No newline at end of file
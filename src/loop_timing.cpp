@@ -0,0 +1,159 @@
+#include "loop_timing.hpp"
+#ifdef ARDUINO
+#include <Arduino.h>
+#include "esp_timer.h"
+#include "telnet_debug.hpp"
+#else
+#include <chrono>
+#include <stdio.h>
+#endif
+
+namespace
+{
+    /**
+     * @brief maps a period to a log-linear histogram bucket
+     *
+     */
+    unsigned bucketOf(uint32_t us)
+    {
+        if (us < LOOP_TIMING_SUB_BUCKETS)
+            return us;
+        unsigned octave = 31 - __builtin_clz(us);
+        unsigned sub = (us >> (octave - 2)) & (LOOP_TIMING_SUB_BUCKETS - 1);
+        return octave * LOOP_TIMING_SUB_BUCKETS + sub - LOOP_TIMING_SUB_BUCKETS;
+    }
+
+    /**
+     * @brief upper bound of a histogram bucket in us
+     *
+     */
+    uint32_t bucketLimit(unsigned bucket)
+    {
+        if (bucket < LOOP_TIMING_SUB_BUCKETS)
+            return bucket + 1;
+        unsigned octave = bucket / LOOP_TIMING_SUB_BUCKETS + 1;
+        unsigned sub = bucket % LOOP_TIMING_SUB_BUCKETS;
+        uint64_t limit = (uint64_t)(LOOP_TIMING_SUB_BUCKETS + sub + 1) << (octave - 2);
+        return limit > UINT32_MAX ? UINT32_MAX : limit;
+    }
+}
+
+/**
+ * @brief a 64 bit timestamp in us that does not wrap and is the same on both cores
+ *
+ */
+uint64_t loopTimingNow()
+{
+#ifdef ARDUINO
+    return esp_timer_get_time();
+#else
+    return std::chrono::duration_cast<std::chrono::microseconds>(
+               std::chrono::steady_clock::now().time_since_epoch())
+        .count();
+#endif
+}
+
+/**
+ * @brief the difference of two loopTimingNow() timestamps in us, saturated at UINT32_MAX
+ *
+ */
+uint32_t loopTimingElapsedUs(uint64_t start, uint64_t end)
+{
+    uint64_t us = end - start;
+    return us > UINT32_MAX ? UINT32_MAX : us;
+}
+
+/**
+ * @brief record a single measurement that is not a loop period, e.g. a delay
+ *
+ * @param timing
+ * @param us
+ */
+void loopTimingRecord(LoopTiming &timing, uint32_t us)
+{
+    if (timing.count == 0 || us < timing.minUs)
+        timing.minUs = us;
+    if (us > timing.maxUs)
+        timing.maxUs = us;
+    if (us > timing.budgetUs)
+        timing.misses++;
+    timing.totalUs += us;
+    timing.count++;
+    timing.lastUs = us;
+    timing.histogram[bucketOf(us)]++;
+}
+
+/**
+ * @brief call once per loop iteration, records the period since the last call
+ *
+ * @param timing
+ */
+void loopTimingTick(LoopTiming &timing)
+{
+    uint64_t now = loopTimingNow();
+    if (timing.running)
+    {
+        loopTimingRecord(timing, loopTimingElapsedUs(timing.lastTick, now));
+    }
+    timing.lastTick = now;
+    timing.running = true;
+}
+
+/**
+ * @brief call before a intended blocking wait, the next period is not recorded
+ *
+ * @param timing
+ */
+void loopTimingPause(LoopTiming &timing)
+{
+    timing.running = false;
+}
+
+void loopTimingReset(LoopTiming &timing)
+{
+    timing.running = false;
+    timing.count = 0;
+    timing.minUs = 0;
+    timing.maxUs = 0;
+    timing.totalUs = 0;
+    timing.lastUs = 0;
+    timing.misses = 0;
+    for (uint32_t &bucket : timing.histogram)
+    {
+        bucket = 0;
+    }
+}
+
+/**
+ * @brief returns an upper bound for the given percentile of all recorded periods
+ *
+ * @param timing
+ * @param percent 0..100
+ * @return the period in us
+ */
+uint32_t loopTimingPercentile(const LoopTiming &timing, unsigned percent)
+{
+    uint64_t target = ((uint64_t)timing.count * percent + 99) / 100;
+    uint64_t sum = 0;
+    for (unsigned i = 0; i < LOOP_TIMING_BUCKETS; i++)
+    {
+        sum += timing.histogram[i];
+        if (sum >= target && sum > 0)
+        {
+            return bucketLimit(i) < timing.maxUs ? bucketLimit(i) : timing.maxUs;
+        }
+    }
+    return timing.maxUs;
+}
+
+void loopTimingPrint(const LoopTiming &timing)
+{
+    uint32_t mean = timing.count ? timing.totalUs / timing.count : 0;
+#ifdef ARDUINO
+    telnet.printf("%s: n=%u min=%uus mean=%uus p99=%uus max=%uus budget=%uus misses=%u\n",
+#else
+    printf("%s: n=%u min=%uus mean=%uus p99=%uus max=%uus budget=%uus misses=%u\n",
+#endif
+                  timing.name, timing.count, timing.minUs, mean, loopTimingPercentile(timing, 99),
+                  timing.maxUs, timing.budgetUs, timing.misses);
+}
@@ -1,11 +1,18 @@
 #include <Arduino.h>
 #include "defines.hpp"
+#include "tasks.hpp"
 #include "wifi.hpp"
 #include "april_tag.hpp"
 #include "car_control.hpp"
 #include "stepper_motor.hpp"
 #include "ultrasonic.hpp"
+#include "pose_estimator.hpp"
 #include "object_recognition.hpp"
+#include "mission_queue.hpp"
+#include "telemetry_stream.hpp"
+#include "log.hpp"
+#include "black_box.hpp"
+#include "firmware.hpp"
 
 #define PIN_TRIGGER 22
 #define PIN_ECHO 18
@@ -15,24 +22,33 @@ unsigned long duration;
 unsigned int distance;
 extern bool telnetConnection;
 
-void setup()
+/**
+ * @brief initialize the modules and start the tasks, the unit tests on the target start the firmware with this too
+ *
+ * @param waitForTelnet block until a telnet client connected
+ */
+void firmwareStart(bool waitForTelnet)
 {
   // start serial interface:
   Serial.begin(SERIAL_BAUDRATE);
   Serial.println("start");
+  logInit();
 
-  // initialize
+  // initialize, the parameters first as the other modules read them
+  paramsInit();
+  blackBoxInit();
   stepperMotorsInit();
   if (!colorSensorInit())
   {
     Serial.println("colorSensorError");
   }
   calibrateLux();
+  missionQueueInit();
 
   // start up AP
   wifiSetup();
 
-  while (telnetConnection == false)
+  while (waitForTelnet && telnetConnection == false)
   {
     Serial.println("wait for telnet");
     delay(1000);
@@ -40,12 +56,23 @@ void setup()
 
   // attachInterrupt(PIN_US0_ECHO, pulse0Echo, CHANGE);
   // setup backround tasks;
-  xTaskCreatePinnedToCore(ultrasonicTask, "ultrasonicTask", 10000, NULL, 1, NULL, 1);
-  xTaskCreatePinnedToCore(steppersControlTask, "steppersControlTask", 10000, NULL, 1, NULL, 1);
-  xTaskCreatePinnedToCore(controlCarTask, "controlCarTask", 10000, NULL, 1, NULL, 1);
+  taskStart(TASK_ULTRASONIC, ultrasonicTask);
+  taskStart(TASK_STEPPERS_CONTROL, steppersControlTask);
+  taskStart(TASK_POSE_ESTIMATOR, poseEstimatorTask);
+  taskStart(TASK_CONTROL_CAR, controlCarTask);
+  telemetryStreamInit();
+}
+
+#ifndef PIO_UNIT_TESTING
+void setup()
+{
+  firmwareStart(true);
+
+  // all work runs in the tasks of TASK_TABLE, the arduino loop task would only compete with them
+  vTaskDelete(NULL);
 }
 
 void loop()
 {
-  vTaskDelay(0);
-}
\ No newline at end of file
+}
+#endif
\ No newline at end of file
@@ -0,0 +1,213 @@
+#include <Arduino.h>
+#include "defines.hpp"
+#include "mission_queue.hpp"
+#include "telnet_debug.hpp"
+
+namespace
+{
+    // ring buffer of the queued legs, head is the next leg to pop
+    MissionLeg legs[MISSION_QUEUE_LENGTH];
+    unsigned head = 0;
+    unsigned count = 0;
+    portMUX_TYPE queueMux = portMUX_INITIALIZER_UNLOCKED;
+
+    struct MissionCode
+    {
+        const char *code;
+        uint8_t mission;
+        const char *name;
+    };
+
+    const MissionCode missionCodes[] = {
+        {"d", missions::DELIVER, "DELIVER"},
+        {"gg", missions::GET_GUMMY, "GET_GUMMY"},
+        {"gc", missions::GET_COTTON, "GET_COTTON"},
+        {"gb", missions::GET_BALL, "GET_BALL"},
+    };
+}
+
+/**
+ * @brief empty the mission queue, must be called before any other missionQueue function
+ *
+ */
+void missionQueueInit()
+{
+    missionQueueClear();
+}
+
+/**
+ * @brief append a leg to the end of the mission queue
+ *
+ * @param mission one of missions::DELIVER, GET_GUMMY, GET_COTTON or GET_BALL
+ * @param station the tag id of the target station or ANY_STATION
+ * @return false if the mission is invalid or the queue is full
+ */
+bool missionQueuePush(uint8_t mission, int station)
+{
+    if (mission < missions::DELIVER || mission > missions::GET_BALL)
+    {
+        return false;
+    }
+    bool queued = false;
+    portENTER_CRITICAL(&queueMux);
+    if (count < MISSION_QUEUE_LENGTH)
+    {
+        legs[(head + count++) % MISSION_QUEUE_LENGTH] = {mission, station};
+        queued = true;
+    }
+    portEXIT_CRITICAL(&queueMux);
+    return queued;
+}
+
+/**
+ * @brief take the next leg from the mission queue without blocking
+ *
+ * @param leg receives the next leg
+ * @return false if the queue is empty
+ */
+bool missionQueuePop(MissionLeg &leg)
+{
+    bool popped = false;
+    portENTER_CRITICAL(&queueMux);
+    if (count > 0)
+    {
+        leg = legs[head];
+        head = (head + 1) % MISSION_QUEUE_LENGTH;
+        count--;
+        popped = true;
+    }
+    portEXIT_CRITICAL(&queueMux);
+    return popped;
+}
+
+unsigned missionQueueCount()
+{
+    portENTER_CRITICAL(&queueMux);
+    unsigned n = count;
+    portEXIT_CRITICAL(&queueMux);
+    return n;
+}
+
+void missionQueueClear()
+{
+    portENTER_CRITICAL(&queueMux);
+    head = 0;
+    count = 0;
+    portEXIT_CRITICAL(&queueMux);
+}
+
+/**
+ * @brief print all queued legs to telnet, the queue stays unchanged
+ *
+ */
+void missionQueuePrint()
+{
+    // copy the legs under the lock and print them after it
+    MissionLeg queued[MISSION_QUEUE_LENGTH];
+    portENTER_CRITICAL(&queueMux);
+    unsigned n = count;
+    for (unsigned i = 0; i < n; i++)
+    {
+        queued[i] = legs[(head + i) % MISSION_QUEUE_LENGTH];
+    }
+    portEXIT_CRITICAL(&queueMux);
+    telnet.printf("%u queued legs\n", n);
+    for (unsigned i = 0; i < n; i++)
+    {
+        const MissionLeg &leg = queued[i];
+        if (leg.station == ANY_STATION)
+        {
+            telnet.printf("%u: %s at any station\n", i, missionName(leg.mission));
+        }
+        else
+        {
+            telnet.printf("%u: %s at station %d\n", i, missionName(leg.mission), leg.station);
+        }
+    }
+}
+
+/**
+ * @brief converts a telnet mission code (d, gg, gc, gb) to a mission
+ *
+ * @param code
+ * @return the mission or NO_MISSION if the code is unknown
+ */
+uint8_t missionFromCode(const char *code)
+{
+    for (const MissionCode &m : missionCodes)
+    {
+        if (strcmp(code, m.code) == 0)
+        {
+            return m.mission;
+        }
+    }
+    return missions::NO_MISSION;
+}
+
+const char *missionName(uint8_t mission)
+{
+    for (const MissionCode &m : missionCodes)
+    {
+        if (m.mission == mission)
+        {
+            return m.name;
+        }
+    }
+    return "UNKNOWN";
+}
+
+/**
+ * @brief queue a whole trip given as a list of "code [station]" pairs,
+ * e.g. "gg 1 d 2" picks up a gummy at station 1 and delivers it to station 2
+ *
+ * @param trip the space separated trip description
+ * @return false if the trip could not be parsed or the queue is full
+ */
+bool missionQueueParse(const char *trip)
+{
+    char buf[64];
+    strncpy(buf, trip, sizeof(buf) - 1);
+    buf[sizeof(buf) - 1] = '\0';
+
+    MissionLeg parsed[MISSION_QUEUE_LENGTH];
+    unsigned numLegs = 0;
+    char *save = NULL;
+    for (char *tok = strtok_r(buf, " ", &save); tok != NULL; tok = strtok_r(NULL, " ", &save))
+    {
+        char *end;
+        long station = strtol(tok, &end, 10);
+        if (*end == '\0' && numLegs > 0)
+        {
+            // station ids are tag ids, negative only for any station
+            if (station != ANY_STATION && (station < 0 || station > 254))
+            {
+                return false;
+            }
+            parsed[numLegs - 1].station = station;
+            continue;
+        }
+        uint8_t mission = missionFromCode(tok);
+        if (mission == missions::NO_MISSION || numLegs >= MISSION_QUEUE_LENGTH)
+        {
+            return false;
+        }
+        parsed[numLegs++] = {mission, ANY_STATION};
+    }
+    if (numLegs == 0)
+    {
+        return false;
+    }
+    // all legs or none
+    bool queued = false;
+    portENTER_CRITICAL(&queueMux);
+    if (count + numLegs <= MISSION_QUEUE_LENGTH)
+    {
+        for (unsigned i = 0; i < numLegs; i++)
+        {
+            legs[(head + count++) % MISSION_QUEUE_LENGTH] = parsed[i];
+        }
+        queued = true;
+    }
+    portEXIT_CRITICAL(&queueMux);
+    return queued;
+}
@@ -1,128 +1,562 @@
 #include <Wire.h>
 #include <Adafruit_TCS34725.h>
 #include "defines.hpp"
+#include "tasks.hpp"
+#include "log.hpp"
 #include "object_recognition.hpp"
 #include "telnet_debug.hpp"
+#include "task_profiler.hpp"
+#include "cargo_classifier.hpp"
+#include <Preferences.h>
 
 namespace
 {
     Adafruit_TCS34725 tcs = Adafruit_TCS34725(TCS34725_INTEGRATIONTIME_50MS, TCS34725_GAIN_1X);
     unsigned CO_OBJ_THRESHOLD = 0;
+
+    // the led lights the object for color measurements and is off to measure the ambient light
+    const int LED_ON = HIGH;
+    const int LED_OFF = LOW;
+
+    struct ColorFrame
+    {
+        uint16_t r, g, b, c;
+    };
+
+    /**
+     * @brief gain and integration time steps of the auto ranging, ordered by sensitivity
+     *
+     */
+    struct ColorRange
+    {
+        tcs34725Gain_t gain;
+        uint8_t integrationTime;
+        float gainFactor;
+    };
+    const ColorRange ranges[] = {
+        {TCS34725_GAIN_1X, TCS34725_INTEGRATIONTIME_24MS, 1},
+        {TCS34725_GAIN_1X, TCS34725_INTEGRATIONTIME_50MS, 1},
+        {TCS34725_GAIN_4X, TCS34725_INTEGRATIONTIME_50MS, 4},
+        {TCS34725_GAIN_16X, TCS34725_INTEGRATIONTIME_50MS, 16},
+        {TCS34725_GAIN_60X, TCS34725_INTEGRATIONTIME_50MS, 60},
+        {TCS34725_GAIN_60X, TCS34725_INTEGRATIONTIME_101MS, 60},
+    };
+    const unsigned NUM_RANGES = sizeof(ranges) / sizeof(ranges[0]);
+    // the range the presence threshold is calibrated in
+    const unsigned BASE_RANGE = 1;
+    unsigned range = BASE_RANGE;
+
+    // rolling window of the latest ambient frames, cleared when the range changes
+    ColorFrame ambientWindow[COLOR_AMBIENT_WINDOW];
+    unsigned ambientFrames = 0;
+
+    // accumulated log likelihood of all lit frames since the cargo last changed
+    float evidence[CLASSIFIER_MAX_CLASSES];
+    unsigned evidenceFrames = 0;
+    unsigned long evidenceStart = 0;
+    bool decided = false;
+    unsigned long lastConfirm = 0;
+    unsigned bestClass = RECOGNITION_NONE;
+    float bestConfidence = 0;
+    bool present = false;
+    unsigned lastDecisionFrames = 0;
+    unsigned long lastDecisionMs = 0;
+    unsigned cargoLostEvents = 0;
+    unsigned cargoChangedEvents = 0;
+
+    ColorSnapshot snapshot = {false, RECOGNITION_NONE, 0, 0, 0, 0};
+    portMUX_TYPE snapshotMux = portMUX_INITIALIZER_UNLOCKED;
+
+    // centroids are loaded from nvs, changes from telnet are swapped in under the mutex
+    CargoClassifier classifier;
+    portMUX_TYPE classifierMux = portMUX_INITIALIZER_UNLOCKED;
+    volatile unsigned classifierChanges = 0;
+    Preferences preferences;
+
+    // labeled frames still to be logged for training
+    char logLabel[16] = "";
+    unsigned logRemaining = 0;
+
+    const char *const classNames[] = {"error", "none", "gummy", "ball", "cotton"};
+
+    /**
+     * @brief maximum raw count of the current range, normalized by its gain
+     *
+     */
+    float fullScale()
+    {
+        float counts = min((256 - ranges[range].integrationTime) * 1024.0f, 65535.0f);
+        return counts * ranges[range].gainFactor;
+    }
+
+    /**
+     * @brief sensitivity of the current range relative to BASE_RANGE
+     *
+     */
+    float rangeScale()
+    {
+        return ranges[range].gainFactor * (256 - ranges[range].integrationTime) /
+               (ranges[BASE_RANGE].gainFactor * (256 - ranges[BASE_RANGE].integrationTime));
+    }
+
+    /**
+     * @brief converts a class name or number to a RecognitedObject value
+     *
+     * @return the class or -1 if the name is unknown
+     */
+    int classFromName(const char *name)
+    {
+        for (unsigned i = 0; i < sizeof(classNames) / sizeof(classNames[0]); i++)
+        {
+            if (strcmp(name, classNames[i]) == 0)
+                return i;
+        }
+        char *end;
+        long id = strtol(name, &end, 10);
+        return (*end == '\0' && id >= 0 && id < 256) ? id : -1;
+    }
+
+    void loadClassifier()
+    {
+        cargoClassifierDefaults(classifier);
+        preferences.begin("cargo", true);
+        CargoClassifier stored;
+        if (preferences.getBytesLength("model") == sizeof(stored) &&
+            preferences.getBytes("model", &stored, sizeof(stored)) == sizeof(stored) &&
+            stored.version == classifier.version && stored.numCentroids <= CLASSIFIER_MAX_CLASSES)
+        {
+            classifier = stored;
+            LOG_INFO("cargo classifier loaded from nvs");
+        }
+        preferences.end();
+    }
+
+    /**
+     * @brief read one frame after switching the led,
+     * getRawData waits one integration time, so the first frame after a switch is dropped
+     *
+     */
+    ColorFrame readFrame(int led)
+    {
+        ColorFrame f;
+        if (digitalRead(PIN_LED_COLOR) != led)
+        {
+            digitalWrite(PIN_LED_COLOR, led);
+            tcs.getRawData(&f.r, &f.g, &f.b, &f.c);
+        }
+        tcs.getRawData(&f.r, &f.g, &f.b, &f.c);
+        return f;
+    }
+
+    /**
+     * @brief per channel mean of the ambient window
+     *
+     */
+    void ambientMean(uint16_t mean[4])
+    {
+        unsigned n = min(ambientFrames, (unsigned)COLOR_AMBIENT_WINDOW);
+        uint32_t sum[4] = {0};
+        for (unsigned i = 0; i < n; i++)
+        {
+            sum[0] += ambientWindow[i].r;
+            sum[1] += ambientWindow[i].g;
+            sum[2] += ambientWindow[i].b;
+            sum[3] += ambientWindow[i].c;
+        }
+        for (int i = 0; i < 4; i++)
+        {
+            mean[i] = n ? sum[i] / n : 0;
+        }
+    }
+
+    /**
+     * @brief mean lux of the ambient window, normalized to BASE_RANGE
+     *
+     */
+    uint16_t ambientLux()
+    {
+        uint16_t ambient[4];
+        ambientMean(ambient);
+        return tcs.calculateLux(ambient[0], ambient[1], ambient[2]) / rangeScale();
+    }
+
+    void resetEvidence()
+    {
+        for (float &e : evidence)
+        {
+            e = 0;
+        }
+        evidenceFrames = 0;
+        evidenceStart = millis();
+        decided = false;
+        bestClass = RECOGNITION_NONE;
+        bestConfidence = 0;
+    }
+
+    /**
+     * @brief step the gain and integration time to keep the clear channel in range,
+     * frames of different ranges are not comparable, so all windows are cleared
+     *
+     * @param c the clear channel of the latest lit frame
+     * @return true if the range was changed
+     */
+    bool autoRange(uint16_t c)
+    {
+        float counts = fullScale() / ranges[range].gainFactor;
+        unsigned next = range;
+        if (c > counts * COLOR_RANGE_HIGH && range > 0)
+            next = range - 1;
+        else if (c < counts * COLOR_RANGE_LOW && range < NUM_RANGES - 1)
+            next = range + 1;
+        if (next == range)
+            return false;
+        range = next;
+        tcs.setGain(ranges[range].gain);
+        tcs.setIntegrationTime(ranges[range].integrationTime);
+        ambientFrames = 0;
+        resetEvidence();
+        return true;
+    }
+
+    /**
+     * @brief add a lit frame to the evidence, the class is decided as soon as
+     * its posterior passes COLOR_DECISION_CONFIDENCE or COLOR_MAX_SAMPLES frames were taken
+     *
+     */
+    void addEvidence(const ColorFrame &lit)
+    {
+        uint16_t ambient[4];
+        ambientMean(ambient);
+        const uint16_t litRgbc[4] = {lit.r, lit.g, lit.b, lit.c};
+        float features[CLASSIFIER_FEATURES];
+        cargoFeatures(litRgbc, ambient, fullScale(), features);
+
+        float ll[CLASSIFIER_MAX_CLASSES];
+        portENTER_CRITICAL(&classifierMux);
+        CargoClassifier c = classifier;
+        portEXIT_CRITICAL(&classifierMux);
+        cargoLogLikelihoods(c, features, ll);
+        if (c.numCentroids == 0)
+        {
+            bestClass = RECOGNITION_ERROR;
+            return;
+        }
+
+        unsigned frameBest = 0;
+        for (unsigned k = 1; k < c.numCentroids; k++)
+        {
+            if (ll[k] > ll[frameBest])
+                frameBest = k;
+        }
+        // a confirmation frame that disagrees with the decision starts a new measurement
+        if (decided && c.centroids[frameBest].cargoClass != bestClass)
+        {
+            LOG_INFO("cargo changed, measuring again");
+            resetEvidence();
+        }
+
+        unsigned best = 0;
+        for (unsigned k = 0; k < c.numCentroids; k++)
+        {
+            evidence[k] += ll[k];
+            if (evidence[k] > evidence[best])
+                best = k;
+        }
+        evidenceFrames++;
+        float sum = 0;
+        for (unsigned k = 0; k < c.numCentroids; k++)
+        {
+            sum += expf(evidence[k] - evidence[best]);
+        }
+        bestClass = c.centroids[best].cargoClass;
+        bestConfidence = 1 / sum;
+        if (!decided && (bestConfidence >= COLOR_DECISION_CONFIDENCE || evidenceFrames >= COLOR_MAX_SAMPLES))
+        {
+            decided = true;
+            lastDecisionFrames = evidenceFrames;
+            lastDecisionMs = millis() - evidenceStart;
+        }
+    }
+
+    /**
+     * @brief publish presence and cargo class as a new snapshot
+     *
+     */
+    void updateSnapshot()
+    {
+        ColorSnapshot s;
+        s.present = present;
+        s.cargoClass = present ? bestClass : RECOGNITION_NONE;
+        s.confidence = present ? bestConfidence : 1;
+        s.lux = ambientLux();
+        s.timestamp = millis();
+        portENTER_CRITICAL(&snapshotMux);
+        s.stableSince = (s.present == snapshot.present && s.cargoClass == snapshot.cargoClass)
+                            ? snapshot.stableSince
+                            : s.timestamp;
+        snapshot = s;
+        portEXIT_CRITICAL(&snapshotMux);
+    }
+
+    /**
+     * @brief print a labeled frame for tools/train_classifier.py
+     *
+     */
+    void logFrame(const ColorFrame &lit)
+    {
+        if (logRemaining == 0)
+            return;
+        logRemaining--;
+        uint16_t ambient[4];
+        ambientMean(ambient);
+        telnet.printf("sample,%s,%lu,%u,%u,%u,%u,%u,%u,%u,%u,%.0f,%.1f\n", logLabel, millis(),
+                      lit.r, lit.g, lit.b, lit.c, ambient[0], ambient[1], ambient[2], ambient[3], fullScale(),
+                      (256 - ranges[range].integrationTime) * 2.4f);
+    }
+
+    /**
+     * @brief background task reading the color sensor on its integration time schedule.
+     * Every cycle reads an ambient frame with the led off for the presence detection.
+     * While cargo is present but not yet classified, up to COLOR_FRAMES_PER_CYCLE lit frames follow,
+     * afterwards a single lit frame every COLOR_CONFIRM_PERIOD confirms the class.
+     *
+     */
+    void colorSamplerTask(void *argument)
+    {
+        Serial.print("colorSamplerTask is running on: ");
+        Serial.println(xPortGetCoreID());
+        unsigned profilerSlot = profilerRegister();
+        unsigned lastClassifierChanges = classifierChanges;
+
+        for (;;)
+        {
+            profilerLoop(profilerSlot);
+            ambientWindow[ambientFrames++ % COLOR_AMBIENT_WINDOW] = readFrame(LED_OFF);
+            // hysteresis: present below the band under the baseline, gone again above the baseline
+            unsigned lux = ambientLux();
+            bool nowPresent = present ? lux <= CO_OBJ_THRESHOLD : lux < CO_OBJ_THRESHOLD * (1 - COLOR_PRESENCE_BAND);
+            if (nowPresent != present || lastClassifierChanges != classifierChanges)
+            {
+                present = nowPresent;
+                lastClassifierChanges = classifierChanges;
+                resetEvidence();
+            }
+
+            bool confirm = decided && millis() - lastConfirm > COLOR_CONFIRM_PERIOD;
+            if (logRemaining > 0 || (present && (!decided || confirm)))
+            {
+                for (unsigned i = 0; i < COLOR_FRAMES_PER_CYCLE; i++)
+                {
+                    ColorFrame lit = readFrame(LED_ON);
+                    logFrame(lit);
+                    if (autoRange(lit.c))
+                    {
+                        break;
+                    }
+                    if (present)
+                    {
+                        addEvidence(lit);
+                    }
+                    if (decided && logRemaining == 0)
+                    {
+                        break;
+                    }
+                }
+                lastConfirm = millis();
+            }
+            updateSnapshot();
+            vTaskDelay(1);
+        }
+        Serial.println("colorSamplerTask closed");
+        vTaskDelete(NULL);
+    }
 }
 
+/**
+ * @brief initialize the color sensor and start the background sampler
+ *
+ * @return false if the sensor was not found
+ */
 bool colorSensorInit()
 {
     digitalWrite(PIN_LED_COLOR, HIGH);
     Wire.begin(PIN_SDA_COLOR, PIN_SCL_COLOR);
     pinMode(PIN_LED_COLOR, OUTPUT);
-    return tcs.begin();
+    if (!tcs.begin())
+    {
+        return false;
+    }
+    loadClassifier();
+    taskStart(TASK_COLOR_SAMPLER, colorSamplerTask);
+    return true;
 }
 
-unsigned returnLux()
+/**
+ * @brief returns the latest published sampler state without blocking
+ *
+ */
+ColorSnapshot colorSnapshot()
 {
-    uint16_t r, g, b, c, lux, lux_mean;
-    tcs.getRawData(&r, &g, &b, &c);
-    lux_mean = tcs.calculateLux(r, g, b);
-
-    long time = millis();
-    for (size_t i = 0; i < NUM_CO_SAMPLES; i++)
-    {
-        tcs.getRawData(&r, &g, &b, &c);
-        lux = tcs.calculateLux(r, g, b);
-        lux_mean += lux;
-        // Serial.print(r);
-        // Serial.print(" ");
-        // Serial.print(g);
-        // Serial.print(" ");
-        // Serial.print(b);
-        // Serial.println();
-        delay(100);
-    }
-    lux_mean = lux_mean / NUM_CO_SAMPLES;
-    DEBUG_VAR(lux_mean);
-    return lux_mean;
+    portENTER_CRITICAL(&snapshotMux);
+    ColorSnapshot s = snapshot;
+    portEXIT_CRITICAL(&snapshotMux);
+    return s;
 }
 
+/**
+ * @brief use the current ambient light as the empty container baseline,
+ * waits until the sampler has filled its ambient window
+ *
+ */
 void calibrateLux()
 {
-    digitalWrite(PIN_LED_COLOR, LOW);
-    delay(100);
-    unsigned lux_mean = returnLux();
-    digitalWrite(PIN_LED_COLOR, HIGH);
-    DEBUG_MSG("calibrate baseline lux to:");
-    DEBUG_VAR(lux_mean);
+    unsigned long start = millis();
+    while (ambientFrames < COLOR_AMBIENT_WINDOW && millis() - start < 5000)
+    {
+        delay(10);
+    }
+    unsigned lux_mean = ambientLux();
+    LOG_INFO("calibrate baseline lux to: %d", lux_mean);
     CO_OBJ_THRESHOLD = lux_mean;
 }
 
 unsigned measureObject()
 {
-    uint16_t r_mean, g_mean, b_mean;
-    uint16_t r, g, b, c, colorTemp, lux;
-
-    digitalWrite(PIN_LED_COLOR, HIGH);
-
-    tcs.getRawData(&r, &g, &b, &c);
-    colorTemp = tcs.calculateColorTemperature(r, g, b);
-    lux = tcs.calculateLux(r, g, b);
-
-    r_mean = r;
-    g_mean = g;
-    b_mean = b;
+    return colorSnapshot().cargoClass;
+}
 
-    long time = millis();
+bool objectLoaded()
+{
+    return colorSnapshot().present;
+}
 
-    for (size_t i = 0; i < NUM_CO_SAMPLES; i++)
+/**
+ * @brief compare the sampler state with the expected cargo,
+ * a difference is only reported once it was stable for COLOR_MONITOR_DEBOUNCE
+ * so the cargo rattling in the container while driving is ignored
+ *
+ * @param expectedClass the loaded class, RECOGNITION_NONE if the container should be empty
+ * @return the detected event, CARGO_EVENT_NONE while nothing changed or the change is not settled
+ */
+CargoEvent cargoMonitor(unsigned expectedClass)
+{
+    ColorSnapshot s = colorSnapshot();
+    if (millis() - s.stableSince < COLOR_MONITOR_DEBOUNCE)
     {
-        tcs.getRawData(&r, &g, &b, &c);
-        r_mean += r;
-        g_mean += g;
-        b_mean += b;
-        delay(100);
+        return CARGO_EVENT_NONE;
     }
-    r_mean = r_mean / NUM_CO_SAMPLES;
-    g_mean = g_mean / NUM_CO_SAMPLES;
-    b_mean = b_mean / NUM_CO_SAMPLES;
-
-    if ((r_mean * 100 / b_mean) < 72 && (g_mean * 100 / b_mean) < 90)
+    if (!s.present && expectedClass != RECOGNITION_NONE)
     {
-        return RECOGNITION_COTTON;
+        cargoLostEvents++;
+        return CARGO_EVENT_LOST;
     }
-    else if ((r_mean * 100 / b_mean) > 72 && (r_mean * 100 / b_mean) < 180 && (g_mean * 100 / b_mean) > 90 && (g_mean * 100 / b_mean) > 165)
+    if (s.present && s.cargoClass != expectedClass && s.cargoClass != RECOGNITION_ERROR &&
+        s.confidence >= COLOR_MIN_CONFIDENCE)
     {
-        return RECOGNITION_GUMMY;
+        cargoChangedEvents++;
+        return CARGO_EVENT_CHANGED;
     }
-    else if ((r_mean * 100 / b_mean) > 180 && (g_mean * 100 / b_mean) > 165)
+    return CARGO_EVENT_NONE;
+}
+
+/**
+ * @brief print the latest sampler state to telnet
+ *
+ */
+void colorPrint()
+{
+    ColorSnapshot s = colorSnapshot();
+    telnet.printf("cargo: present=%d class=%u confidence=%.2f lux=%u threshold=%u age=%lums stable=%lums\n",
+                  s.present, s.cargoClass, s.confidence, s.lux, CO_OBJ_THRESHOLD,
+                  millis() - s.timestamp, millis() - s.stableSince);
+    telnet.printf("sensor: range=%u gain=%.0fx full scale=%.0f last decision: %u frames %lums\n",
+                  range, ranges[range].gainFactor, fullScale(), lastDecisionFrames, lastDecisionMs);
+    telnet.printf("events: lost=%u changed=%u\n", cargoLostEvents, cargoChangedEvents);
+}
+
+/**
+ * @brief print the centroids of the cargo classifier to telnet
+ *
+ */
+void colorPrintModel()
+{
+    portENTER_CRITICAL(&classifierMux);
+    CargoClassifier c = classifier;
+    portEXIT_CRITICAL(&classifierMux);
+    for (unsigned k = 0; k < c.numCentroids; k++)
     {
-        return RECOGNITION_BALL;
+        const CargoCentroid &centroid = c.centroids[k];
+        telnet.printf("centroid %u: mean %.4f %.4f %.4f stddev %.4f %.4f %.4f\n", centroid.cargoClass,
+                      centroid.mean[0], centroid.mean[1], centroid.mean[2],
+                      centroid.stddev[0], centroid.stddev[1], centroid.stddev[2]);
     }
-    // double cheking if none where true which is the most likely
-    else if ((r_mean * 100 / b_mean) < 50)
+}
+
+/**
+ * @brief handle the "color ..." telnet commands
+ * log <label> <n>: print n labeled frames for training
+ * model: print the centroids
+ * set <class> <mean 0..2> <stddev 0..2>: replace or add a centroid
+ * save: store the centroids in nvs
+ * defaults: restore the untrained centroids
+ *
+ * @param args the command without "color "
+ * @return false if the command is unknown or invalid
+ */
+bool colorCommand(const char *args)
+{
+    char label[16];
+    unsigned n;
+    CargoCentroid centroid;
+    char name[16];
+    if (sscanf(args, "log %15s %u", label, &n) == 2)
     {
-        return RECOGNITION_COTTON;
+        strcpy(logLabel, label);
+        logRemaining = n;
+        return true;
     }
-    else if ((r_mean * 100 / b_mean) > 220)
+    if (strcmp(args, "model") == 0)
     {
-        return RECOGNITION_BALL;
+        colorPrintModel();
+        return true;
     }
-    else if ((r_mean * 100 / b_mean) > 50)
+    if (sscanf(args, "set %15s %f %f %f %f %f %f", name, &centroid.mean[0], &centroid.mean[1], &centroid.mean[2],
+               &centroid.stddev[0], &centroid.stddev[1], &centroid.stddev[2]) == 7)
     {
-        return RECOGNITION_GUMMY;
+        int id = classFromName(name);
+        if (id < 0)
+            return false;
+        centroid.cargoClass = id;
+        portENTER_CRITICAL(&classifierMux);
+        CargoClassifier c = classifier;
+        portEXIT_CRITICAL(&classifierMux);
+        if (!cargoClassifierSet(c, centroid))
+            return false;
+        portENTER_CRITICAL(&classifierMux);
+        classifier = c;
+        portEXIT_CRITICAL(&classifierMux);
+        classifierChanges++;
+        return true;
     }
-    else
+    if (strcmp(args, "save") == 0)
     {
-        return RECOGNITION_ERROR;
+        portENTER_CRITICAL(&classifierMux);
+        CargoClassifier c = classifier;
+        portEXIT_CRITICAL(&classifierMux);
+        preferences.begin("cargo", false);
+        bool ok = preferences.putBytes("model", &c, sizeof(c)) == sizeof(c);
+        preferences.end();
+        return ok;
     }
-}
-
-bool objectLoaded()
-{
-    DEBUG_VAR(CO_OBJ_THRESHOLD);
-    digitalWrite(PIN_LED_COLOR, LOW);
-    delay(100);
-    unsigned lux_mean = returnLux();
-    digitalWrite(PIN_LED_COLOR, HIGH);
-    if (lux_mean > CO_OBJ_THRESHOLD)
-        return false;
-    else
+    if (strcmp(args, "defaults") == 0)
+    {
+        CargoClassifier c;
+        cargoClassifierDefaults(c);
+        portENTER_CRITICAL(&classifierMux);
+        classifier = c;
+        portEXIT_CRITICAL(&classifierMux);
+        classifierChanges++;
         return true;
-}
\ No newline at end of file
+    }
+    return false;
+}
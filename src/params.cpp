@@ -0,0 +1,207 @@
+#include <Arduino.h>
+#include <Preferences.h>
+#include <type_traits>
+#include "params.hpp"
+#include "telnet_debug.hpp"
+
+Params params = {
+#define PARAM_DEFAULT(field, type, name, def, min, max, help) def,
+    PARAM_TABLE(PARAM_DEFAULT)
+#undef PARAM_DEFAULT
+};
+
+namespace
+{
+    struct ParamInfo
+    {
+        const char *name;
+        bool isFloat;
+        float def;
+        float min;
+        float max;
+        const char *help;
+        size_t offset;
+    };
+
+    const ParamInfo paramInfo[] = {
+#define PARAM_INFO(field, type, name, def, min, max, help) \
+    {name, std::is_floating_point<type>::value, def, min, max, help, offsetof(Params, field)},
+        PARAM_TABLE(PARAM_INFO)
+#undef PARAM_INFO
+    };
+    const unsigned PARAM_COUNT = sizeof(paramInfo) / sizeof(paramInfo[0]);
+
+    void (*listeners[PARAM_MAX_LISTENERS])(unsigned index);
+    Preferences preferences;
+
+    /**
+     * @brief fingerprint of the names and types, a stored blob of another firmware is not loaded
+     *
+     */
+    uint32_t layoutHash()
+    {
+        uint32_t hash = 2166136261u;
+        for (const ParamInfo &info : paramInfo)
+        {
+            for (const char *c = info.name; *c != '\0'; c++)
+            {
+                hash = (hash ^ *c) * 16777619u;
+            }
+            hash = (hash ^ info.isFloat) * 16777619u;
+        }
+        return hash;
+    }
+
+    void store(unsigned index, float value)
+    {
+        uint8_t *field = (uint8_t *)&params + paramInfo[index].offset;
+        if (paramInfo[index].isFloat)
+        {
+            *(float *)field = value;
+        }
+        else
+        {
+            *(int32_t *)field = lroundf(value);
+        }
+    }
+
+    void notify(unsigned index)
+    {
+        for (auto listener : listeners)
+        {
+            if (listener != NULL)
+            {
+                listener(index);
+            }
+        }
+    }
+}
+
+/**
+ * @brief load the parameters saved in nvs, call before any task reads them
+ *
+ */
+void paramsInit()
+{
+    preferences.begin("params", true);
+    Params stored;
+    if (preferences.getUInt("layout", 0) == layoutHash() &&
+        preferences.getBytes("values", &stored, sizeof(stored)) == sizeof(stored))
+    {
+        params = stored;
+        // values outside of the bounds of this firmware fall back to the default
+        for (unsigned i = 0; i < PARAM_COUNT; i++)
+        {
+            float value = paramGet(i);
+            if (!(value >= paramInfo[i].min && value <= paramInfo[i].max))
+            {
+                store(i, paramInfo[i].def);
+            }
+        }
+        Serial.println("parameters loaded from nvs");
+    }
+    preferences.end();
+}
+
+unsigned paramCount()
+{
+    return PARAM_COUNT;
+}
+
+/**
+ * @brief index of a parameter by its name
+ *
+ * @return the index or -1
+ */
+int paramFind(const char *name)
+{
+    for (unsigned i = 0; i < PARAM_COUNT; i++)
+    {
+        if (strcmp(paramInfo[i].name, name) == 0)
+        {
+            return i;
+        }
+    }
+    return -1;
+}
+
+const char *paramName(unsigned index)
+{
+    return index < PARAM_COUNT ? paramInfo[index].name : "";
+}
+
+float paramGet(unsigned index)
+{
+    if (index >= PARAM_COUNT)
+        return 0;
+    const uint8_t *field = (const uint8_t *)&params + paramInfo[index].offset;
+    return paramInfo[index].isFloat ? *(const float *)field : *(const int32_t *)field;
+}
+
+/**
+ * @brief change a parameter at runtime, the change is not saved to nvs
+ *
+ * @return false if the index or the value is out of bounds
+ */
+bool paramSet(unsigned index, float value)
+{
+    if (index >= PARAM_COUNT || !(value >= paramInfo[index].min && value <= paramInfo[index].max))
+    {
+        return false;
+    }
+    store(index, value);
+    notify(index);
+    return true;
+}
+
+/**
+ * @brief restore all defaults, the saved values stay in nvs until paramsSave
+ *
+ */
+void paramsReset()
+{
+    for (unsigned i = 0; i < PARAM_COUNT; i++)
+    {
+        store(i, paramInfo[i].def);
+        notify(i);
+    }
+}
+
+bool paramsSave()
+{
+    Params current = params;
+    preferences.begin("params", false);
+    bool ok = preferences.putUInt("layout", layoutHash()) == sizeof(uint32_t) &&
+              preferences.putBytes("values", &current, sizeof(current)) == sizeof(current);
+    preferences.end();
+    return ok;
+}
+
+/**
+ * @brief register a function that is called with the index of every changed parameter
+ *
+ * @return false if all listener slots are taken
+ */
+bool paramOnChange(void (*listener)(unsigned index))
+{
+    for (auto &slot : listeners)
+    {
+        if (slot == NULL)
+        {
+            slot = listener;
+            return true;
+        }
+    }
+    return false;
+}
+
+/**
+ * @brief print value, bounds and help of a parameter to telnet
+ *
+ */
+void paramPrint(unsigned index)
+{
+    const ParamInfo &info = paramInfo[index];
+    telnet.printf(info.isFloat ? "%u %s=%.3f default=%.3f [%g, %g] %s\n" : "%u %s=%.0f default=%.0f [%g, %g] %s\n",
+                  index, info.name, paramGet(index), info.def, info.min, info.max, info.help);
+}
@@ -0,0 +1,388 @@
+#include <math.h>
+#include "defines.hpp"
+#include "pose_estimator.hpp"
+#include "floor_map.hpp"
+#ifdef ARDUINO
+#include <Arduino.h>
+#include "stepper_motor.hpp"
+#include "ultrasonic.hpp"
+#include "docking.hpp"
+#include "april_tag.hpp"
+#include "task_profiler.hpp"
+#include "telnet_debug.hpp"
+#endif
+
+namespace
+{
+    float wrapAngle(float a)
+    {
+        return remainderf(a, 2 * (float)M_PI);
+    }
+
+    /**
+     * @brief range a sensor is expected to measure from a pose, the closest mapped wall within its beam.
+     * The walls of the map are inflated by half the robot width, this is about the offset of the
+     * sensors from the robot center, so the range from the center to the inflated wall is the
+     * range from the sensor to the real wall
+     *
+     */
+    float expectedRange(float x, float y, float direction, float maxRange)
+    {
+        const float halfBeam = US_BEAM_WIDTH * (float)M_PI / 360;
+        float range = floorMapRayCast(x, y, direction, maxRange);
+        range = fminf(range, floorMapRayCast(x, y, direction - halfBeam, maxRange));
+        return fminf(range, floorMapRayCast(x, y, direction + halfBeam, maxRange));
+    }
+}
+
+void PoseEstimator::reset(float x0, float y0, float heading0, float var, float headingVar)
+{
+    x = x0;
+    y = y0;
+    heading = wrapAngle(heading0);
+    for (int i = 0; i < 3; i++)
+    {
+        for (int j = 0; j < 3; j++)
+        {
+            P[i][j] = 0;
+        }
+    }
+    P[0][0] = var;
+    P[1][1] = var;
+    P[2][2] = headingVar;
+}
+
+/**
+ * @brief move the estimate by the wheel motion since the last prediction
+ *
+ * @param driven signed distance along the heading in cm
+ * @param turned heading change in rad, positive is left
+ */
+void PoseEstimator::predict(float driven, float turned)
+{
+    float mid = heading + turned / 2;
+    float c = cosf(mid);
+    float s = sinf(mid);
+    x += driven * c;
+    y += driven * s;
+    heading = wrapAngle(heading + turned);
+
+    // P = F P F^T with F the jacobian of the motion to the state
+    float fx = -driven * s;
+    float fy = driven * c;
+    float p02 = P[0][2] + fx * P[2][2];
+    float p12 = P[1][2] + fy * P[2][2];
+    float p00 = P[0][0] + 2 * fx * P[0][2] + fx * fx * P[2][2];
+    float p01 = P[0][1] + fx * P[1][2] + fy * P[0][2] + fx * fy * P[2][2];
+    float p11 = P[1][1] + 2 * fy * P[1][2] + fy * fy * P[2][2];
+
+    // + G Q G^T with the noise of the driven distance and of the turn
+    float qd = POSE_DISTANCE_NOISE * fabsf(driven);
+    float qt = POSE_TURN_NOISE * fabsf(turned) + POSE_DRIFT_NOISE * fabsf(driven);
+    float gx = fx / 2;
+    float gy = fy / 2;
+    P[0][0] = p00 + c * c * qd + gx * gx * qt;
+    P[0][1] = P[1][0] = p01 + c * s * qd + gx * gy * qt;
+    P[1][1] = p11 + s * s * qd + gy * gy * qt;
+    P[0][2] = P[2][0] = p02 + gx * qt;
+    P[1][2] = P[2][1] = p12 + gy * qt;
+    P[2][2] += qt;
+}
+
+/**
+ * @brief fuse one scalar measurement, measurements outside of POSE_GATE are rejected
+ *
+ * @param innovation measured minus expected value
+ * @param H jacobian of the measurement to x, y and heading
+ * @param var variance of the measurement
+ * @return true if the measurement was fused
+ */
+bool PoseEstimator::update(float innovation, const float H[3], float var)
+{
+    float PH[3];
+    for (int i = 0; i < 3; i++)
+    {
+        PH[i] = P[i][0] * H[0] + P[i][1] * H[1] + P[i][2] * H[2];
+    }
+    float S = H[0] * PH[0] + H[1] * PH[1] + H[2] * PH[2] + var;
+    if (!(S > 0) || innovation * innovation > POSE_GATE * S)
+    {
+        return false;
+    }
+    x += PH[0] * innovation / S;
+    y += PH[1] * innovation / S;
+    heading = wrapAngle(heading + PH[2] * innovation / S);
+    // P = (I - K H) P with K = P H^T / S, stays symmetric
+    for (int i = 0; i < 3; i++)
+    {
+        for (int j = 0; j < 3; j++)
+        {
+            P[i][j] -= PH[i] * PH[j] / S;
+        }
+    }
+    return true;
+}
+
+/**
+ * @brief fuse a tag observation
+ *
+ * @param tagX position of the observed tag on the map in cm
+ * @param tagY
+ * @param range measured range in cm or 0 if the tag is too close to measure it
+ * @param bearing of the tag from the heading in rad, positive is left
+ * @return number of fused measurements
+ */
+int PoseEstimator::updateTag(float tagX, float tagY, float range, float bearing)
+{
+    int fused = 0;
+    float dx = tagX - x;
+    float dy = tagY - y;
+    float r2 = dx * dx + dy * dy;
+    if (r2 < 1)
+    {
+        return 0;
+    }
+    const float bearingH[3] = {dy / r2, -dx / r2, -1};
+    fused += update(wrapAngle(bearing - (atan2f(dy, dx) - heading)), bearingH, POSE_BEARING_VARIANCE);
+    if (range > 0)
+    {
+        // relinearize at the pose corrected by the bearing
+        dx = tagX - x;
+        dy = tagY - y;
+        float r = sqrtf(dx * dx + dy * dy);
+        const float rangeH[3] = {-dx / r, -dy / r, 0};
+        fused += update(range - r, rangeH, DOCK_TAG_VARIANCE * range * range);
+    }
+    return fused;
+}
+
+/**
+ * @brief fuse the range of an ultrasonic sensor to the mapped walls, the jacobian is taken
+ * numerically as the expected range comes from a ray cast. Obstacles that are not on the
+ * map give short ranges that the gate rejects
+ *
+ * @param sensorBearing direction of the sensor from the heading in rad
+ * @param measured in cm
+ * @param maxRange range the sensor reports without an echo
+ * @return true if the measurement was fused
+ */
+bool PoseEstimator::updateRange(float sensorBearing, float measured, float maxRange)
+{
+    if (measured >= maxRange)
+    {
+        return false;
+    }
+    const float dPos = 0.5;
+    const float dHeading = 0.005;
+    float direction = heading + sensorBearing;
+    float expected = expectedRange(x, y, direction, maxRange);
+    if (expected <= 0 || expected >= maxRange)
+    {
+        return false;
+    }
+    const float H[3] = {
+        (expectedRange(x + dPos, y, direction, maxRange) - expected) / dPos,
+        (expectedRange(x, y + dPos, direction, maxRange) - expected) / dPos,
+        (expectedRange(x, y, direction + dHeading, maxRange) - expected) / dHeading,
+    };
+    return update(measured - expected, H, POSE_US_VARIANCE);
+}
+
+#ifdef ARDUINO
+extern unsigned volatile detectTagCenter;
+extern double detectTagSize;
+extern volatile int detectTagId;
+extern volatile unsigned tagFrameCounter;
+extern double usDistances[NUM_SENSORS];
+extern unsigned long usTimestamps[NUM_SENSORS];
+
+namespace
+{
+    PoseEstimator estimator;
+    PoseEstimate published = {false};
+    portMUX_TYPE publishMux = portMUX_INITIALIZER_UNLOCKED;
+    // pose set by the control task, taken over by the estimator task in its next period
+    volatile bool resetPending = false;
+    float resetX, resetY, resetHeading;
+    portMUX_TYPE resetMux = portMUX_INITIALIZER_UNLOCKED;
+
+    const float sensorBearings[NUM_SENSORS] = US_SENSOR_BEARINGS;
+
+    void publish(uint32_t tagFixes, uint32_t rangeFixes, uint32_t rejected)
+    {
+        PoseEstimate e;
+        e.valid = true;
+        e.x = estimator.x;
+        e.y = estimator.y;
+        e.heading = estimator.heading;
+        e.covariance[0] = estimator.P[0][0];
+        e.covariance[1] = estimator.P[0][1];
+        e.covariance[2] = estimator.P[0][2];
+        e.covariance[3] = estimator.P[1][1];
+        e.covariance[4] = estimator.P[1][2];
+        e.covariance[5] = estimator.P[2][2];
+        e.timestamp = millis();
+        e.tagFixes = tagFixes;
+        e.rangeFixes = rangeFixes;
+        e.rejected = rejected;
+        portENTER_CRITICAL(&publishMux);
+        published = e;
+        portEXIT_CRITICAL(&publishMux);
+    }
+}
+
+/**
+ * @brief runs the pose estimator every POSE_PERIOD. The prediction uses the step counters of the
+ * stepper task, so it does not depend on the odometry pose that stepperSetPose overwrites
+ *
+ * @param argument
+ */
+void poseEstimatorTask(void *argument)
+{
+    Serial.print("poseEstimatorTask is running on: ");
+    Serial.println(xPortGetCoreID());
+    unsigned profilerSlot = profilerRegister();
+    float x, y, heading;
+    floorMapStartPose(x, y, heading);
+    estimator.reset(x, y, heading, POSE_START_VARIANCE, POSE_START_HEADING_VARIANCE);
+    float lastDistance = stepperDistance();
+    long lastHeadingSteps = stepperHeadingSteps();
+    unsigned lastFrame = tagFrameCounter;
+    unsigned long lastUs[NUM_SENSORS];
+    for (int i = 0; i < NUM_SENSORS; i++)
+    {
+        lastUs[i] = usTimestamps[i];
+    }
+    uint32_t tagFixes = 0;
+    uint32_t rangeFixes = 0;
+    uint32_t rejected = 0;
+    TickType_t lastWake = xTaskGetTickCount();
+
+    for (;;)
+    {
+        profilerLoop(profilerSlot);
+        vTaskDelayUntil(&lastWake, pdMS_TO_TICKS(POSE_PERIOD));
+
+        float distance = stepperDistance();
+        long headingSteps = stepperHeadingSteps();
+        if (resetPending)
+        {
+            portENTER_CRITICAL(&resetMux);
+            estimator.reset(resetX, resetY, resetHeading, POSE_START_VARIANCE, POSE_START_HEADING_VARIANCE);
+            resetPending = false;
+            portEXIT_CRITICAL(&resetMux);
+        }
+        else
+        {
+            estimator.predict(distance - lastDistance, (headingSteps - lastHeadingSteps) * 2 * PI / STEPS_360);
+        }
+        lastDistance = distance;
+        lastHeadingSteps = headingSteps;
+
+        // the camera frame is a few ms old, small against the motion in one period at the tag speeds
+        unsigned frame = tagFrameCounter;
+        if (frame != lastFrame && detectTagCenter != 0)
+        {
+            const StationPose *station = floorMapStation(detectTagId);
+            if (station != NULL)
+            {
+                float range = dockTagRange(detectTagSize);
+                float bearing = tagCenterBearing(detectTagCenter);
+                int fused = estimator.updateTag(station->tagX, station->tagY, range > DOCK_TAG_MIN_RANGE ? range : 0,
+                                                bearing);
+                tagFixes += fused;
+                rejected += (range > DOCK_TAG_MIN_RANGE ? 2 : 1) - fused;
+            }
+        }
+        lastFrame = frame;
+
+        for (int i = 0; i < NUM_SENSORS; i++)
+        {
+            unsigned long t = usTimestamps[i];
+            if (t == lastUs[i])
+            {
+                continue;
+            }
+            lastUs[i] = t;
+            float measured = usDistances[i];
+            if (measured >= US_MAX_DIST)
+            {
+                continue;
+            }
+            if (estimator.updateRange(sensorBearings[i] * PI / 180, measured, US_MAX_DIST))
+            {
+                rangeFixes++;
+            }
+            else
+            {
+                rejected++;
+            }
+        }
+        publish(tagFixes, rangeFixes, rejected);
+    }
+}
+
+/**
+ * @brief returns the latest published estimate without blocking
+ *
+ */
+PoseEstimate poseEstimate()
+{
+    portENTER_CRITICAL(&publishMux);
+    PoseEstimate e = published;
+    portEXIT_CRITICAL(&publishMux);
+    return e;
+}
+
+/**
+ * @brief the estimated pose, the odometry pose until the estimator published its first estimate
+ *
+ * @return true if the pose is the estimate
+ */
+bool poseEstimatePose(float &x, float &y, float &heading)
+{
+    PoseEstimate e = poseEstimate();
+    if (!e.valid)
+    {
+        stepperPose(x, y, heading);
+        return false;
+    }
+    x = e.x;
+    y = e.y;
+    heading = e.heading;
+    return true;
+}
+
+/**
+ * @brief set the estimate to a known pose, e.g. when the robot reached a station
+ *
+ */
+void poseEstimatorSet(float x, float y, float heading)
+{
+    portENTER_CRITICAL(&resetMux);
+    resetX = x;
+    resetY = y;
+    resetHeading = heading;
+    resetPending = true;
+    portEXIT_CRITICAL(&resetMux);
+}
+
+/**
+ * @brief print the estimate with its standard deviations to telnet
+ *
+ */
+void poseEstimatorPrint()
+{
+    PoseEstimate e = poseEstimate();
+    if (!e.valid)
+    {
+        telnet.println("estimate: not running");
+        return;
+    }
+    telnet.printf("estimate: x=%.1fcm y=%.1fcm heading=%.1fdeg age=%ums\n", e.x, e.y, e.heading * 180 / PI,
+                  (unsigned)(millis() - e.timestamp));
+    telnet.printf("sigma: x=%.1fcm y=%.1fcm heading=%.1fdeg\n", sqrtf(e.covariance[0]), sqrtf(e.covariance[3]),
+                  sqrtf(e.covariance[5]) * 180 / PI);
+    telnet.printf("fixes: tag=%u range=%u rejected=%u\n", e.tagFixes, e.rangeFixes, e.rejected);
+}
+#endif
\ No newline at end of file
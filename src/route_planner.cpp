@@ -0,0 +1,238 @@
+#include <math.h>
+#include <stdint.h>
+#include "defines.hpp"
+#include "floor_map.hpp"
+#include "route_planner.hpp"
+
+/**
+ * @brief A* search on the floor map grid, 8-connected,
+ * all buffers are static so planning never allocates
+ */
+namespace
+{
+    const int MAX_CELLS = FLOOR_MAP_WIDTH * FLOOR_MAP_HEIGHT;
+    static_assert(MAX_CELLS <= INT16_MAX, "cells are indexed with int16_t");
+    const uint16_t COST_STRAIGHT = 10;
+    const uint16_t COST_DIAGONAL = 14;
+    const int16_t NO_PARENT = -1;
+
+    uint16_t gCost[MAX_CELLS];
+    int16_t parent[MAX_CELLS];
+    bool closed[MAX_CELLS];
+    int16_t openHeap[MAX_CELLS];
+    uint16_t openCost[MAX_CELLS];
+    int openSize = 0;
+
+    int cellOf(float cm)
+    {
+        return (int)floorf(cm / FLOOR_MAP_CELL_SIZE);
+    }
+
+    float cellCenter(int c)
+    {
+        return (c + 0.5f) * FLOOR_MAP_CELL_SIZE;
+    }
+
+    uint16_t heuristic(int cx, int cy, int tx, int ty)
+    {
+        int dx = abs(cx - tx);
+        int dy = abs(cy - ty);
+        int diag = dx < dy ? dx : dy;
+        return COST_DIAGONAL * diag + COST_STRAIGHT * (dx + dy - 2 * diag);
+    }
+
+    /**
+     * @brief a cell can be pushed again for every cheaper way found to it (up to 8 times),
+     * the heap is sized for every cell once
+     *
+     * @return false if the heap is full
+     */
+    bool heapPush(int16_t cell, uint16_t cost)
+    {
+        if (openSize >= MAX_CELLS)
+            return false;
+        int i = openSize++;
+        while (i > 0)
+        {
+            int p = (i - 1) / 2;
+            if (openCost[p] <= cost)
+                break;
+            openHeap[i] = openHeap[p];
+            openCost[i] = openCost[p];
+            i = p;
+        }
+        openHeap[i] = cell;
+        openCost[i] = cost;
+        return true;
+    }
+
+    int16_t heapPop()
+    {
+        int16_t top = openHeap[0];
+        int16_t cell = openHeap[--openSize];
+        uint16_t cost = openCost[openSize];
+        int i = 0;
+        for (;;)
+        {
+            int c = 2 * i + 1;
+            if (c >= openSize)
+                break;
+            if (c + 1 < openSize && openCost[c + 1] < openCost[c])
+                c++;
+            if (cost <= openCost[c])
+                break;
+            openHeap[i] = openHeap[c];
+            openCost[i] = openCost[c];
+            i = c;
+        }
+        openHeap[i] = cell;
+        openCost[i] = cost;
+        return top;
+    }
+
+    /**
+     * @brief checks that a diagonal move does not cut an occupied corner
+     *
+     */
+    bool canMove(int x, int y, int dx, int dy)
+    {
+        if (floorMapOccupied(x + dx, y + dy))
+            return false;
+        if (dx != 0 && dy != 0)
+            return !floorMapOccupied(x + dx, y) && !floorMapOccupied(x, y + dy);
+        return true;
+    }
+
+    /**
+     * @brief checks that the straight line between two cell centers only crosses free cells
+     *
+     */
+    bool lineOfSight(int from, int to, int width)
+    {
+        float x0 = from % width + 0.5f, y0 = from / width + 0.5f;
+        float x1 = to % width + 0.5f, y1 = to / width + 0.5f;
+        int samples = (int)(4 * (fabsf(x1 - x0) + fabsf(y1 - y0))) + 1;
+        for (int i = 0; i <= samples; i++)
+        {
+            float t = (float)i / samples;
+            if (floorMapOccupied((int)(x0 + t * (x1 - x0)), (int)(y0 + t * (y1 - y0))))
+                return false;
+        }
+        return true;
+    }
+}
+
+/**
+ * @brief plan a collision free route on the floor map
+ *
+ * @param fromX start position in cm
+ * @param fromY start position in cm
+ * @param toX goal position in cm
+ * @param toY goal position in cm
+ * @param waypoints receives the corner points of the route, the last one is the goal
+ * @param maxWaypoints size of waypoints
+ * @return number of waypoints, 0 if there is no route, it has too many corners or the search ran out of heap
+ */
+int planRoute(float fromX, float fromY, float toX, float toY, Waypoint *waypoints, int maxWaypoints)
+{
+    const int width = floorMapWidth();
+    const int height = floorMapHeight();
+
+    int sx = cellOf(fromX), sy = cellOf(fromY);
+    int tx = cellOf(toX), ty = cellOf(toY);
+    if (floorMapOccupied(tx, ty))
+        return 0;
+    // the robot may have drifted into an inflated cell, start planning anyway
+    if (sx < 0 || sy < 0 || sx >= width || sy >= height)
+        return 0;
+
+    for (int i = 0; i < width * height; i++)
+    {
+        gCost[i] = UINT16_MAX;
+        parent[i] = NO_PARENT;
+        closed[i] = false;
+    }
+    openSize = 0;
+    int start = sy * width + sx;
+    int goal = ty * width + tx;
+    gCost[start] = 0;
+    heapPush(start, heuristic(sx, sy, tx, ty));
+
+    bool found = false;
+    while (openSize > 0)
+    {
+        int cell = heapPop();
+        if (closed[cell])
+            continue;
+        if (cell == goal)
+        {
+            found = true;
+            break;
+        }
+        closed[cell] = true;
+        int cx = cell % width;
+        int cy = cell / width;
+        for (int dy = -1; dy <= 1; dy++)
+        {
+            for (int dx = -1; dx <= 1; dx++)
+            {
+                if ((dx == 0 && dy == 0) || !canMove(cx, cy, dx, dy))
+                    continue;
+                int next = (cy + dy) * width + cx + dx;
+                if (closed[next])
+                    continue;
+                uint16_t g = gCost[cell] + ((dx != 0 && dy != 0) ? COST_DIAGONAL : COST_STRAIGHT);
+                if (g < gCost[next])
+                {
+                    gCost[next] = g;
+                    parent[next] = cell;
+                    if (!heapPush(next, g + heuristic(cx + dx, cy + dy, tx, ty)))
+                        return 0;
+                }
+            }
+        }
+    }
+    if (!found)
+        return 0;
+
+    // walk back from the goal to get the cell path in driving order
+    int pathLength = 0;
+    for (int cell = goal; cell != NO_PARENT; cell = parent[cell])
+    {
+        openHeap[pathLength++] = cell;
+    }
+    for (int i = 0; i < pathLength / 2; i++)
+    {
+        int16_t tmp = openHeap[i];
+        openHeap[i] = openHeap[pathLength - 1 - i];
+        openHeap[pathLength - 1 - i] = tmp;
+    }
+
+    // keep only the cells that can not be skipped in a straight line
+    int numWaypoints = 0;
+    int anchor = 0;
+    while (anchor < pathLength - 1)
+    {
+        int next = anchor + 1;
+        while (next + 1 < pathLength && lineOfSight(openHeap[anchor], openHeap[next + 1], width))
+        {
+            next++;
+        }
+        if (numWaypoints >= maxWaypoints)
+            return 0;
+        waypoints[numWaypoints].x = cellCenter(openHeap[next] % width);
+        waypoints[numWaypoints].y = cellCenter(openHeap[next] / width);
+        numWaypoints++;
+        anchor = next;
+    }
+    if (numWaypoints == 0)
+    {
+        waypoints[numWaypoints++] = {toX, toY};
+        return numWaypoints;
+    }
+
+    // end exactly on the requested goal instead of the cell center
+    waypoints[numWaypoints - 1].x = toX;
+    waypoints[numWaypoints - 1].y = toY;
+    return numWaypoints;
+}
@@ -0,0 +1,271 @@
+#include <string.h>
+#include "station_protocol.hpp"
+
+/**
+ * @brief CRC-16/CCITT-FALSE
+ *
+ */
+uint16_t commCrc(const uint8_t *data, size_t length)
+{
+    uint16_t crc = 0xFFFF;
+    for (size_t i = 0; i < length; i++)
+    {
+        crc ^= data[i] << 8;
+        for (int bit = 0; bit < 8; bit++)
+        {
+            crc = (crc & 0x8000) ? (crc << 1) ^ 0x1021 : crc << 1;
+        }
+    }
+    return crc;
+}
+
+/**
+ * @brief fill in the header and the trailing crc of a message
+ *
+ * @param msg the message, the payload has to be set already
+ * @param length of the message including the crc
+ */
+void commSeal(uint8_t *msg, size_t length, uint8_t type, uint8_t robot, uint8_t session, uint16_t sequence)
+{
+    commHeader header;
+    memcpy(header.preamble, PREAMBLE, sizeof(PREAMBLE));
+    header.version = COMM_PROTOCOL_VERSION;
+    header.type = type;
+    header.robot = robot;
+    header.session = session;
+    header.sequence = sequence;
+    memcpy(msg, &header, sizeof(header));
+    uint16_t crc = commCrc(msg, length - sizeof(crc));
+    memcpy(msg + length - sizeof(crc), &crc, sizeof(crc));
+}
+
+/**
+ * @brief size of a message type
+ *
+ * @return the size or 0 for unknown types
+ */
+size_t commMessageSize(uint8_t type)
+{
+    switch (type)
+    {
+    case COMM_AGV_STATUS:
+        return sizeof(agvMsg);
+    case COMM_STATION_STATUS:
+        return sizeof(stationMsg);
+    case COMM_MISSION:
+        return sizeof(missionMsg);
+    case COMM_ACK:
+        return sizeof(commAck);
+    case COMM_SLOT_REQUEST:
+    case COMM_SLOT_RELEASE:
+    case COMM_SLOT_STATE:
+        return sizeof(slotMsg);
+    case COMM_PARAM_SET:
+        return sizeof(paramMsg);
+    default:
+        return 0;
+    }
+}
+
+/**
+ * @brief validate preamble, version, length and crc of a received message,
+ * trailing bytes after the message are ignored
+ *
+ * @param type receives the message type
+ * @return true if the message is valid
+ */
+bool commCheck(const uint8_t *data, size_t length, uint8_t &type)
+{
+    if (length < sizeof(commHeader))
+        return false;
+    commHeader header;
+    memcpy(&header, data, sizeof(header));
+    if (memcmp(header.preamble, PREAMBLE, sizeof(PREAMBLE)) != 0 || header.version != COMM_PROTOCOL_VERSION)
+        return false;
+    size_t size = commMessageSize(header.type);
+    if (size == 0 || length < size)
+        return false;
+    uint16_t crc;
+    memcpy(&crc, data + size - sizeof(crc), sizeof(crc));
+    if (crc != commCrc(data, size - sizeof(crc)))
+        return false;
+    type = header.type;
+    return true;
+}
+
+/**
+ * @brief build the acknowledgement of a received message, it carries the id of the acknowledging
+ * robot, also for messages to COMM_ALL_ROBOTS
+ *
+ * @param robot id of the acknowledging robot
+ */
+void commAckFor(const commHeader &header, uint8_t robot, commAck &ack)
+{
+    ack.ackedType = header.type;
+    commSeal((uint8_t *)&ack, sizeof(ack), COMM_ACK, robot, header.session, header.sequence);
+}
+
+void commSenderInit(CommSender &sender, uint8_t robot, uint8_t session)
+{
+    memset(&sender, 0, sizeof(sender));
+    sender.robot = robot;
+    sender.session = session;
+}
+
+/**
+ * @brief number and seal a message and send it with the next poll,
+ * an unacknowledged older message is dropped
+ *
+ * @param msg the message with the payload set, it is copied
+ * @param length of the message including the crc
+ */
+void commSenderQueue(CommSender &sender, uint8_t *msg, size_t length, uint8_t type, uint32_t now)
+{
+    if (length > COMM_MAX_MSG)
+        return;
+    if (sender.pending)
+        sender.dropped++;
+    commSeal(msg, length, type, sender.robot, sender.session, sender.nextSequence++);
+    memcpy(sender.buffer, msg, length);
+    sender.length = length;
+    sender.pending = true;
+    sender.nextSend = now;
+    sender.backoff = COMM_RETRY_MIN;
+    sender.retries = 0;
+}
+
+/**
+ * @brief check if the pending message is due for (re)transmission,
+ * the message is sent from sender.buffer by the caller
+ *
+ * @return true if sender.buffer has to be sent now
+ */
+bool commSenderPoll(CommSender &sender, uint32_t now)
+{
+    if (!sender.pending || (int32_t)(now - sender.nextSend) < 0)
+        return false;
+    if (sender.retries > COMM_MAX_RETRIES)
+    {
+        sender.pending = false;
+        sender.dropped++;
+        return false;
+    }
+    if (sender.retries == 0)
+        sender.sent++;
+    else
+        sender.retransmits++;
+    sender.retries++;
+    sender.nextSend = now + sender.backoff;
+    sender.backoff = sender.backoff * 2 > COMM_RETRY_MAX ? COMM_RETRY_MAX : sender.backoff * 2;
+    return true;
+}
+
+/**
+ * @brief handle a received ack
+ *
+ * @return true if it acknowledged the pending message
+ */
+bool commSenderAck(CommSender &sender, const commAck &ack)
+{
+    commHeader pending;
+    memcpy(&pending, sender.buffer, sizeof(pending));
+    if (!sender.pending || ack.header.robot != sender.robot || ack.header.session != sender.session ||
+        ack.header.sequence != pending.sequence || ack.ackedType != pending.type)
+        return false;
+    sender.pending = false;
+    sender.acked++;
+    return true;
+}
+
+void commOutboxInit(CommOutbox &outbox, uint8_t robot, uint8_t session)
+{
+    memset(&outbox, 0, sizeof(outbox));
+    commSenderInit(outbox.sender, robot, session);
+}
+
+/**
+ * @brief append a message, it is sent after all messages queued before it
+ *
+ * @param msg the message with the payload set, it is copied
+ * @param length of the message including the crc
+ * @return false if the outbox is full, the message is dropped
+ */
+bool commOutboxQueue(CommOutbox &outbox, const uint8_t *msg, size_t length, uint8_t type)
+{
+    if (length > COMM_MAX_MSG || outbox.count >= COMM_OUTBOX_LENGTH)
+    {
+        outbox.sender.dropped++;
+        return false;
+    }
+    unsigned i = (outbox.head + outbox.count++) % COMM_OUTBOX_LENGTH;
+    memcpy(outbox.messages[i], msg, length);
+    outbox.lengths[i] = length;
+    outbox.types[i] = type;
+    return true;
+}
+
+/**
+ * @brief like commSenderPoll, moves on to the next queued message when the sender is idle
+ *
+ * @return true if outbox.sender.buffer has to be sent now
+ */
+bool commOutboxPoll(CommOutbox &outbox, uint32_t now)
+{
+    for (;;)
+    {
+        if (!outbox.sender.pending && outbox.count > 0)
+        {
+            unsigned i = outbox.head;
+            outbox.head = (outbox.head + 1) % COMM_OUTBOX_LENGTH;
+            outbox.count--;
+            commSenderQueue(outbox.sender, outbox.messages[i], outbox.lengths[i], outbox.types[i], now);
+        }
+        if (commSenderPoll(outbox.sender, now))
+        {
+            return true;
+        }
+        // the retries of the last message ran out, try the next one right away
+        if (outbox.sender.pending || outbox.count == 0)
+        {
+            return false;
+        }
+    }
+}
+
+/**
+ * @brief check if a message was not seen yet, a message that was overtaken by a newer one is
+ * still processed. Duplicates and messages older than COMM_REPLAY_WINDOW are rejected
+ * but have to be acknowledged anyway
+ *
+ * @return true if the message has to be processed
+ */
+bool commReceiverAccept(CommReceiver &receiver, const commHeader &header)
+{
+    if (!receiver.synced || header.session != receiver.session)
+    {
+        receiver.synced = true;
+        receiver.session = header.session;
+        receiver.lastSequence = header.sequence;
+        receiver.window = 1;
+        receiver.accepted++;
+        return true;
+    }
+    int16_t ahead = header.sequence - receiver.lastSequence;
+    if (ahead > 0)
+    {
+        receiver.window = ahead < COMM_REPLAY_WINDOW ? (receiver.window << ahead) | 1 : 1;
+        receiver.lastSequence = header.sequence;
+        receiver.accepted++;
+        return true;
+    }
+    unsigned age = -ahead;
+    if (age >= COMM_REPLAY_WINDOW || (receiver.window & (1u << age)))
+    {
+        receiver.duplicates++;
+        return false;
+    }
+    receiver.window |= 1u << age;
+    receiver.accepted++;
+    receiver.late++;
+    return true;
+}
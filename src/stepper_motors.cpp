@@ -1,9 +1,16 @@
 #include <Arduino.h>
+#include "esp_timer.h"
 #include "defines.hpp"
+#include "tasks.hpp"
+#include "loop_timing.hpp"
+#include "log.hpp"
+#include "black_box.hpp"
+#include "trace.hpp"
 #include "stepper_motor.hpp"
 #include "BasicStepperDriver.h"
 #include "SyncDriver.h"
 #include "telnet_debug.hpp"
+#include "task_profiler.hpp"
 
 namespace
 {
@@ -17,24 +24,152 @@ namespace
         RIGHT,
         LEFT,
         STRAIGHT,
-        BACKWARDS
+        BACKWARDS,
+        CURVE
     };
     unsigned state;
+    // accumulated heading of all finished moves, left turns are positive
+    long headingSteps = 0;
+    // odometry position in cm of all finished moves and the heading offset of the map frame
+    float poseX = 0;
+    float poseY = 0;
+    float poseHeadingOffset = 0;
+    // signed distance driven since startup in cm
+    float distanceTotal = 0;
+    // STEPS_360 the heading offset belongs to
+    float headingSteps360 = 0;
+    // wheel speed difference of the current curve, see stepperStartCurve
+    float curveRatio = 0;
+    unsigned curveRpm = 0;
+    // trace correlation of the last motor command until its first step, -1 if none is pending
+    volatile int32_t firstStepPending = -1;
+    // wakes steppersControlTask before the next step
+    esp_timer_handle_t wakeTimer;
+    // how late the steps are compared to the step rate
+    LoopTiming stepTiming = {"step lateness", STEP_LATENESS_BUDGET_US};
+
+    /**
+     * @brief signed heading change of the current move in steps
+     *
+     */
+    long moveHeadingSteps()
+    {
+        if (state == LEFT)
+            return returnSteps();
+        if (state == RIGHT)
+            return -(long)returnSteps();
+        // stepper is the outer wheel of a left curve, half the difference turns like a turn on the spot
+        if (state == CURVE)
+            return ((long)stepper.getStepsCompleted() - (long)stepper2.getStepsCompleted()) / 2;
+        return 0;
+    }
+
+    /**
+     * @brief signed distance of the current move in cm
+     *
+     */
+    float moveDistance()
+    {
+        if (state == STRAIGHT)
+            return returnSteps() / STEPS_PER_CM;
+        if (state == BACKWARDS)
+            return -(returnSteps() / STEPS_PER_CM);
+        if (state == CURVE)
+            return (stepper.getStepsCompleted() + stepper2.getStepsCompleted()) / 2.0f / STEPS_PER_CM;
+        return 0;
+    }
+
+    float headingToRad(float steps)
+    {
+        return poseHeadingOffset + steps * 2 * PI / STEPS_360;
+    }
+
+    /**
+     * @brief keep the heading continuous when the turn calibration is changed at runtime
+     *
+     */
+    void onParamChanged(unsigned index)
+    {
+        if (index != (unsigned)paramFind("WHEEL_ROTS_360"))
+        {
+            return;
+        }
+        long steps = stepperHeadingSteps();
+        poseHeadingOffset += steps * 2 * PI / headingSteps360 - steps * 2 * PI / STEPS_360;
+        headingSteps360 = STEPS_360;
+    }
+
+    void wakeStepperTask(void *argument)
+    {
+        xTaskNotifyGive(taskHandle(TASK_STEPPERS_CONTROL));
+    }
+
+    /**
+     * @brief add the current move to the odometry before it is stopped or restarted
+     *
+     */
+    void accumulateMove()
+    {
+        long turn = moveHeadingSteps();
+        float d = moveDistance();
+        // a curve is driven along the heading in the middle of the move
+        float heading = headingToRad(headingSteps + turn / 2.0f);
+        poseX += d * cos(heading);
+        poseY += d * sin(heading);
+        headingSteps += turn;
+        distanceTotal += d;
+    }
 }
 
+/**
+ * @brief drives the steps of the current move, the task runs at the highest priority of its core
+ * so it sleeps between the steps and lets nextAction wait only the last STEPPER_WAKE_EARLY_US
+ *
+ */
 void steppersControlTask(void *argument)
 {
     Serial.print("steppersControlTask is running on: ");
     Serial.println(xPortGetCoreID());
+    unsigned profilerSlot = profilerRegister();
+    bool stepping = false;
+    uint32_t due = 0;
 
     for (;;)
     {
+        profilerLoop(profilerSlot);
         if (stepperIsRunning() == false)
         {
             controller.disable();
         }
-        controller.nextAction();
-        vTaskDelay(0);
+        // steps when one is due and returns the time to the next one
+        long wait = controller.nextAction();
+        uint32_t now = micros();
+        if (stepping)
+        {
+            int32_t late = now - due;
+            loopTimingRecord(stepTiming, late > 0 ? late : 0);
+        }
+        int32_t correlation = firstStepPending;
+        if (correlation >= 0 && returnSteps() > 0)
+        {
+            firstStepPending = -1;
+            trace(TRACE_FIRST_STEP, correlation);
+        }
+        if (wait <= 0)
+        {
+            // no move, poll for the next one
+            stepping = false;
+            vTaskDelay(TASK_POLL_TICKS);
+            continue;
+        }
+        stepping = true;
+        due = now + wait;
+        int32_t remaining;
+        while ((remaining = due - micros()) > STEPPER_WAKE_EARLY_US)
+        {
+            esp_timer_start_once(wakeTimer, remaining - STEPPER_WAKE_EARLY_US);
+            ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+        }
     }
     Serial.println("steppersControlTask closed");
     vTaskDelete(NULL);
@@ -48,6 +183,10 @@ void stepperUpdate()
 void stepperMotorsInit()
 {
     Serial.println("initialize Stepper Motors");
+    headingSteps360 = STEPS_360;
+    paramOnChange(onParamChanged);
+    const esp_timer_create_args_t wakeTimerArgs = {wakeStepperTask, NULL, ESP_TIMER_TASK, "stepperWake", false};
+    esp_timer_create(&wakeTimerArgs, &wakeTimer);
     stepper.begin(STEPPER_MAX_RPM, 1);
     stepper2.begin(STEPPER_MAX_RPM, 1);
     stepper.setSpeedProfile(stepper.CONSTANT_SPEED, 5000, 5000);
@@ -62,11 +201,12 @@ void stepperStartTurnLeft(unsigned int rpm)
     {
         stepperStop();
         delay(100);
-        DEBUG_MSG("motors: go left");
+        LOG_DEBUG("motors: go left");
         state = LEFT;
         controller.enable();
         controller.setRPM(rpm == 0 ? STEPPER_MAX_RPM : rpm);
         controller.startMove(STEPER_STEPS_PER_ROT * WHEEL_ROTS_360, STEPER_STEPS_PER_ROT * WHEEL_ROTS_360);
+        firstStepPending = traceMotorCommand();
     }
 }
 
@@ -76,26 +216,98 @@ void stepperStartTurnRight(unsigned int rpm)
     {
         stepperStop();
         delay(100);
-        DEBUG_MSG("motors: go right");
+        LOG_DEBUG("motors: go right");
         state = RIGHT;
         controller.enable();
         controller.setRPM(rpm == 0 ? STEPPER_MAX_RPM : rpm);
         controller.startMove(-STEPER_STEPS_PER_ROT * WHEEL_ROTS_360, -STEPER_STEPS_PER_ROT * WHEEL_ROTS_360);
+        firstStepPending = traceMotorCommand();
     }
 }
 
 void stepperStartStraight(unsigned int rpm)
 {
-    if (state != STRAIGHT || !controller.isRunning())
-    {   
+    if (state == CURVE && controller.isRunning())
+    {
+        // both wheels already turn forward, change the speeds without stopping
+        accumulateMove();
+        state = STRAIGHT;
+        controller.setRPM(rpm == 0 ? STEPPER_MAX_RPM : rpm);
+        controller.startMove(STEPER_STEPS_PER_ROT * 100, -STEPER_STEPS_PER_ROT * 100);
+        firstStepPending = traceMotorCommand();
+    }
+    else if (state != STRAIGHT || !controller.isRunning())
+    {
         stepperStop();
         delay(100);
-        DEBUG_MSG("motors: go straight");
+        LOG_DEBUG("motors: go straight");
         state = STRAIGHT;
         controller.enable();
         controller.setRPM(rpm == 0 ? STEPPER_MAX_RPM : rpm);
         controller.startMove(STEPER_STEPS_PER_ROT * 100, -STEPER_STEPS_PER_ROT * 100);
+        firstStepPending = traceMotorCommand();
+    }
+}
+
+/**
+ * @brief change the speed of a straight move without stopping,
+ * starts a straight move if the robot is not driving straight yet
+ *
+ * @param rpm
+ */
+void stepperSetStraightRpm(unsigned int rpm)
+{
+    if (state != STRAIGHT || !controller.isRunning())
+    {
+        stepperStartStraight(rpm);
+        return;
+    }
+    accumulateMove();
+    controller.setRPM(rpm);
+    controller.startMove(STEPER_STEPS_PER_ROT * 100, -STEPER_STEPS_PER_ROT * 100);
+    firstStepPending = traceMotorCommand();
+}
+
+/**
+ * @brief drive forward on an arc, the outer wheel turns faster by the curvature times half the track.
+ * A straight move or a curve turns into the new curve without stopping
+ *
+ * @param curvature 1/cm, positive is left, limited by STEPPER_CURVE_LIMIT
+ * @param rpm speed of the robot center, the outer wheel is limited to STEPPER_MAX_RPM
+ */
+void stepperStartCurve(float curvature, unsigned int rpm)
+{
+    float track = WHEEL_ROTS_360 * WHEEL_DIAMETER;
+    float ratio = constrain(curvature * track / 2, -STEPPER_CURVE_LIMIT, STEPPER_CURVE_LIMIT);
+    unsigned maxRpm = STEPPER_MAX_RPM / (1 + fabsf(ratio));
+    if (rpm == 0 || rpm > maxRpm)
+    {
+        rpm = max(maxRpm, 1u);
+    }
+    bool running = controller.isRunning();
+    if (state == CURVE && running && fabsf(ratio - curveRatio) < STEPPER_CURVE_RESOLUTION && rpm == curveRpm)
+    {
+        return;
+    }
+    if (running && (state == CURVE || state == STRAIGHT))
+    {
+        accumulateMove();
+    }
+    else
+    {
+        stepperStop();
+        delay(100);
+        LOG_DEBUG("motors: go curve");
+        controller.enable();
     }
+    state = CURVE;
+    curveRatio = ratio;
+    curveRpm = rpm;
+    // stepper turns forward with positive steps and is the outer wheel of a left curve, like in stepperStartTurnLeft
+    stepper.setRPM(rpm * (1 + ratio));
+    stepper2.setRPM(rpm * (1 - ratio));
+    controller.startMove(STEPER_STEPS_PER_ROT * 100 * (1 + ratio), -STEPER_STEPS_PER_ROT * 100 * (1 - ratio));
+    firstStepPending = traceMotorCommand();
 }
 
 void stepperStartBackwards(unsigned int rpm)
@@ -104,18 +316,25 @@ void stepperStartBackwards(unsigned int rpm)
     {
         stepperStop();
         delay(100);
-        DEBUG_MSG("motors: go back");
+        LOG_DEBUG("motors: go back");
         state = BACKWARDS;
         controller.enable();
         controller.setRPM(rpm == 0 ? STEPPER_MAX_RPM : rpm);
         controller.startMove(-STEPER_STEPS_PER_ROT * 100, STEPER_STEPS_PER_ROT * 100);
+        firstStepPending = traceMotorCommand();
     }
 }
 
 void stepperStop()
 {
-    DEBUG_MSG("motors: stop called");
+    LOG_DEBUG("motors: stop called");
+    if (state != STOPPED)
+    {
+        blackBoxStepper(state, returnSteps());
+    }
+    accumulateMove();
     state = STOPPED;
+    firstStepPending = -1;
     controller.stop();
     controller.disable();
 }
@@ -135,7 +354,81 @@ void setRpmStepperR(int rpm)
     stepper2.setRPM(rpm);
 }
 
+/**
+ * @brief print how late the steps were to telnet
+ *
+ * @param reset clear the statistics after printing
+ */
+void printStepTiming(bool reset)
+{
+    loopTimingPrint(stepTiming);
+    if (reset)
+    {
+        loopTimingReset(stepTiming);
+    }
+}
+
+/**
+ * @brief returns the current movement, STOPPED, RIGHT, LEFT, STRAIGHT, BACKWARDS or CURVE
+ *
+ */
+unsigned stepperState()
+{
+    return state;
+}
+
 unsigned long returnSteps()
 {
     return max(stepper.getStepsCompleted(), stepper2.getStepsCompleted());
-}
\ No newline at end of file
+}
+
+/**
+ * @brief returns the heading of the robot since startup in stepper steps,
+ * STEPS_360 equals a full turn and left turns are positive
+ *
+ * @return heading in steps
+ */
+long stepperHeadingSteps()
+{
+    return headingSteps + moveHeadingSteps();
+}
+
+/**
+ * @brief returns the odometry pose in map coordinates
+ *
+ * @param x in cm
+ * @param y in cm
+ * @param heading in rad, counterclockwise
+ */
+void stepperPose(float &x, float &y, float &heading)
+{
+    long turn = moveHeadingSteps();
+    float d = moveDistance();
+    float mid = headingToRad(headingSteps + turn / 2.0f);
+    heading = headingToRad(headingSteps + turn);
+    x = poseX + d * cos(mid);
+    y = poseY + d * sin(mid);
+}
+
+/**
+ * @brief overwrite the odometry pose, e.g. when the robot reached a known station
+ *
+ */
+void stepperSetPose(float x, float y, float heading)
+{
+    float mid = heading - moveHeadingSteps() * PI / STEPS_360;
+    poseX = x - moveDistance() * cos(mid);
+    poseY = y - moveDistance() * sin(mid);
+    poseHeadingOffset = heading - stepperHeadingSteps() * 2 * PI / STEPS_360;
+}
+
+/**
+ * @brief returns the signed distance driven straight since startup,
+ * backwards moves count negative, turns on the spot do not count
+ *
+ * @return distance in cm
+ */
+float stepperDistance()
+{
+    return distanceTotal + moveDistance();
+}
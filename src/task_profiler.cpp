@@ -0,0 +1,196 @@
+#include <Arduino.h>
+#include "defines.hpp"
+#include "wifi.hpp"
+#include "task_profiler.hpp"
+#include "telnet_debug.hpp"
+
+namespace
+{
+    /**
+     * @brief number of loop iterations per task, not a context switch count:
+     * an iteration may block several times or not at all
+     */
+    struct LoopCounter
+    {
+        TaskHandle_t task;
+        uint32_t loops;
+    };
+    LoopCounter loopCounters[TELEMETRY_MAX_TASKS];
+    // copy of loopCounters taken under the lock by profilerSample
+    LoopCounter sampledCounters[TELEMETRY_MAX_TASKS];
+    portMUX_TYPE loopCounterMux = portMUX_INITIALIZER_UNLOCKED;
+
+    TaskStatus_t taskStatus[TELEMETRY_MAX_TASKS];
+    // run time counters of the previous sample to calculate the cpu share
+    struct RunTime
+    {
+        TaskHandle_t task;
+        uint32_t counter;
+    };
+    RunTime lastRunTime[TELEMETRY_MAX_TASKS];
+    uint32_t lastTotalRunTime = 0;
+
+    // written by the sampling task, published for profilerPrint under snapshotMux
+    telemetryProfile snapshot;
+    telemetryProfile published;
+    telemetryProfile printed;
+    portMUX_TYPE snapshotMux = portMUX_INITIALIZER_UNLOCKED;
+
+    uint32_t loopsOf(TaskHandle_t task)
+    {
+        for (const LoopCounter &c : sampledCounters)
+        {
+            if (c.task == task)
+                return c.loops;
+        }
+        return 0;
+    }
+
+    uint32_t lastRunTimeOf(TaskHandle_t task)
+    {
+        for (const RunTime &r : lastRunTime)
+        {
+            if (r.task == task)
+                return r.counter;
+        }
+        return 0;
+    }
+}
+
+/**
+ * @brief reserve a loop counter for the calling task, call once before the task loop
+ *
+ * @return the slot to pass to profilerLoop
+ */
+unsigned profilerRegister()
+{
+    TaskHandle_t self = xTaskGetCurrentTaskHandle();
+    unsigned slot = TELEMETRY_MAX_TASKS;
+    portENTER_CRITICAL(&loopCounterMux);
+    for (unsigned i = 0; i < TELEMETRY_MAX_TASKS; i++)
+    {
+        if (loopCounters[i].task == self || loopCounters[i].task == NULL)
+        {
+            loopCounters[i].task = self;
+            slot = i;
+            break;
+        }
+    }
+    portEXIT_CRITICAL(&loopCounterMux);
+    return slot;
+}
+
+/**
+ * @brief count one loop iteration of the calling task
+ *
+ * @param slot returned by profilerRegister
+ */
+void profilerLoop(unsigned slot)
+{
+    if (slot < TELEMETRY_MAX_TASKS)
+    {
+        portENTER_CRITICAL(&loopCounterMux);
+        loopCounters[slot].loops++;
+        portEXIT_CRITICAL(&loopCounterMux);
+    }
+}
+
+/**
+ * @brief take a new snapshot of all tasks and the heap,
+ * the cpu share is calculated over the time since the previous sample. The prebuilt
+ * FreeRTOS of the arduino core has no run time stats, then the cpu share is 0xFFFF
+ *
+ */
+void profilerSample()
+{
+    uint32_t totalRunTime = 0;
+    unsigned n = 0;
+#if configUSE_TRACE_FACILITY
+    n = uxTaskGetSystemState(taskStatus, TELEMETRY_MAX_TASKS, &totalRunTime);
+#endif
+    portENTER_CRITICAL(&loopCounterMux);
+    memcpy(sampledCounters, loopCounters, sizeof(loopCounters));
+    portEXIT_CRITICAL(&loopCounterMux);
+    // the run time counts per core, so all tasks together use up to portNUM_PROCESSORS * 1000
+    uint32_t totalDelta = totalRunTime - lastTotalRunTime;
+    snapshot.header = {{PREAMBLE[0], PREAMBLE[1], PREAMBLE[2]}, TELEMETRY_PROFILE, (uint32_t)millis()};
+    snapshot.heapFree = ESP.getFreeHeap();
+    snapshot.heapMinFree = ESP.getMinFreeHeap();
+    snapshot.numTasks = n;
+    for (unsigned i = 0; i < n; i++)
+    {
+        const TaskStatus_t &status = taskStatus[i];
+        telemetryTask &task = snapshot.tasks[i];
+        strncpy(task.name, status.pcTaskName, TELEMETRY_TASK_NAME - 1);
+        task.name[TELEMETRY_TASK_NAME - 1] = '\0';
+#if configGENERATE_RUN_TIME_STATS
+        uint32_t delta = status.ulRunTimeCounter - lastRunTimeOf(status.xHandle);
+        task.cpuPermille = totalDelta ? (uint64_t)delta * 1000 / totalDelta : 0;
+#else
+        task.cpuPermille = 0xFFFF;
+#endif
+        task.stackFree = status.usStackHighWaterMark;
+        task.core = status.xCoreID > 1 ? 0xFF : status.xCoreID;
+        task.priority = status.uxCurrentPriority;
+        task.loops = loopsOf(status.xHandle);
+    }
+#if configGENERATE_RUN_TIME_STATS
+    for (unsigned i = 0; i < TELEMETRY_MAX_TASKS; i++)
+    {
+        lastRunTime[i] = {i < n ? taskStatus[i].xHandle : NULL, i < n ? taskStatus[i].ulRunTimeCounter : 0};
+    }
+    lastTotalRunTime = totalRunTime;
+#endif
+    portENTER_CRITICAL(&snapshotMux);
+    published = snapshot;
+    portEXIT_CRITICAL(&snapshotMux);
+}
+
+/**
+ * @brief the latest snapshot, only for the task that calls profilerSample
+ *
+ */
+const telemetryProfile &profilerSnapshot()
+{
+    return snapshot;
+}
+
+/**
+ * @brief size of the snapshot record, only the used task entries are sent
+ *
+ */
+unsigned profilerSnapshotSize()
+{
+    return sizeof(telemetryProfile) - (TELEMETRY_MAX_TASKS - snapshot.numTasks) * sizeof(telemetryTask);
+}
+
+/**
+ * @brief print the latest snapshot as a "top" like table to telnet
+ *
+ */
+void profilerPrint()
+{
+    portENTER_CRITICAL(&snapshotMux);
+    printed = published;
+    portEXIT_CRITICAL(&snapshotMux);
+    telnet.printf("heap free: %u min free: %u\n", printed.heapFree, printed.heapMinFree);
+    telnet.println("task             cpu%  stack free  core  prio  loops");
+    for (unsigned i = 0; i < printed.numTasks; i++)
+    {
+        const telemetryTask &task = printed.tasks[i];
+        if (task.cpuPermille == 0xFFFF)
+        {
+            telnet.printf("%-16s  n/a", task.name);
+        }
+        else
+        {
+            telnet.printf("%-16s %3u.%u", task.name, task.cpuPermille / 10, task.cpuPermille % 10);
+        }
+        telnet.printf("  %10u  %4d  %4u  %u\n", task.stackFree, task.core == 0xFF ? -1 : task.core,
+                      task.priority, task.loops);
+    }
+#if !configGENERATE_RUN_TIME_STATS
+    telnet.println("cpu% needs configGENERATE_RUN_TIME_STATS, which this FreeRTOS build does not set");
+#endif
+    telnet.println("loops counts loop iterations of the task, there is no context switch count");
+}
@@ -0,0 +1,116 @@
+#include <Arduino.h>
+#include "esp_heap_caps.h"
+#include "defines.hpp"
+#include "tasks.hpp"
+#include "log.hpp"
+#include "telnet_debug.hpp"
+
+namespace
+{
+    struct TaskConfig
+    {
+        const char *name;
+        uint32_t stackSize;
+        UBaseType_t priority;
+        BaseType_t core;
+    };
+
+#define TASK_CONFIG(id, name, stack, priority, core) {name, stack, priority, core},
+    const TaskConfig taskConfigs[TASK_COUNT] = {TASK_TABLE(TASK_CONFIG)};
+#undef TASK_CONFIG
+
+    // the esp32 port counts the stack depth in bytes, StackType_t is a byte there
+#define TASK_STACK(id, name, stack, priority, core) alignas(16) StackType_t id##Stack[(stack) / sizeof(StackType_t)];
+    TASK_TABLE(TASK_STACK)
+#undef TASK_STACK
+
+#define TASK_STACK_POINTER(id, name, stack, priority, core) id##Stack,
+    StackType_t *const stacks[TASK_COUNT] = {TASK_TABLE(TASK_STACK_POINTER)};
+#undef TASK_STACK_POINTER
+
+    StaticTask_t taskBuffers[TASK_COUNT];
+    TaskHandle_t handles[TASK_COUNT];
+    // warnings are logged once
+    bool stackWarned[TASK_COUNT];
+    bool heapWarned = false;
+}
+
+/**
+ * @brief create the task id of TASK_TABLE on its static stack, a second call returns the running task
+ *
+ */
+TaskHandle_t taskStart(taskId id, TaskFunction_t function)
+{
+    const TaskConfig &config = taskConfigs[id];
+    if (handles[id] == NULL)
+    {
+        handles[id] = xTaskCreateStaticPinnedToCore(function, config.name, config.stackSize, NULL, config.priority,
+                                                    stacks[id], &taskBuffers[id], config.core);
+    }
+    return handles[id];
+}
+
+TaskHandle_t taskHandle(taskId id)
+{
+    return handles[id];
+}
+
+const char *taskName(taskId id)
+{
+    return taskConfigs[id].name;
+}
+
+/**
+ * @brief warn about stacks with less than TASK_STACK_MARGIN left and a heap below HEAP_MIN_FREE
+ *
+ */
+void memoryCheck()
+{
+    for (unsigned i = 0; i < TASK_COUNT; i++)
+    {
+        if (handles[i] != NULL && !stackWarned[i] && uxTaskGetStackHighWaterMark(handles[i]) < TASK_STACK_MARGIN)
+        {
+            stackWarned[i] = true;
+            LOG_WARN("%s stack margin below %d bytes", taskConfigs[i].name, TASK_STACK_MARGIN);
+        }
+    }
+    if (!heapWarned && ESP.getMinFreeHeap() < HEAP_MIN_FREE)
+    {
+        heapWarned = true;
+        LOG_WARN("heap low water mark %u below budget %d", ESP.getMinFreeHeap(), HEAP_MIN_FREE);
+    }
+}
+
+/**
+ * @brief print the static task memory, the stack use per task and the heap to telnet,
+ * "size" is the peak use plus TASK_STACK_MARGIN rounded up to 256 bytes for TASK_TABLE
+ *
+ */
+void memoryPrint()
+{
+    uint32_t stackTotal = 0;
+    telnet.println("task                 stack   used  free   size");
+    for (unsigned i = 0; i < TASK_COUNT; i++)
+    {
+        const TaskConfig &config = taskConfigs[i];
+        stackTotal += config.stackSize;
+        if (handles[i] == NULL)
+        {
+            telnet.printf("%-20s %5u  not started\n", config.name, config.stackSize);
+            continue;
+        }
+        unsigned left = uxTaskGetStackHighWaterMark(handles[i]);
+        unsigned used = config.stackSize - left;
+        unsigned size = (used + TASK_STACK_MARGIN + 255) / 256 * 256;
+        telnet.printf("%-20s %5u  %5u %5u  %5u%s\n", config.name, config.stackSize, used, left, size,
+                      left < TASK_STACK_MARGIN ? "  LOW" : "");
+    }
+    telnet.printf("static task memory: %u bytes stacks + %u bytes tcb\n", stackTotal,
+                  (unsigned)sizeof(taskBuffers));
+    uint32_t heapSize = ESP.getHeapSize();
+    uint32_t minFree = ESP.getMinFreeHeap();
+    telnet.printf("heap: size=%u free=%u peak used=%u min free=%u budget=%u%s largest block=%u\n", heapSize,
+                  ESP.getFreeHeap(), heapSize - minFree, minFree, HEAP_MIN_FREE,
+                  minFree < HEAP_MIN_FREE ? " EXCEEDED" : "",
+                  (unsigned)heap_caps_get_largest_free_block(MALLOC_CAP_8BIT));
+}
\ No newline at end of file
@@ -0,0 +1,190 @@
+#include <Arduino.h>
+#include "defines.hpp"
+#include "tasks.hpp"
+#include "telemetry_stream.hpp"
+#include "telemetry.hpp"
+#include "wifi.hpp"
+#include "car_control.hpp"
+#include "stepper_motor.hpp"
+#include "mission_queue.hpp"
+#include "task_profiler.hpp"
+#include "telnet_debug.hpp"
+
+extern double usDistances[NUM_SENSORS];
+extern unsigned volatile detectTagCenter;
+extern double detectTagSize;
+extern volatile unsigned tagFrameCounter;
+extern uint8_t missionMode;
+extern volatile int targetTagId;
+extern unsigned robotStatus;
+extern unsigned robotCargo;
+extern unsigned robotRequest;
+
+namespace
+{
+    volatile unsigned rate = TELEMETRY_RATE;
+    // fields as sent in the previous record, the reference of the delta encoding
+    telemetryState sent;
+    uint16_t sequence = 0;
+    uint8_t record[sizeof(telemetryState)];
+    uint32_t recordsSent = 0;
+    uint32_t bytesSent = 0;
+
+    uint16_t toU16(double value)
+    {
+        return constrain(value, 0, UINT16_MAX);
+    }
+
+    int16_t toI16(double value)
+    {
+        return constrain(value, INT16_MIN, INT16_MAX);
+    }
+
+    /**
+     * @brief collect the current robot state, only copies values and never blocks
+     *
+     */
+    void sample(telemetryState &s)
+    {
+        for (int i = 0; i < NUM_SENSORS; i++)
+        {
+            s.us.distance[i] = toU16(usDistances[i] * 10);
+        }
+        s.tag.center = detectTagCenter;
+        s.tag.size = toU16(detectTagSize * 100);
+        s.tag.frame = tagFrameCounter;
+        s.stepper.state = stepperState();
+        s.stepper.steps = returnSteps();
+        s.stepper.headingSteps = stepperHeadingSteps();
+        float x, y, heading;
+        stepperPose(x, y, heading);
+        s.pose.x = toI16(x * 10);
+        s.pose.y = toI16(y * 10);
+        s.pose.heading = toI16(remainderf(heading, 2 * PI) * 1000);
+        s.mission.mission = missionMode;
+        s.mission.robotStatus = robotStatus;
+        s.mission.cargo = robotCargo;
+        s.mission.request = robotRequest;
+        s.mission.station = targetTagId == ANY_STATION ? 0xFF : targetTagId;
+        s.mission.queued = missionQueueCount();
+        const LoopTiming &timing = controlLoopTiming();
+        s.timing.periodUs = timing.lastUs;
+        s.timing.misses = timing.misses;
+    }
+
+    /**
+     * @brief append a field to the record if it changed since it was last sent
+     *
+     * @return the new record length
+     */
+    template <typename T>
+    size_t appendField(size_t length, const T &now, T &last, uint8_t bit, bool keyframe, uint8_t &fields)
+    {
+        if (!keyframe && memcmp(&now, &last, sizeof(T)) == 0)
+        {
+            return length;
+        }
+        memcpy(record + length, &now, sizeof(T));
+        last = now;
+        fields |= bit;
+        return length + sizeof(T);
+    }
+
+    /**
+     * @brief delta encode a state into record
+     *
+     * @return the record length
+     */
+    size_t encode(const telemetryState &s)
+    {
+        bool keyframe = sequence % TELEMETRY_KEYFRAME_INTERVAL == 0;
+        uint8_t fields = 0;
+        size_t length = sizeof(telemetryStateHeader);
+        length = appendField(length, s.us, sent.us, TELEMETRY_FIELD_US, keyframe, fields);
+        length = appendField(length, s.tag, sent.tag, TELEMETRY_FIELD_TAG, keyframe, fields);
+        length = appendField(length, s.stepper, sent.stepper, TELEMETRY_FIELD_STEPPER, keyframe, fields);
+        length = appendField(length, s.pose, sent.pose, TELEMETRY_FIELD_POSE, keyframe, fields);
+        length = appendField(length, s.mission, sent.mission, TELEMETRY_FIELD_MISSION, keyframe, fields);
+        length = appendField(length, s.timing, sent.timing, TELEMETRY_FIELD_TIMING, keyframe, fields);
+
+        telemetryStateHeader header;
+        memcpy(header.header.preamble, PREAMBLE, sizeof(PREAMBLE));
+        header.header.type = TELEMETRY_STATE;
+        header.header.uptime = millis();
+        header.sequence = sequence++;
+        header.fields = fields;
+        memcpy(record, &header, sizeof(header));
+        return length;
+    }
+
+    void telemetryStreamTask(void *argument)
+    {
+        Serial.print("telemetryStreamTask is running on: ");
+        Serial.println(xPortGetCoreID());
+        unsigned profilerSlot = profilerRegister();
+        TickType_t lastWake = xTaskGetTickCount();
+
+        for (;;)
+        {
+            profilerLoop(profilerSlot);
+            unsigned hz = rate;
+            if (hz == 0)
+            {
+                vTaskDelay(100);
+                lastWake = xTaskGetTickCount();
+                continue;
+            }
+            vTaskDelayUntil(&lastWake, pdMS_TO_TICKS(1000 / hz));
+            if (getNumClients() == 0)
+            {
+                continue;
+            }
+            telemetryState s;
+            sample(s);
+            size_t length = encode(s);
+            sendTelemetry(record, length);
+            recordsSent++;
+            bytesSent += length;
+        }
+        Serial.println("telemetryStreamTask closed");
+        vTaskDelete(NULL);
+    }
+}
+
+/**
+ * @brief start the background task streaming telemetryState records to UDP_TELEMETRY_PORT
+ *
+ */
+void telemetryStreamInit()
+{
+    taskStart(TASK_TELEMETRY_STREAM, telemetryStreamTask);
+}
+
+/**
+ * @brief change the record rate
+ *
+ * @param hz between TELEMETRY_MIN_RATE and TELEMETRY_MAX_RATE or 0 to stop the stream
+ * @return false if the rate is out of range
+ */
+bool telemetryStreamSetRate(unsigned hz)
+{
+    if (hz != 0 && (hz < TELEMETRY_MIN_RATE || hz > TELEMETRY_MAX_RATE))
+    {
+        return false;
+    }
+    rate = hz;
+    // the next record is a keyframe so a recorder started now syncs quickly
+    sequence = 0;
+    return true;
+}
+
+/**
+ * @brief print the stream statistics to telnet
+ *
+ */
+void telemetryStreamPrint()
+{
+    unsigned long average = recordsSent ? bytesSent / recordsSent : 0;
+    telnet.printf("telemetry: rate=%uHz records=%u bytes=%u average=%luB full=%uB\n",
+                  rate, recordsSent, bytesSent, average, (unsigned)sizeof(telemetryState));
+}
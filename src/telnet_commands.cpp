@@ -0,0 +1,480 @@
+#include <Arduino.h>
+#include "defines.hpp"
+#include "telnet_commands.hpp"
+#include "telnet_debug.hpp"
+#include "wifi.hpp"
+#include "car_control.hpp"
+#include "stepper_motor.hpp"
+#include "mission_queue.hpp"
+#include "object_recognition.hpp"
+#include "cargo_classifier.hpp"
+#include "floor_map.hpp"
+#include "route_planner.hpp"
+#include "loop_timing.hpp"
+#include "task_profiler.hpp"
+#include "tasks.hpp"
+#include "alloc_counter.hpp"
+#include "telemetry_stream.hpp"
+#include "params.hpp"
+#include "log.hpp"
+#include "black_box.hpp"
+#include "trace.hpp"
+
+extern uint8_t missionMode;
+extern unsigned robotStatus;
+extern unsigned robotCargo;
+extern unsigned robotRequest;
+extern volatile int targetTagId;
+extern unsigned volatile detectTagCenter;
+extern double detectTagSize;
+extern double usDistances[NUM_SENSORS];
+
+namespace
+{
+    // only the telnet task executes commands, so one static line buffer is enough
+    char line[COMMAND_MAX_LINE];
+
+    const char *cmdHelp(const CommandArgs &args);
+
+    const char *cmdStop(const CommandArgs &args)
+    {
+        missionQueueClear();
+        missionMode = missions::NO_MISSION;
+        return NULL;
+    }
+
+    const char *cmdMission(const CommandArgs &args)
+    {
+        long station = ANY_STATION;
+        if (args.count > 1 && !argInt(args, 1, station, 0, 254))
+        {
+            return "invalid station";
+        }
+        if (!missionQueuePush(missionFromCode(args.words[0]), station))
+        {
+            return "mission queue full";
+        }
+        missionQueuePrint();
+        return NULL;
+    }
+
+    const char *cmdQueue(const CommandArgs &args)
+    {
+        if (!missionQueueParse(args.rest))
+        {
+            return "invalid trip or mission queue full";
+        }
+        missionQueuePrint();
+        return NULL;
+    }
+
+    const char *cmdQueueList(const CommandArgs &args)
+    {
+        missionQueuePrint();
+        return NULL;
+    }
+
+    const char *cmdQueueClear(const CommandArgs &args)
+    {
+        missionQueueClear();
+        return NULL;
+    }
+
+    const char *cmdDriveAway(const CommandArgs &args)
+    {
+        if (missionMode == missions::NO_MISSION)
+        {
+            return "no mission";
+        }
+        missionMode = missions::DRIVING_AWAY;
+        return NULL;
+    }
+
+    const char *cmdStatus(const CommandArgs &args)
+    {
+        float x, y, heading;
+        stepperPose(x, y, heading);
+        telnet.printf("mission=%s status=%u cargo=%u request=%u target=%d queued=%u\n",
+                      missionName(missionMode), robotStatus, robotCargo, robotRequest, targetTagId,
+                      missionQueueCount());
+        telnet.printf("tag center=%u size=%.1f\n", detectTagCenter, detectTagSize);
+        telnet.printf("us left=%.1f frontl=%.1f frontc=%.1f frontr=%.1f right=%.1f\n",
+                      usDistances[0], usDistances[1], usDistances[2], usDistances[3], usDistances[4]);
+        telnet.printf("pose x=%.1f y=%.1f heading=%.1f motors=%u\n", x, y, heading * 180 / PI, stepperState());
+        telnet.printf("uptime=%lu heap=%u\n", millis(), ESP.getFreeHeap());
+        return NULL;
+    }
+
+    const char *cmdSearchStats(const CommandArgs &args)
+    {
+        printSearchStats();
+        return NULL;
+    }
+
+    const char *cmdPose(const CommandArgs &args)
+    {
+        printPose();
+        return NULL;
+    }
+
+    const char *cmdColor(const CommandArgs &args)
+    {
+        if (args.count == 1)
+        {
+            colorPrint();
+            return NULL;
+        }
+        return colorCommand(args.rest) ? NULL : "invalid color command";
+    }
+
+    const char *cmdDock(const CommandArgs &args)
+    {
+        printDockStats();
+        return NULL;
+    }
+
+    const char *cmdTop(const CommandArgs &args)
+    {
+        profilerPrint();
+        return NULL;
+    }
+
+    const char *cmdMem(const CommandArgs &args)
+    {
+        memoryPrint();
+        return NULL;
+    }
+
+    const char *cmdAlloc(const CommandArgs &args)
+    {
+        allocPrint();
+        return NULL;
+    }
+
+    const char *cmdTiming(const CommandArgs &args)
+    {
+        if (args.count > 1 && !argIs(args, 1, "reset"))
+        {
+            return "usage: timing [reset]";
+        }
+        printControlTiming(args.count > 1);
+        printStepTiming(args.count > 1);
+        return NULL;
+    }
+
+    const char *cmdComm(const CommandArgs &args)
+    {
+        commPrint();
+        return NULL;
+    }
+
+    const char *cmdTelemetry(const CommandArgs &args)
+    {
+        long hz;
+        if (args.count > 1)
+        {
+            if (!argInt(args, 1, hz, 0, TELEMETRY_MAX_RATE) || !telemetryStreamSetRate(hz))
+            {
+                return "telemetry rate out of range";
+            }
+        }
+        telemetryStreamPrint();
+        return NULL;
+    }
+
+    const char *cmdLog(const CommandArgs &args)
+    {
+        logPrint();
+        return NULL;
+    }
+
+    const char *cmdBlackBox(const CommandArgs &args)
+    {
+        if (args.count == 1)
+        {
+            blackBoxPrint();
+        }
+        else if (argIs(args, 1, "dump"))
+        {
+            if (args.count > 2 && !argIs(args, 2, "flash"))
+            {
+                return "usage: bb dump [flash]";
+            }
+            blackBoxDump(args.count > 2);
+        }
+        else if (argIs(args, 1, "send"))
+        {
+            blackBoxSend();
+        }
+        else if (argIs(args, 1, "save"))
+        {
+            return blackBoxSave() ? NULL : "no blackbox partition or flash error";
+        }
+        else if (argIs(args, 1, "clear"))
+        {
+            blackBoxClear();
+        }
+        else
+        {
+            return "unknown subcommand";
+        }
+        return NULL;
+    }
+
+    const char *cmdTrace(const CommandArgs &args)
+    {
+        if (args.count == 1)
+        {
+            tracePrint();
+        }
+        else if (argIs(args, 1, "dump"))
+        {
+            traceDump();
+        }
+        else if (argIs(args, 1, "clear"))
+        {
+            traceClear();
+        }
+        else
+        {
+            return "unknown subcommand";
+        }
+        return NULL;
+    }
+
+    const char *cmdParam(const CommandArgs &args)
+    {
+        if (args.count == 1)
+        {
+            for (unsigned i = 0; i < paramCount(); i++)
+            {
+                paramPrint(i);
+            }
+            return NULL;
+        }
+        if (argIs(args, 1, "save"))
+        {
+            return paramsSave() ? NULL : "saving failed";
+        }
+        if (argIs(args, 1, "reset"))
+        {
+            paramsReset();
+            return NULL;
+        }
+        int index = paramFind(args.words[1]);
+        if (index < 0)
+        {
+            return "unknown parameter";
+        }
+        if (args.count > 2)
+        {
+            float value;
+            if (!argFloat(args, 2, value, -1e9, 1e9) || !paramSet(index, value))
+            {
+                return "value out of range";
+            }
+            // the change listener already printed the new value
+            return NULL;
+        }
+        paramPrint(index);
+        return NULL;
+    }
+
+    /**
+     * @brief time the route planner and the cargo classifier on the robot
+     *
+     */
+    const char *cmdBench(const CommandArgs &args)
+    {
+        long n = 10;
+        if (args.count > 2 && !argInt(args, 2, n, 1, 1000))
+        {
+            return "invalid count";
+        }
+        uint32_t total = 0;
+        uint32_t worst = 0;
+        if (argIs(args, 1, "route"))
+        {
+            float x, y, heading;
+            floorMapStartPose(x, y, heading);
+            Waypoint waypoints[ROUTE_MAX_WAYPOINTS];
+            for (long i = 0; i < n; i++)
+            {
+                const StationPose *station = floorMapStation(i % 3);
+                uint64_t start = loopTimingNow();
+                planRoute(x, y, station->approachX, station->approachY, waypoints, ROUTE_MAX_WAYPOINTS);
+                uint32_t us = loopTimingElapsedUs(start, loopTimingNow());
+                total += us;
+                worst = max(worst, us);
+            }
+        }
+        else if (argIs(args, 1, "classify"))
+        {
+            CargoClassifier classifier;
+            cargoClassifierDefaults(classifier);
+            for (long i = 0; i < n; i++)
+            {
+                float features[CLASSIFIER_FEATURES] = {0.3f + i * 0.001f, 0.35f, 0.2f};
+                float confidence;
+                uint64_t start = loopTimingNow();
+                cargoClassify(classifier, features, &confidence);
+                uint32_t us = loopTimingElapsedUs(start, loopTimingNow());
+                total += us;
+                worst = max(worst, us);
+            }
+        }
+        else
+        {
+            return "usage: bench route|classify [n]";
+        }
+        telnet.printf("bench %s n=%ld mean=%luus max=%luus\n", args.words[1], n,
+                      (unsigned long)(total / n), (unsigned long)worst);
+        return NULL;
+    }
+
+    const Command commands[] = {
+        {"help", "[command]", "list commands or show the usage of one", 0, 1, cmdHelp},
+        {"status", "", "live mission, tag, ultrasonic and pose state", 0, 0, cmdStatus},
+        {"stop", "", "clear the queue and stop the current mission", 0, 0, cmdStop},
+        {"d", "[station]", "queue deliver", 0, 1, cmdMission},
+        {"gg", "[station]", "queue get gummy bear", 0, 1, cmdMission},
+        {"gc", "[station]", "queue get cotton wool", 0, 1, cmdMission},
+        {"gb", "[station]", "queue get ping pong ball", 0, 1, cmdMission},
+        {"q", "<mission> [station] ...", "queue a trip", 1, COMMAND_MAX_ARGS - 1, cmdQueue},
+        {"ql", "", "list the mission queue", 0, 0, cmdQueueList},
+        {"qc", "", "clear the mission queue", 0, 0, cmdQueueClear},
+        {"da", "", "drive away from the station", 0, 0, cmdDriveAway},
+        {"ss", "", "tag search statistics", 0, 0, cmdSearchStats},
+        {"pose", "", "odometry pose and the estimate of the pose estimator", 0, 0, cmdPose},
+        {"color", "[log|model|set|save|defaults ...]", "cargo sensor state and classifier", 0, COMMAND_MAX_ARGS - 1, cmdColor},
+        {"dock", "", "docking error statistics", 0, 0, cmdDock},
+        {"top", "", "cpu and stack usage per task", 0, 0, cmdTop},
+        {"mem", "", "task stacks and heap against the memory budget", 0, 0, cmdMem},
+        {"alloc", "", "heap allocations per task of the allocation counter build", 0, 0, cmdAlloc},
+        {"timing", "[reset]", "control loop period and step lateness statistics", 0, 1, cmdTiming},
+        {"comm", "", "station protocol statistics", 0, 0, cmdComm},
+        {"tm", "[hz]", "telemetry stream statistics and rate", 0, 1, cmdTelemetry},
+        {"param", "[name [value]|save|reset]", "list, get or set runtime parameters", 0, 2, cmdParam},
+        {"bb", "[dump [flash]|send|save|clear]", "black box recorder of the control inputs", 0, 2, cmdBlackBox},
+        {"trace", "[dump|clear]", "latency trace from tag frames to the first motor step", 0, 1, cmdTrace},
+        {"log", "", "log ring usage and dropped records", 0, 0, cmdLog},
+        {"bench", "route|classify [n]", "time the route planner or the classifier", 1, 2, cmdBench},
+    };
+
+    const Command *findCommand(const char *name)
+    {
+        for (const Command &command : commands)
+        {
+            if (strcmp(command.name, name) == 0)
+            {
+                return &command;
+            }
+        }
+        return NULL;
+    }
+
+    const char *cmdHelp(const CommandArgs &args)
+    {
+        if (args.count > 1)
+        {
+            const Command *command = findCommand(args.words[1]);
+            if (command == NULL)
+            {
+                return "unknown command";
+            }
+            telnet.printf("%s %s: %s\n", command->name, command->usage, command->help);
+            return NULL;
+        }
+        for (const Command &command : commands)
+        {
+            telnet.printf("%-6s %-24s %s\n", command.name, command.usage, command.help);
+        }
+        return NULL;
+    }
+}
+
+/**
+ * @brief parse an integer argument
+ *
+ * @return false if the argument is missing, no number or out of [min, max]
+ */
+bool argInt(const CommandArgs &args, unsigned index, long &value, long min, long max)
+{
+    if (index >= args.count)
+        return false;
+    char *end;
+    value = strtol(args.words[index], &end, 10);
+    return *end == '\0' && value >= min && value <= max;
+}
+
+/**
+ * @brief parse a float argument
+ *
+ * @return false if the argument is missing, no number or out of [min, max]
+ */
+bool argFloat(const CommandArgs &args, unsigned index, float &value, float min, float max)
+{
+    if (index >= args.count)
+        return false;
+    char *end;
+    value = strtof(args.words[index], &end);
+    return *end == '\0' && value >= min && value <= max;
+}
+
+bool argIs(const CommandArgs &args, unsigned index, const char *word)
+{
+    return index < args.count && strcmp(args.words[index], word) == 0;
+}
+
+/**
+ * @brief tokenize a telnet line in place and run the matching command,
+ * every command answers with "ok <name>" or "error <name>: <reason>"
+ *
+ * @param input the received line
+ */
+void commandExecute(const char *input)
+{
+    strncpy(line, input, sizeof(line) - 1);
+    line[sizeof(line) - 1] = '\0';
+    CommandArgs args = {0, {NULL}, ""};
+    char *p = line;
+    while (*p != '\0' && args.count < COMMAND_MAX_ARGS)
+    {
+        while (*p == ' ')
+            *p++ = '\0';
+        if (*p == '\0')
+            break;
+        args.words[args.count++] = p;
+        if (args.count == 1)
+        {
+            // the untokenized rest in the original line
+            const char *rest = input + (p - line) + strcspn(p, " ");
+            args.rest = rest + strspn(rest, " ");
+        }
+        p += strcspn(p, " ");
+    }
+    if (args.count == 0)
+    {
+        return;
+    }
+    blackBoxCommand(BB_SOURCE_TELNET, input, strlen(input));
+
+    const Command *command = findCommand(args.words[0]);
+    if (command == NULL)
+    {
+        telnet.printf("error %s: unknown command, try help\n", args.words[0]);
+        return;
+    }
+    if (args.count - 1 < command->minArgs || args.count - 1 > command->maxArgs)
+    {
+        telnet.printf("error %s: usage: %s %s\n", command->name, command->name, command->usage);
+        return;
+    }
+    const char *error = command->handler(args);
+    if (error != NULL)
+    {
+        telnet.printf("error %s: %s\n", command->name, error);
+        return;
+    }
+    telnet.printf("ok %s\n", command->name);
+}
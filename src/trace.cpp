@@ -0,0 +1,136 @@
+#include <Arduino.h>
+#include "defines.hpp"
+#include "trace.hpp"
+#include "telnet_debug.hpp"
+
+namespace
+{
+    traceRecord ring[TRACE_SIZE];
+    uint32_t written = 0;
+    // records lost because a dump was running
+    uint32_t dropped = 0;
+    bool frozen = false;
+    portMUX_TYPE mux = portMUX_INITIALIZER_UNLOCKED;
+
+    // correlation of the last record per event
+    uint16_t last[TRACE_FIRST_STEP + 1];
+    // the parsed frame the last decision was traced for
+    uint16_t decidedFrame = 0;
+}
+
+/**
+ * @brief record a trace event, safe from every task
+ *
+ * @param event one of traceEvent
+ * @param correlation the frame the event belongs to
+ */
+void trace(uint8_t event, uint16_t correlation)
+{
+    traceRecord r = {(uint32_t)micros(), correlation, event, (uint8_t)xPortGetCoreID()};
+    portENTER_CRITICAL(&mux);
+    if (event <= TRACE_FIRST_STEP)
+    {
+        last[event] = correlation;
+    }
+    if (frozen)
+    {
+        dropped++;
+    }
+    else
+    {
+        ring[written % TRACE_SIZE] = r;
+        written++;
+    }
+    portEXIT_CRITICAL(&mux);
+}
+
+/**
+ * @brief correlation of the last recorded event of a kind
+ *
+ */
+uint16_t traceLast(uint8_t event)
+{
+    portENTER_CRITICAL(&mux);
+    uint16_t correlation = event <= TRACE_FIRST_STEP ? last[event] : 0;
+    portEXIT_CRITICAL(&mux);
+    return correlation;
+}
+
+/**
+ * @brief number a received frame and record it, only called by the AprilTag packet handler
+ *
+ * @return the correlation of the frame
+ */
+uint16_t traceReceive()
+{
+    uint16_t frame = traceLast(TRACE_UDP_RECEIVE) + 1;
+    trace(TRACE_UDP_RECEIVE, frame);
+    return frame;
+}
+
+/**
+ * @brief record a control decision on the newest parsed frame,
+ * later decisions on the same frame are not recorded
+ *
+ */
+void traceDecision()
+{
+    uint16_t frame = traceLast(TRACE_TAG_PARSED);
+    if (frame != decidedFrame)
+    {
+        decidedFrame = frame;
+        trace(TRACE_DECISION, frame);
+    }
+}
+
+/**
+ * @brief record a motor command caused by the last decision
+ *
+ * @return the correlation to record the first step with
+ */
+uint16_t traceMotorCommand()
+{
+    uint16_t frame = traceLast(TRACE_DECISION);
+    trace(TRACE_MOTOR_COMMAND, frame);
+    return frame;
+}
+
+/**
+ * @brief print the ring from the oldest record as lines "tr <micros> <event> <correlation> <core>",
+ * recording is paused meanwhile
+ *
+ */
+void traceDump()
+{
+    portENTER_CRITICAL(&mux);
+    frozen = true;
+    uint32_t end = written;
+    portEXIT_CRITICAL(&mux);
+    uint32_t start = end > TRACE_SIZE ? end - TRACE_SIZE : 0;
+    for (uint32_t i = start; i < end; i++)
+    {
+        const traceRecord &r = ring[i % TRACE_SIZE];
+        telnet.printf("tr %u %u %u %u\n", r.time, r.event, r.correlation, r.core);
+    }
+    portENTER_CRITICAL(&mux);
+    frozen = false;
+    portEXIT_CRITICAL(&mux);
+}
+
+void traceClear()
+{
+    portENTER_CRITICAL(&mux);
+    written = 0;
+    dropped = 0;
+    portEXIT_CRITICAL(&mux);
+}
+
+/**
+ * @brief print the trace statistics to telnet
+ *
+ */
+void tracePrint()
+{
+    telnet.printf("trace: records=%u/%u written=%u dropped=%u last frame=%u\n", min(written, (uint32_t)TRACE_SIZE),
+                  TRACE_SIZE, written, dropped, traceLast(TRACE_UDP_RECEIVE));
+}
\ No newline at end of file
@@ -1,10 +1,15 @@
 #include <Arduino.h>
 #include "defines.hpp"
+#include "log.hpp"
+#include "black_box.hpp"
 #include "ultrasonic.hpp"
 #include "telnet_debug.hpp"
+#include "task_profiler.hpp"
 
 // stores measured distances form ultrasonic sensors for use by other tasks
 double usDistances[NUM_SENSORS] = {0};
+// millis() of the last update of each entry in usDistances
+unsigned long usTimestamps[NUM_SENSORS] = {0};
 
 // used to enable/disable the ultrasonic routine
 bool ultrasonicEnable = true;
@@ -144,9 +149,11 @@ void ultrasonicTask(void *argument)
 {
     Serial.print("ultrasonicTask is running on: ");
     Serial.println(xPortGetCoreID());
+    unsigned profilerSlot = profilerRegister();
     ultrasonicInit();
     for (;;)
     {
+        profilerLoop(profilerSlot);
         while (ultrasonicEnable == false)
         {
             vTaskDelay(100);
@@ -158,15 +165,17 @@ void ultrasonicTask(void *argument)
             while (timerPulseFinished[i] == false)
             {
                 if (ultrasonicStarted && millis() - usStartTime > 1000){
-                    DEBUG_MSG("US TIMEOUT");
+                    LOG_WARN("US TIMEOUT");
                     delay(1000);
                 }
-                vTaskDelay(0);
+                vTaskDelay(TASK_POLL_TICKS);
             }
             ultrasonicStarted = true;
             //Serial.printf("us %i\n", i);
             timerPulseFinished[i] = false;
             usDistances[i] = microsToCm(timerPulseDuration[i]);
+            blackBoxUs(i, usDistances[i]);
+            usTimestamps[i] = millis();
         }
         //ultrasonicPrint();
         delay(250);
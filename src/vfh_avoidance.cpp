@@ -0,0 +1,221 @@
+#include <math.h>
+#include "defines.hpp"
+#include "vfh_avoidance.hpp"
+
+namespace
+{
+    const float SECTOR_WIDTH = 2 * (float)M_PI / VFH_SECTORS;
+
+    float wrapAngle(float a)
+    {
+        return remainderf(a, 2 * (float)M_PI);
+    }
+
+    int sectorOf(float direction)
+    {
+        float a = fmodf(direction, 2 * (float)M_PI);
+        if (a < 0)
+        {
+            a += 2 * (float)M_PI;
+        }
+        return (int)lroundf(a / SECTOR_WIDTH) % VFH_SECTORS;
+    }
+
+    /**
+     * @brief prefer the goal, then small steering changes and keeping the last direction
+     *
+     */
+    float cost(float candidate, float heading, float goal, float last)
+    {
+        float c = 5 * fabsf(wrapAngle(candidate - goal)) + 2 * fabsf(wrapAngle(candidate - heading));
+        if (!isnan(last))
+        {
+            c += 2 * fabsf(wrapAngle(candidate - last));
+        }
+        return c;
+    }
+
+    /**
+     * @brief density of every sector widened by the angle the robot radius covers at the range of the obstacle,
+     * then thresholded with hysteresis
+     *
+     */
+    void updateBlocked(VfhHistogram &h)
+    {
+        float widened[VFH_SECTORS] = {0};
+        for (int i = 0; i < VFH_SECTORS; i++)
+        {
+            float d = h.density[i];
+            if (d <= 0)
+            {
+                continue;
+            }
+            float range = fmaxf(VFH_RANGE * (1 - sqrtf(d)), 1);
+            int spread = ceilf(asinf(fminf(1, VFH_ROBOT_RADIUS / range)) / SECTOR_WIDTH);
+            for (int k = -spread; k <= spread; k++)
+            {
+                int j = (i + k + VFH_SECTORS) % VFH_SECTORS;
+                widened[j] = fmaxf(widened[j], d);
+            }
+        }
+        for (int i = 0; i < VFH_SECTORS; i++)
+        {
+            if (widened[i] > VFH_THRESHOLD_HIGH)
+            {
+                h.blocked[i] = true;
+            }
+            else if (widened[i] < VFH_THRESHOLD_LOW)
+            {
+                h.blocked[i] = false;
+            }
+        }
+    }
+}
+
+void vfhReset(VfhHistogram &h, float distance)
+{
+    for (int i = 0; i < VFH_SECTORS; i++)
+    {
+        h.density[i] = 0;
+        h.blocked[i] = false;
+    }
+    h.distance = distance;
+    h.lastDirection = NAN;
+}
+
+/**
+ * @brief fade the readings by the distance driven, the bearing of an obstacle changes when the robot moves
+ *
+ * @param distance odometry distance in cm
+ */
+void vfhDecay(VfhHistogram &h, float distance)
+{
+    float fade = expf(-fabsf(distance - h.distance) / VFH_MEMORY_DISTANCE);
+    for (int i = 0; i < VFH_SECTORS; i++)
+    {
+        h.density[i] *= fade;
+    }
+    h.distance = distance;
+}
+
+/**
+ * @brief enter a fresh ultrasonic reading, it replaces the sectors the sensor beam covers
+ * and the other sectors keep their memory
+ *
+ * @param direction of the sensor in the map frame in rad
+ * @param range in cm, US_MAX_DIST if there was no echo
+ */
+void vfhUpdate(VfhHistogram &h, float direction, float range)
+{
+    float closeness = fmaxf(VFH_RANGE - range, 0) / VFH_RANGE;
+    int center = sectorOf(direction);
+    const int halfBeam = US_BEAM_WIDTH * VFH_SECTORS / 720;
+    for (int k = -halfBeam; k <= halfBeam; k++)
+    {
+        h.density[(center + k + VFH_SECTORS) % VFH_SECTORS] = closeness * closeness;
+    }
+}
+
+/**
+ * @brief choose the free direction closest to the goal and the curve towards it.
+ * The gaps between blocked sectors are candidates, a gap that contains the goal is entered
+ * at the goal, wide gaps VFH_WIDE_VALLEY / 2 sectors from their border, narrow gaps in the middle
+ *
+ * @param heading of the robot in rad, map frame
+ * @param goal direction to the target in rad, map frame
+ * @return the command, blocked if every direction is blocked
+ */
+VfhCommand vfhSteer(VfhHistogram &h, float heading, float goal)
+{
+    VfhCommand command = {false, heading, 0, 0, 0};
+    updateBlocked(h);
+    int firstBlocked = -1;
+    for (int i = 0; i < VFH_SECTORS && firstBlocked < 0; i++)
+    {
+        if (h.blocked[i])
+        {
+            firstBlocked = i;
+        }
+    }
+
+    float best = goal;
+    if (firstBlocked >= 0)
+    {
+        int goalSector = sectorOf(goal);
+        float bestCost = INFINITY;
+        int start = -1;
+        for (int n = 1; n <= VFH_SECTORS; n++)
+        {
+            int i = (firstBlocked + n) % VFH_SECTORS;
+            if (!h.blocked[i])
+            {
+                if (start < 0)
+                {
+                    start = firstBlocked + n;
+                }
+                continue;
+            }
+            if (start < 0)
+            {
+                continue;
+            }
+            // free sectors start .. firstBlocked + n - 1, not wrapped
+            int length = firstBlocked + n - start;
+            float candidates[2];
+            int count = 0;
+            if ((goalSector - start % VFH_SECTORS + VFH_SECTORS) % VFH_SECTORS < length)
+            {
+                candidates[count++] = goal;
+            }
+            else if (length >= VFH_WIDE_VALLEY)
+            {
+                candidates[count++] = (start + VFH_WIDE_VALLEY / 2) * SECTOR_WIDTH;
+                candidates[count++] = (start + length - 1 - VFH_WIDE_VALLEY / 2) * SECTOR_WIDTH;
+            }
+            else
+            {
+                candidates[count++] = (start + (length - 1) / 2.0f) * SECTOR_WIDTH;
+            }
+            for (int c = 0; c < count; c++)
+            {
+                float value = cost(candidates[c], heading, goal, h.lastDirection);
+                if (value < bestCost)
+                {
+                    bestCost = value;
+                    best = candidates[c];
+                }
+            }
+            start = -1;
+        }
+        if (isinf(bestCost))
+        {
+            command.blocked = true;
+            h.lastDirection = NAN;
+            return command;
+        }
+    }
+
+    command.direction = wrapAngle(best);
+    h.lastDirection = command.direction;
+    float alpha = wrapAngle(best - heading);
+    if (fabsf(alpha) > VFH_SPIN_ANGLE)
+    {
+        command.spin = alpha > 0 ? 1 : -1;
+        return command;
+    }
+    // arc through the point VFH_LOOKAHEAD ahead in the chosen direction
+    float curvature = 2 * sinf(alpha) / VFH_LOOKAHEAD;
+    command.curvature = fminf(fmaxf(curvature, -VFH_MAX_CURVATURE), VFH_MAX_CURVATURE);
+    command.speed = fmaxf(cosf(alpha), VFH_MIN_SPEED);
+    return command;
+}
+
+/**
+ * @brief true if a direction is not blocked after the last vfhSteer
+ *
+ * @param direction in rad, map frame
+ */
+bool vfhFree(const VfhHistogram &h, float direction)
+{
+    return !h.blocked[sectorOf(direction)];
+}
\ No newline at end of file
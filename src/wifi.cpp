@@ -2,7 +2,15 @@
 #include "AsyncUDP.h"
 #include "wifi.hpp"
 #include "defines.hpp"
+#include "tasks.hpp"
+#include "alloc_counter.hpp"
+#include "trace.hpp"
+#include "log.hpp"
+#include "black_box.hpp"
 #include "april_tag.hpp"
+#include "mission_queue.hpp"
+#include "task_profiler.hpp"
+#include "telnet_commands.hpp"
 #include "ESPTelnet.h"
 #include "esp_wifi.h"
 
@@ -19,45 +27,42 @@ namespace
     AsyncUDP udp2;
     wifi_sta_list_t wifi_sta_list;
     tcpip_adapter_sta_list_t adapter_sta_list;
+    // connected stations, refreshed by the wifi events instead of on every send
+    unsigned numStations = 0;
     bool stationIsWorking = false;
+    TaskHandle_t udpCommTaskHandle = NULL;
+
+    // agvMsg and slotMsg retransmission, acks arrive in the AsyncUDP task
+    CommSender agvSender;
+    // releases and requests of slots must all arrive in order, so they are not replaced
+    CommOutbox slotOutbox;
+    portMUX_TYPE agvSenderMux = portMUX_INITIALIZER_UNLOCKED;
+    // reservation of the station the robot docks at
+    volatile uint8_t slotStation = 0;
+    volatile uint8_t reservationState = SLOT_NONE;
+
+    /**
+     * @brief duplicate detection per station, stations are told apart by their ip
+     *
+     */
+    struct CommPeer
+    {
+        uint32_t ip;
+        CommReceiver receiver;
+    };
+    CommPeer peers[COMM_MAX_PEERS];
+    unsigned nextPeer = 0;
+    uint32_t invalidPackets = 0;
 
     void onInputReceived(String input)
     {
-        Serial.printf("telnet -> %s\n", input);
-        if (input == "stop")
-        {
-            DEBUG_MSG("set mission to NO_MISSION");
-            missionMode = missions::NO_MISSION;
-        }
-        else if (input == "d" && missionMode == missions::NO_MISSION)
-        {
-            DEBUG_MSG("set mission to DELIVER");
-            missionMode = missions::DELIVER;
-        }
-        else if (input == "gg" && missionMode == missions::NO_MISSION)
-        {
-            DEBUG_MSG("set mission to GET_GUMMY_BEAR");
-            missionMode = missions::GET_GUMMY;
-        }
-        else if (input == "gc" && missionMode == missions::NO_MISSION)
-        {
-            DEBUG_MSG("set mission to GET_COTTON_WOOL");
-            missionMode = missions::GET_COTTON;
-        }
-        else if (input == "gb" && missionMode == missions::NO_MISSION)
-        {
-            DEBUG_MSG("set mission to GET_BALL");
-            missionMode = missions::GET_BALL;
-        }
-        else if (input == "da" && missionMode != missions::NO_MISSION)
-        {
-            DEBUG_MSG("set mission to DRIVING_AWAY");
-            missionMode = missions::DRIVING_AWAY;
-        }
-        else
-        {
-            DEBUG_MSG("unknown command");
-        }
+        Serial.printf("telnet -> %s\n", input.c_str());
+        commandExecute(input.c_str());
+    }
+
+    void onParamChanged(unsigned index)
+    {
+        paramPrint(index);
     }
 
     void onTelnetConnect(String ip)
@@ -65,7 +70,7 @@ namespace
         Serial.print("- Telnet: ");
         Serial.print(ip);
         Serial.println(" connected");
-        telnet.println("\nWelcome " + telnet.getIP());
+        telnet.printf("\nWelcome %s\n", ip.c_str());
         telnetConnection = true;
     }
 
@@ -99,6 +104,7 @@ namespace
         telnet.onReconnect(onTelnetReconnect);
         telnet.onDisconnect(onTelnetDisconnect);
         telnet.onInputReceived(onInputReceived);
+        paramOnChange(onParamChanged);
 
         Serial.print("- Telnet: ");
         if (telnet.begin(TELNET_PORT))
@@ -115,40 +121,156 @@ namespace
     {
         Serial.print("udpTimeoutTask is running on: ");
         Serial.println(xPortGetCoreID());
+        unsigned profilerSlot = profilerRegister();
 
         for (;;)
         {
+            profilerLoop(profilerSlot);
             testTimeout();
             telnet.loop();
-            vTaskDelay(0);
+            vTaskDelay(TASK_POLL_TICKS);
         }
         Serial.println("udpTimeoutTask closed");
         vTaskDelete(NULL);
     }
 
+    /**
+     * @brief broadcast a datagram, the packet buffer lwip allocates for it is not counted
+     * against the allocation free tasks
+     *
+     */
+    void broadcast(const uint8_t *data, size_t length, uint16_t port)
+    {
+        allocExempt(true);
+        udp2.broadcastTo((uint8_t *)data, length, port);
+        allocExempt(false);
+    }
+
+    /**
+     * @brief send the pending message again if it was not acknowledged in time
+     *
+     */
+    void retransmit(CommSender &sender)
+    {
+        uint8_t msg[COMM_MAX_MSG];
+        size_t length = 0;
+        portENTER_CRITICAL(&agvSenderMux);
+        if (commSenderPoll(sender, millis()))
+        {
+            length = sender.length;
+            memcpy(msg, sender.buffer, length);
+        }
+        portEXIT_CRITICAL(&agvSenderMux);
+        if (length > 0)
+        {
+            broadcast(msg, length, UDP_COMM_PORT);
+        }
+    }
+
+    void retransmit(CommOutbox &outbox)
+    {
+        uint8_t msg[COMM_MAX_MSG];
+        size_t length = 0;
+        portENTER_CRITICAL(&agvSenderMux);
+        if (commOutboxPoll(outbox, millis()))
+        {
+            length = outbox.sender.length;
+            memcpy(msg, outbox.sender.buffer, length);
+        }
+        portEXIT_CRITICAL(&agvSenderMux);
+        if (length > 0)
+        {
+            broadcast(msg, length, UDP_COMM_PORT);
+        }
+    }
+
+    void sendSlotPck(uint8_t type, uint8_t station)
+    {
+        slotMsg msg;
+        msg.station = station;
+        msg.state = reservationState;
+        msg.position = 0;
+        portENTER_CRITICAL(&agvSenderMux);
+        bool queued = commOutboxQueue(slotOutbox, (uint8_t *)&msg, sizeof(msg), type);
+        portEXIT_CRITICAL(&agvSenderMux);
+        if (!queued)
+        {
+            LOG_WARN("slot outbox full, dropped slot message %u for station %u", type, station);
+        }
+        // udpCommTask sends it, lwip allocates the packet buffers in that task instead of the control tasks
+        agvStatusChanged();
+    }
+
     void udpCommTask(void *argument)
     {
         Serial.print("udpCommTask is running on: ");
         Serial.println(xPortGetCoreID());
+        unsigned profilerSlot = profilerRegister();
 
+        unsigned long profilerTimer = 0;
+        unsigned long heartbeatTimer = 0;
+        agvMsg last;
+        last.robotStatus = last.cargo = last.request = 0xFF;
         for (;;)
         {
-            sendAgvPck(robotStatus, robotCargo, robotRequest);
-            delay(500);
+            profilerLoop(profilerSlot);
+            // woken by agvStatusChanged, polls as a fallback for writers that do not notify
+            ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(AGV_STATUS_POLL));
+            bool changed = last.robotStatus != robotStatus || last.cargo != robotCargo ||
+                           last.request != robotRequest;
+            if (changed || millis() - heartbeatTimer > AGV_HEARTBEAT_PERIOD)
+            {
+                heartbeatTimer = millis();
+                last.robotStatus = robotStatus;
+                last.cargo = robotCargo;
+                last.request = robotRequest;
+                sendAgvPck(last.robotStatus, last.cargo, last.request);
+            }
+            retransmit(agvSender);
+            retransmit(slotOutbox);
+            if (millis() - profilerTimer > PROFILER_PERIOD)
+            {
+                profilerTimer = millis();
+                profilerSample();
+                memoryCheck();
+                allocSample();
+                sendTelemetry((const uint8_t *)&profilerSnapshot(), profilerSnapshotSize());
+            }
         }
         Serial.println("udpCommTask closed");
         vTaskDelete(NULL);
     }
 
-    void udpOnPck(AsyncUDPPacket packet)
+    /**
+     * @brief refresh the station count when a station joins or leaves the AP,
+     * on a fleet network the robot counts as connected once it has an ip
+     *
+     * @param event
+     */
+    void onStationEvent(WiFiEvent_t event)
+    {
+#ifdef WIFI_FLEET_SSID
+        numStations = (event == ARDUINO_EVENT_WIFI_STA_GOT_IP) ? 1 : 0;
+#else
+        esp_wifi_ap_get_sta_list(&wifi_sta_list);
+        tcpip_adapter_get_sta_list(&wifi_sta_list, &adapter_sta_list);
+        numStations = adapter_sta_list.num;
+#endif
+        Serial.printf("- Wifi: %u stations connected\n", numStations);
+        // a new station gets the current status right away
+        agvStatusChanged();
+    }
+
+    void udpOnPck(AsyncUDPPacket &packet)
     {
+        uint16_t frame = traceReceive();
         if (testApril(packet))
         {
-            parseApril(packet);
+            aprilTagPost(packet.data(), packet.length(), frame);
         }
     }
 
-    void printPacket(AsyncUDPPacket packet)
+    void printPacket(AsyncUDPPacket &packet)
     {
         for (size_t i = 0; i < packet.length() - 2; i++)
         {
@@ -157,88 +279,160 @@ namespace
         Serial.println();
     }
 
-    /**
-     * @brief returns wether a UDP packet contains the correct Preamble
-     *
-     * @param AsyncUDPPacket
-     * @return true||false
-     */
-    bool testPreamble(AsyncUDPPacket packet)
+    CommReceiver &receiverOf(uint32_t ip)
     {
-        for (int i = 0; i < sizeof(PREAMBLE); i++)
+        for (CommPeer &peer : peers)
         {
-            if (packet.data()[i] != PREAMBLE[i])
-            {
-                Serial.print("wrong preamble! ");
-                printPacket(packet);
-                return false;
-            }
+            if (peer.ip == ip)
+                return peer.receiver;
         }
-        return true;
+        // unknown station, replace the oldest entry
+        CommPeer &peer = peers[nextPeer++ % COMM_MAX_PEERS];
+        peer.ip = ip;
+        peer.receiver = {};
+        return peer.receiver;
     }
 
     /**
-     * @brief returns wether a AsyncUDP packet is a valid station->AGV commPck
+     * @brief drive away once the station signaled that it finished working, an IDLE while the
+     * robot is stopped at the station is enough even if the WORKING before it was lost
      *
-     * @param AsyncUDPPacket
-     * @return true||false
+     * @param status
      */
-    bool testStationCommPck(AsyncUDPPacket packet)
+    void onStationStatus(uint8_t station, uint8_t status)
     {
-        // udp packets are alyways two bytes longer then the data
-        if (packet.length() - 2 != sizeof(stationMsg))
+        if (missionMode != missions::WAITING || robotStatus != ROBOT_STOPPED_NEAR_STATION ||
+            station != slotStation)
         {
-            Serial.printf("wrong packet length: %i ", packet.length() - 2);
-            printPacket(packet);
-            return false;
+            return;
+        }
+        if (status == STATION_WORKING && !stationIsWorking)
+        {
+            LOG_INFO("station signaled start working");
+            stationIsWorking = true;
+        }
+        else if (status == STATION_IDLE)
+        {
+            LOG_INFO("station signaled finished working");
+            stationIsWorking = false;
+            missionMode = missions::DRIVING_AWAY;
         }
-        return testPreamble(packet);
-    }
-
-    /**
-     * @brief return the number of connected Clients
-     *
-     * @return number of clients
-     */
-    unsigned getNumClients()
-    {
-        // get connected IPs
-        esp_wifi_ap_get_sta_list(&wifi_sta_list);
-        tcpip_adapter_get_sta_list(&wifi_sta_list, &adapter_sta_list);
-        return adapter_sta_list.num;
     }
 
     /**
-     * @brief gets called on every received UDP packet
+     * @brief gets called on every received UDP packet,
+     * station and mission messages are acknowledged even if they are duplicates
      *
      * @param packet
      */
-    void udpOnCommPck(AsyncUDPPacket packet)
+    void udpOnCommPck(AsyncUDPPacket &packet)
     {
-        if (testStationCommPck(packet))
+        uint8_t type;
+        if (!commCheck(packet.data(), packet.length(), type))
         {
-            Serial.print("Station packet received:");
+            invalidPackets++;
+            Serial.print("invalid comm packet:");
             printPacket(packet);
-            if (missionMode == missions::WAITING && robotStatus == ROBOT_STOPPED_NEAR_STATION)
+            return;
+        }
+        commHeader header;
+        memcpy(&header, packet.data(), sizeof(header));
+        if (header.robot != ROBOT_ID && header.robot != COMM_ALL_ROBOTS)
+        {
+            return;
+        }
+        if (type == COMM_ACK)
+        {
+            commAck *ack = (commAck *)packet.data();
+            portENTER_CRITICAL(&agvSenderMux);
+            bool slotAcked = ack->ackedType != COMM_AGV_STATUS && commSenderAck(slotOutbox.sender, *ack);
+            if (ack->ackedType == COMM_AGV_STATUS)
+            {
+                commSenderAck(agvSender, *ack);
+            }
+            unsigned slotQueued = slotOutbox.count;
+            portEXIT_CRITICAL(&agvSenderMux);
+            // the next slot message waited for this ack
+            if (slotAcked && slotQueued > 0)
+            {
+                agvStatusChanged();
+            }
+            return;
+        }
+        if (type != COMM_STATION_STATUS && type != COMM_MISSION && type != COMM_SLOT_STATE &&
+            type != COMM_PARAM_SET)
+        {
+            return;
+        }
+        commAck ack;
+        commAckFor(header, ROBOT_ID, ack);
+        udp2.writeTo((uint8_t *)&ack, sizeof(ack), packet.remoteIP(), packet.remotePort());
+        if (!commReceiverAccept(receiverOf(packet.remoteIP()), header))
+        {
+            return;
+        }
+        // the type and the start of the payload
+        char command[8] = {(char)type};
+        size_t payload = commMessageSize(type) - sizeof(commHeader) - sizeof(uint16_t);
+        memcpy(command + 1, packet.data() + sizeof(commHeader), min(payload, sizeof(command) - 1));
+        blackBoxCommand(BB_SOURCE_STATION, command, sizeof(command));
+
+        if (type == COMM_MISSION)
+        {
+            missionMsg *msg = (missionMsg *)packet.data();
+            int station = (msg->station == 0xFF) ? ANY_STATION : msg->station;
+            if (!missionQueuePush(msg->mission, station))
+            {
+                LOG_WARN("mission packet rejected");
+            }
+        }
+        else if (type == COMM_PARAM_SET)
+        {
+            paramMsg *msg = (paramMsg *)packet.data();
+            if (!paramSet(msg->index, msg->value))
             {
-                if (packet.data()[0] == STATION_WORKING && !stationIsWorking)
+                LOG_WARN("param packet rejected");
+            }
+        }
+        else if (type == COMM_SLOT_STATE)
+        {
+            slotMsg *msg = (slotMsg *)packet.data();
+            // a queued state that arrives late does not take back the grant
+            bool lateQueued = msg->state == SLOT_QUEUED && reservationState == SLOT_GRANTED;
+            if (reservationState != SLOT_NONE && msg->station == slotStation && !lateQueued &&
+                (msg->state == SLOT_GRANTED || msg->state == SLOT_QUEUED))
+            {
+                reservationState = msg->state;
+                if (msg->state == SLOT_GRANTED)
                 {
-                    DEBUG_MSG("station signaled start working");
-                    stationIsWorking = true;
+                    LOG_INFO("slot granted");
                 }
-                else if (packet.data()[0] == STATION_IDLE && stationIsWorking)
+                else
                 {
-                    DEBUG_MSG("station signaled finished working");
-                    stationIsWorking = false;
-                    missionMode = missions::DRIVING_AWAY;
+                    LOG_INFO("slot queued at position %u", msg->position);
                 }
             }
         }
+        else
+        {
+            stationMsg *msg = (stationMsg *)packet.data();
+            onStationStatus(msg->station, msg->stationStatus);
+        }
     }
 }
 
 /**
- * @brief send a agvMsg to the station
+ * @brief return the number of connected Clients
+ *
+ * @return number of clients
+ */
+unsigned getNumClients()
+{
+    return numStations;
+}
+
+/**
+ * @brief broadcast a agvMsg to all stations, it is repeated with backoff until a station acknowledges it
  *
  * @param status
  * @param cargo
@@ -246,25 +440,119 @@ namespace
  */
 void sendAgvPck(uint8_t status, uint8_t cargo, uint8_t request)
 {
-    // get connected IPs
-    esp_wifi_ap_get_sta_list(&wifi_sta_list);
-    tcpip_adapter_get_sta_list(&wifi_sta_list, &adapter_sta_list);
+    if (numStations == 0)
+    {
+        return;
+    }
+    agvMsg msg;
+    msg.station = slotStation;
+    msg.robotStatus = status;
+    msg.cargo = cargo;
+    msg.request = request;
+    portENTER_CRITICAL(&agvSenderMux);
+    commSenderQueue(agvSender, (uint8_t *)&msg, sizeof(msg), COMM_AGV_STATUS, millis());
+    portEXIT_CRITICAL(&agvSenderMux);
+    retransmit(agvSender);
+}
+
+/**
+ * @brief ask the station for its slot before docking, the answer is read with stationSlot
+ *
+ * @param station tag id of the station
+ */
+void stationSlotRequest(int station)
+{
+    if (station != slotStation)
+    {
+        stationSlotRelease();
+    }
+    slotStation = station;
+    reservationState = SLOT_REQUESTED;
+    sendSlotPck(COMM_SLOT_REQUEST, station);
+}
+
+/**
+ * @brief give the slot back to the station after driving away or aborting a leg
+ *
+ */
+void stationSlotRelease()
+{
+    if (reservationState == SLOT_NONE)
+    {
+        return;
+    }
+    reservationState = SLOT_NONE;
+    sendSlotPck(COMM_SLOT_RELEASE, slotStation);
+}
+
+/**
+ * @brief state of the slot request for a station
+ *
+ * @return SLOT_NONE, SLOT_REQUESTED, SLOT_GRANTED or SLOT_QUEUED
+ */
+uint8_t stationSlot(int station)
+{
+    return station == slotStation ? reservationState : SLOT_NONE;
+}
 
-    // send udp message to evry client
-    for (int i = 0; i < adapter_sta_list.num; i++)
+/**
+ * @brief wake up udpCommTask to publish a changed robotStatus, robotCargo or robotRequest
+ *
+ */
+void agvStatusChanged()
+{
+    if (udpCommTaskHandle != NULL)
     {
-        tcpip_adapter_sta_info_t station = adapter_sta_list.sta[i];
-        String ip = (ip4addr_ntoa((ip4_addr_t *)&(station.ip)));
-        uint8_t msg[6] = {PREAMBLE[0], PREAMBLE[1], PREAMBLE[2], status, cargo, request};
-        // udp.connect((ip_addr_t*)&(station.ip),UDP_COMM_PORT);
-        // udp.write(msg,6);
-        udp2.broadcastTo(msg, 6, 7708);
-        // Serial.printf("send to %s", ip);
-        // for (size_t i = 0; i < 6; i++)
-        // {
-        //     Serial.printf(" %x", msg[i]);
-        // }
-        // Serial.println();
+        xTaskNotifyGive(udpCommTaskHandle);
+    }
+}
+
+/**
+ * @brief broadcast a telemetry record to UDP_TELEMETRY_PORT
+ *
+ * @param data the record
+ * @param length
+ */
+void sendTelemetry(const uint8_t *data, size_t length)
+{
+    broadcast(data, length, UDP_TELEMETRY_PORT);
+}
+
+void sendLog(const char *line, size_t length)
+{
+    broadcast((const uint8_t *)line, length, UDP_LOG_PORT);
+}
+
+void sendBlackBox(const uint8_t *data, size_t length)
+{
+    broadcast(data, length, UDP_BLACK_BOX_PORT);
+}
+
+/**
+ * @brief print the station protocol statistics to telnet
+ *
+ */
+void commPrint()
+{
+    portENTER_CRITICAL(&agvSenderMux);
+    CommSender senders[2] = {agvSender, slotOutbox.sender};
+    portEXIT_CRITICAL(&agvSenderMux);
+    const char *names[2] = {"agvMsg", "slotMsg"};
+    for (int i = 0; i < 2; i++)
+    {
+        telnet.printf("%s: sent=%u retransmits=%u acked=%u dropped=%u pending=%d\n", names[i],
+                      senders[i].sent, senders[i].retransmits, senders[i].acked, senders[i].dropped, senders[i].pending);
+    }
+    telnet.printf("robot %u: slot station=%u state=%u invalid received=%u\n",
+                  ROBOT_ID, slotStation, reservationState, invalidPackets);
+    for (const CommPeer &peer : peers)
+    {
+        if (peer.ip != 0)
+        {
+            const uint8_t *ip = (const uint8_t *)&peer.ip;
+            telnet.printf("station %u.%u.%u.%u: accepted=%u late=%u duplicates=%u\n", ip[0], ip[1], ip[2], ip[3],
+                          peer.receiver.accepted, peer.receiver.late, peer.receiver.duplicates);
+        }
     }
 }
 
@@ -275,6 +563,23 @@ void sendAgvPck(uint8_t status, uint8_t cargo, uint8_t request)
  */
 void wifiSetup()
 {
+    uint8_t session = esp_random();
+    commSenderInit(agvSender, ROBOT_ID, session);
+    commOutboxInit(slotOutbox, ROBOT_ID, session);
+#ifdef WIFI_FLEET_SSID
+    Serial.print("Wifi-Join-Fleet... ");
+    WiFi.onEvent(onStationEvent, ARDUINO_EVENT_WIFI_STA_GOT_IP);
+    WiFi.onEvent(onStationEvent, ARDUINO_EVENT_WIFI_STA_DISCONNECTED);
+    WiFi.mode(WIFI_STA);
+    WiFi.setAutoReconnect(true);
+    WiFi.begin(WIFI_FLEET_SSID, WIFI_FLEET_PASSWORD);
+    while (numStations == 0)
+    {
+        delay(100);
+    }
+    Serial.print("IP address: ");
+    Serial.println(WiFi.localIP());
+#else
     Serial.print("Wifi-Start-AP... ");
     WiFi.mode(WIFI_AP);
     WiFi.disconnect();
@@ -282,6 +587,10 @@ void wifiSetup()
     WiFi.softAP(WIFI_SSID, "");
     Serial.print("IP address: ");
     Serial.println(WiFi.softAPIP());
+    WiFi.onEvent(onStationEvent, ARDUINO_EVENT_WIFI_AP_STAIPASSIGNED);
+    WiFi.onEvent(onStationEvent, ARDUINO_EVENT_WIFI_AP_STADISCONNECTED);
+#endif
+    aprilTagInit();
     if (udp1.listen(UDP_PORT))
     {
         udp1.onPacket(udpOnPck);
@@ -295,6 +604,6 @@ void wifiSetup()
         Serial.println(UDP_COMM_PORT);
     }
     setupTelnet();
-    xTaskCreatePinnedToCore(udpTimeoutTask, "udpTimeoutTask", 10000, NULL, 1, NULL, 1);
-    xTaskCreatePinnedToCore(udpCommTask, "udpCommTask", 10000, NULL, 1, NULL, 1);
+    taskStart(TASK_UDP_TIMEOUT, udpTimeoutTask);
+    udpCommTaskHandle = taskStart(TASK_UDP_COMM, udpCommTask);
 }
\ No newline at end of file
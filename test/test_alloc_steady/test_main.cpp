@@ -0,0 +1,44 @@
+#include <Arduino.h>
+#include <unity.h>
+#include "defines.hpp"
+#include "alloc_counter.hpp"
+#include "firmware.hpp"
+
+/*!
+ * on target test of the steady state allocations, run with "pio test -e lolin32_lite_alloc"
+ */
+
+void setUp()
+{
+}
+
+void tearDown()
+{
+}
+
+/**
+ * @brief allocSample runs every PROFILER_PERIOD in the udp comm task and marks every allocation
+ * free task that allocated after ALLOC_SETTLE_TIME
+ *
+ */
+void test_steady_state_allocation_free()
+{
+    const char *offender = allocSteadyOffender();
+    TEST_ASSERT_NULL_MESSAGE(offender, offender);
+}
+
+void setup()
+{
+    // time for the serial monitor to attach
+    delay(2000);
+    UNITY_BEGIN();
+    firmwareStart(false);
+    // settle, then at least two samples of the steady state
+    delay(ALLOC_SETTLE_TIME + 3 * PROFILER_PERIOD);
+    RUN_TEST(test_steady_state_allocation_free);
+    UNITY_END();
+}
+
+void loop()
+{
+}
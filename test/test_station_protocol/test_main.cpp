@@ -0,0 +1,297 @@
+#include <string.h>
+#include <unity.h>
+#include "station_protocol.hpp"
+
+/*!
+ * host loopback tests of the station protocol, run with "pio test -e native"
+ */
+
+namespace
+{
+    // deterministic loss pattern of the simulated link
+    uint32_t seed = 1;
+
+    bool lost(unsigned percent)
+    {
+        seed = seed * 1103515245 + 12345;
+        return (seed >> 16) % 100 < percent;
+    }
+
+    commHeader headerOf(const uint8_t *msg)
+    {
+        commHeader header;
+        memcpy(&header, msg, sizeof(header));
+        return header;
+    }
+
+    commHeader stationHeader(uint8_t session, uint16_t sequence)
+    {
+        stationMsg msg = {};
+        commSeal((uint8_t *)&msg, sizeof(msg), COMM_STATION_STATUS, 1, session, sequence);
+        return headerOf((uint8_t *)&msg);
+    }
+}
+
+void setUp()
+{
+    seed = 1;
+}
+
+void tearDown()
+{
+}
+
+void test_crc_rejection()
+{
+    agvMsg msg = {};
+    msg.robotStatus = 2;
+    commSeal((uint8_t *)&msg, sizeof(msg), COMM_AGV_STATUS, 1, 7, 42);
+    uint8_t type = 0;
+    TEST_ASSERT_TRUE(commCheck((uint8_t *)&msg, sizeof(msg), type));
+    TEST_ASSERT_EQUAL(COMM_AGV_STATUS, type);
+
+    agvMsg corrupted = msg;
+    corrupted.robotStatus ^= 0x10;
+    TEST_ASSERT_FALSE(commCheck((uint8_t *)&corrupted, sizeof(corrupted), type));
+    corrupted = msg;
+    corrupted.crc ^= 1;
+    TEST_ASSERT_FALSE(commCheck((uint8_t *)&corrupted, sizeof(corrupted), type));
+    corrupted = msg;
+    corrupted.header.preamble[0] = 'X';
+    TEST_ASSERT_FALSE(commCheck((uint8_t *)&corrupted, sizeof(corrupted), type));
+    TEST_ASSERT_FALSE(commCheck((uint8_t *)&msg, sizeof(msg) - 1, type));
+}
+
+void test_duplicates()
+{
+    CommReceiver receiver = {};
+    TEST_ASSERT_TRUE(commReceiverAccept(receiver, stationHeader(3, 0)));
+    TEST_ASSERT_TRUE(commReceiverAccept(receiver, stationHeader(3, 1)));
+    TEST_ASSERT_FALSE(commReceiverAccept(receiver, stationHeader(3, 1)));
+    TEST_ASSERT_FALSE(commReceiverAccept(receiver, stationHeader(3, 0)));
+    TEST_ASSERT_EQUAL(2, receiver.duplicates);
+    // a new session starts over
+    TEST_ASSERT_TRUE(commReceiverAccept(receiver, stationHeader(4, 0)));
+}
+
+void test_reordering()
+{
+    CommReceiver receiver = {};
+    TEST_ASSERT_TRUE(commReceiverAccept(receiver, stationHeader(3, 65530)));
+    // 65531 .. 65533 overtaken by 65534, across the wrap of the sequence
+    TEST_ASSERT_TRUE(commReceiverAccept(receiver, stationHeader(3, 65534)));
+    TEST_ASSERT_TRUE(commReceiverAccept(receiver, stationHeader(3, 65532)));
+    TEST_ASSERT_FALSE(commReceiverAccept(receiver, stationHeader(3, 65532)));
+    TEST_ASSERT_TRUE(commReceiverAccept(receiver, stationHeader(3, 2)));
+    TEST_ASSERT_TRUE(commReceiverAccept(receiver, stationHeader(3, 65531)));
+    TEST_ASSERT_TRUE(commReceiverAccept(receiver, stationHeader(3, 65533)));
+    TEST_ASSERT_FALSE(commReceiverAccept(receiver, stationHeader(3, 65534)));
+    TEST_ASSERT_EQUAL(3, receiver.late);
+    // older than the replay window
+    TEST_ASSERT_TRUE(commReceiverAccept(receiver, stationHeader(3, 2 + COMM_REPLAY_WINDOW)));
+    TEST_ASSERT_FALSE(commReceiverAccept(receiver, stationHeader(3, 1)));
+}
+
+void test_retransmit_backoff()
+{
+    CommSender sender;
+    commSenderInit(sender, 1, 7);
+    agvMsg msg = {};
+    commSenderQueue(sender, (uint8_t *)&msg, sizeof(msg), COMM_AGV_STATUS, 1000);
+    uint32_t expected = 1000;
+    uint32_t backoff = COMM_RETRY_MIN;
+    for (unsigned i = 0; i <= COMM_MAX_RETRIES; i++)
+    {
+        TEST_ASSERT_FALSE(commSenderPoll(sender, expected - 1));
+        TEST_ASSERT_TRUE(commSenderPoll(sender, expected));
+        expected += backoff;
+        backoff = backoff * 2 > COMM_RETRY_MAX ? COMM_RETRY_MAX : backoff * 2;
+    }
+    TEST_ASSERT_EQUAL(1, sender.sent);
+    TEST_ASSERT_EQUAL(COMM_MAX_RETRIES, sender.retransmits);
+    // gives up after COMM_MAX_RETRIES retransmits
+    TEST_ASSERT_FALSE(commSenderPoll(sender, expected));
+    TEST_ASSERT_FALSE(sender.pending);
+    TEST_ASSERT_EQUAL(1, sender.dropped);
+}
+
+void test_ack_stops_retransmit()
+{
+    CommSender sender;
+    commSenderInit(sender, 1, 7);
+    agvMsg msg = {};
+    commSenderQueue(sender, (uint8_t *)&msg, sizeof(msg), COMM_AGV_STATUS, 0);
+    TEST_ASSERT_TRUE(commSenderPoll(sender, 0));
+    commAck ack;
+    commAckFor(headerOf(sender.buffer), 1, ack);
+    commAck wrong = ack;
+    wrong.header.sequence++;
+    TEST_ASSERT_FALSE(commSenderAck(sender, wrong));
+    TEST_ASSERT_TRUE(commSenderAck(sender, ack));
+    TEST_ASSERT_FALSE(commSenderPoll(sender, 10000));
+}
+
+void test_broadcast_ack_names_robot()
+{
+    missionMsg msg = {};
+    commSeal((uint8_t *)&msg, sizeof(msg), COMM_MISSION, COMM_ALL_ROBOTS, 7, 3);
+    commAck ack;
+    commAckFor(headerOf((uint8_t *)&msg), 5, ack);
+    uint8_t type;
+    TEST_ASSERT_TRUE(commCheck((uint8_t *)&ack, sizeof(ack), type));
+    TEST_ASSERT_EQUAL(5, ack.header.robot);
+    TEST_ASSERT_EQUAL(3, ack.header.sequence);
+    TEST_ASSERT_EQUAL(COMM_MISSION, ack.ackedType);
+}
+
+/**
+ * @brief moving on to another station queues the release of the old slot and the request of the new one,
+ * both have to go out in this order, acknowledged or not
+ *
+ */
+void test_outbox_release_then_request()
+{
+    CommOutbox outbox;
+    commOutboxInit(outbox, 1, 7);
+    slotMsg release = {};
+    release.station = 3;
+    slotMsg request = {};
+    request.station = 4;
+    TEST_ASSERT_TRUE(commOutboxQueue(outbox, (uint8_t *)&release, sizeof(release), COMM_SLOT_RELEASE));
+    TEST_ASSERT_TRUE(commOutboxQueue(outbox, (uint8_t *)&request, sizeof(request), COMM_SLOT_REQUEST));
+
+    TEST_ASSERT_TRUE(commOutboxPoll(outbox, 0));
+    slotMsg sent;
+    memcpy(&sent, outbox.sender.buffer, sizeof(sent));
+    TEST_ASSERT_EQUAL(COMM_SLOT_RELEASE, sent.header.type);
+    TEST_ASSERT_EQUAL(3, sent.station);
+    // the request waits for the ack of the release
+    TEST_ASSERT_FALSE(commOutboxPoll(outbox, 1));
+    commAck ack;
+    commAckFor(sent.header, 1, ack);
+    TEST_ASSERT_TRUE(commSenderAck(outbox.sender, ack));
+
+    TEST_ASSERT_TRUE(commOutboxPoll(outbox, 2));
+    memcpy(&sent, outbox.sender.buffer, sizeof(sent));
+    TEST_ASSERT_EQUAL(COMM_SLOT_REQUEST, sent.header.type);
+    TEST_ASSERT_EQUAL(4, sent.station);
+    TEST_ASSERT_EQUAL(0, outbox.sender.dropped);
+
+    // an unacknowledged release still gives way to the request once its retries ran out
+    commOutboxInit(outbox, 1, 7);
+    commOutboxQueue(outbox, (uint8_t *)&release, sizeof(release), COMM_SLOT_RELEASE);
+    commOutboxQueue(outbox, (uint8_t *)&request, sizeof(request), COMM_SLOT_REQUEST);
+    unsigned releases = 0;
+    sent.header.type = COMM_SLOT_RELEASE;
+    for (uint32_t now = 0; sent.header.type == COMM_SLOT_RELEASE && now < 100000; now++)
+    {
+        if (commOutboxPoll(outbox, now))
+        {
+            memcpy(&sent, outbox.sender.buffer, sizeof(sent));
+            releases += sent.header.type == COMM_SLOT_RELEASE;
+        }
+    }
+    TEST_ASSERT_EQUAL(COMM_MAX_RETRIES + 1, releases);
+    TEST_ASSERT_EQUAL(COMM_SLOT_REQUEST, sent.header.type);
+    TEST_ASSERT_EQUAL(1, outbox.sender.dropped);
+    TEST_ASSERT_EQUAL(2, outbox.sender.sent);
+}
+
+/**
+ * @brief every message goes over a link that drops both messages and acks,
+ * the next message is queued once the last one was acknowledged
+ *
+ */
+void test_loss_loopback()
+{
+    const unsigned messages = 50;
+    CommSender sender;
+    commSenderInit(sender, 1, 7);
+    CommReceiver receiver = {};
+    unsigned processed = 0;
+    unsigned queued = 0;
+    uint8_t lastStatus = 0xFF;
+    for (uint32_t now = 0; now < 200000 && processed < messages; now++)
+    {
+        if (!sender.pending && queued < messages)
+        {
+            agvMsg msg = {};
+            msg.robotStatus = queued++;
+            commSenderQueue(sender, (uint8_t *)&msg, sizeof(msg), COMM_AGV_STATUS, now);
+        }
+        if (!commSenderPoll(sender, now) || lost(20))
+        {
+            continue;
+        }
+        uint8_t type;
+        TEST_ASSERT_TRUE(commCheck(sender.buffer, sender.length, type));
+        commHeader header = headerOf(sender.buffer);
+        if (commReceiverAccept(receiver, header))
+        {
+            agvMsg received;
+            memcpy(&received, sender.buffer, sizeof(received));
+            TEST_ASSERT_EQUAL((lastStatus + 1) & 0xFF, received.robotStatus);
+            lastStatus = received.robotStatus;
+            processed++;
+        }
+        commAck ack;
+        commAckFor(header, 1, ack);
+        if (!lost(20))
+        {
+            commSenderAck(sender, ack);
+        }
+    }
+    TEST_ASSERT_EQUAL(messages, processed);
+    TEST_ASSERT_EQUAL(messages, sender.acked);
+    TEST_ASSERT_EQUAL(0, sender.dropped);
+    TEST_ASSERT_TRUE(sender.retransmits > 0);
+    TEST_ASSERT_TRUE(receiver.duplicates > 0);
+}
+
+/**
+ * @brief the station sends WORKING and then IDLE, the robot has to see the IDLE
+ * however the WORKING got lost or late
+ *
+ */
+void test_working_idle_handover()
+{
+    // WORKING overtaken by IDLE, both are processed, the retransmit of WORKING is a duplicate
+    CommReceiver receiver = {};
+    TEST_ASSERT_TRUE(commReceiverAccept(receiver, stationHeader(9, 10)));
+    TEST_ASSERT_TRUE(commReceiverAccept(receiver, stationHeader(9, 12)));
+    TEST_ASSERT_TRUE(commReceiverAccept(receiver, stationHeader(9, 11)));
+    TEST_ASSERT_FALSE(commReceiverAccept(receiver, stationHeader(9, 11)));
+
+    // WORKING replaced in the sender before it was acknowledged, only IDLE arrives
+    CommSender station;
+    commSenderInit(station, 1, 9);
+    stationMsg working = {};
+    working.stationStatus = 1;
+    commSenderQueue(station, (uint8_t *)&working, sizeof(working), COMM_STATION_STATUS, 0);
+    TEST_ASSERT_TRUE(commSenderPoll(station, 0));
+    stationMsg idle = {};
+    idle.stationStatus = 0;
+    commSenderQueue(station, (uint8_t *)&idle, sizeof(idle), COMM_STATION_STATUS, 5);
+    TEST_ASSERT_EQUAL(1, station.dropped);
+    TEST_ASSERT_TRUE(commSenderPoll(station, 5));
+    CommReceiver robot = {};
+    TEST_ASSERT_TRUE(commReceiverAccept(robot, headerOf(station.buffer)));
+    stationMsg received;
+    memcpy(&received, station.buffer, sizeof(received));
+    TEST_ASSERT_EQUAL(0, received.stationStatus);
+}
+
+int main(int argc, char **argv)
+{
+    UNITY_BEGIN();
+    RUN_TEST(test_crc_rejection);
+    RUN_TEST(test_duplicates);
+    RUN_TEST(test_reordering);
+    RUN_TEST(test_retransmit_backoff);
+    RUN_TEST(test_ack_stops_retransmit);
+    RUN_TEST(test_broadcast_ack_names_robot);
+    RUN_TEST(test_outbox_release_then_request);
+    RUN_TEST(test_loss_loopback);
+    RUN_TEST(test_working_idle_handover);
+    return UNITY_END();
+}
\ No newline at end of file
@@ -0,0 +1,300 @@
+/*
+ * Replay a black box recording of the robot on the host.
+ *
+ * Build from the repository root:
+ *
+ *     g++ -std=gnu++17 -Iinclude tools/black_box_replay.cpp src/follow_decision.cpp -o black_box_replay
+ *
+ * The recording is either a telnet session log with the "bb <hex>" lines of
+ * "bb dump", or the records received on UDP_BLACK_BOX_PORT after "bb send":
+ *
+ *     socat -u UDP-RECV:7712 CREATE:run.bb
+ *
+ * Every follow decision in the recording is made again with followDecide on the
+ * recorded inputs and parameters and compared with the decision of the robot.
+ * The recording starts with the parameters and inputs as of its oldest record,
+ * decisions whose inputs are older than that cannot be checked.
+ *
+ *     black_box_replay [--print] <recording>
+ *
+ * --print lists every record for a post-mortem. The exit status is 1 if a
+ * decision differs.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <deque>
+#include <string>
+#include <vector>
+#include "black_box.hpp"
+
+Params params;
+
+namespace
+{
+    const char *stepperStates[] = {"stopped", "right", "left", "straight", "back"};
+    const char *sources[] = {"telnet", "station"};
+
+#define PARAM_NAME(field, type, name, def, min, max, help) name,
+    const char *paramNames[] = {PARAM_TABLE(PARAM_NAME)};
+#undef PARAM_NAME
+    const unsigned PARAM_COUNT = sizeof(paramNames) / sizeof(paramNames[0]);
+
+    void setParam(unsigned index, float value)
+    {
+        unsigned i = 0;
+#define PARAM_SET(field, type, name, def, min, max, help) \
+    if (i++ == index)                                     \
+        params.field = (type)value;
+        PARAM_TABLE(PARAM_SET)
+#undef PARAM_SET
+    }
+
+    void resetParams()
+    {
+#define PARAM_DEFAULT(field, type, name, def, min, max, help) params.field = (type)def;
+        PARAM_TABLE(PARAM_DEFAULT)
+#undef PARAM_DEFAULT
+    }
+
+    int hexValue(char c)
+    {
+        if (c >= '0' && c <= '9')
+            return c - '0';
+        if (c >= 'a' && c <= 'f')
+            return c - 'a' + 10;
+        if (c >= 'A' && c <= 'F')
+            return c - 'A' + 10;
+        return -1;
+    }
+
+    /**
+     * @brief read the "bb <hex>" lines of a telnet log, or the file as raw records if it has none
+     *
+     */
+    bool readRecording(const char *path, std::vector<blackBoxRecord> &records)
+    {
+        FILE *f = fopen(path, "rb");
+        if (f == NULL)
+        {
+            perror(path);
+            return false;
+        }
+        std::string data;
+        char buffer[4096];
+        size_t n;
+        while ((n = fread(buffer, 1, sizeof(buffer), f)) > 0)
+        {
+            data.append(buffer, n);
+        }
+        fclose(f);
+
+        size_t position = 0;
+        while ((position = data.find("bb ", position)) != std::string::npos)
+        {
+            position += 3;
+            uint8_t bytes[sizeof(blackBoxRecord)];
+            size_t i = 0;
+            for (; i < sizeof(bytes) && position + 2 * i + 1 < data.size(); i++)
+            {
+                int high = hexValue(data[position + 2 * i]);
+                int low = hexValue(data[position + 2 * i + 1]);
+                if (high < 0 || low < 0)
+                    break;
+                bytes[i] = high << 4 | low;
+            }
+            if (i == sizeof(bytes))
+            {
+                blackBoxRecord r;
+                memcpy(&r, bytes, sizeof(r));
+                records.push_back(r);
+            }
+        }
+        if (!records.empty())
+        {
+            return true;
+        }
+        if (data.size() % sizeof(blackBoxRecord) != 0)
+        {
+            fprintf(stderr, "%s: neither bb lines nor whole records\n", path);
+            return false;
+        }
+        records.resize(data.size() / sizeof(blackBoxRecord));
+        memcpy(records.data(), data.data(), data.size());
+        return true;
+    }
+
+    FollowState stateFromFlags(uint8_t flags)
+    {
+        return FollowState{(flags & 1) != 0, (flags & 2) != 0};
+    }
+
+    void printRecord(const blackBoxRecord &r)
+    {
+        printf("%10.3f %5u ", r.time / 1000.0, r.sequence);
+        switch (r.type)
+        {
+        case BB_TAG:
+            printf("tag      center=%u size=%.2f id=%d\n", r.tag.center, r.tag.size, r.tag.id);
+            break;
+        case BB_US:
+            printf("us       sensor=%u distance=%.2f\n", r.arg, r.distance);
+            break;
+        case BB_COMMAND:
+            if (r.arg == BB_SOURCE_TELNET)
+            {
+                printf("command  %s \"%.8s\"\n", sources[0], r.command);
+            }
+            else
+            {
+                printf("command  %s type=%u payload=", sources[1], (uint8_t)r.command[0]);
+                for (int i = 1; i < 8; i++)
+                    printf("%02x", (uint8_t)r.command[i]);
+                printf("\n");
+            }
+            break;
+        case BB_STEPPER:
+            printf("stepper  %s steps=%d\n", r.arg < 5 ? stepperStates[r.arg] : "?", r.steps);
+            break;
+        case BB_PARAM:
+            printf("param    %s %g -> %g\n", r.arg < PARAM_COUNT ? paramNames[r.arg] : "?",
+                   r.param.oldValue, r.param.newValue);
+            break;
+        case BB_DECISION:
+            printf("decision %s inputs=%u lockedOn=%d->%d innerCircle=%d->%d stop=%d\n",
+                   followActionName(r.arg), r.decision.inputs, r.decision.before & 1, r.decision.after & 1,
+                   r.decision.before >> 1 & 1, r.decision.after >> 1 & 1, r.decision.stop);
+            break;
+        default:
+            printf("unknown  type=%u\n", r.type);
+        }
+    }
+
+    struct Snapshot
+    {
+        uint16_t sequence;
+        ControlInputs inputs;
+        // bit 0 tag, bit 1 + n ultrasonic sensor n seen in the recording
+        unsigned known;
+    };
+    const unsigned ALL_KNOWN = (1 << (NUM_SENSORS + 1)) - 1;
+    // decisions can only refer to inputs recorded shortly before
+    const size_t HISTORY = 256;
+}
+
+int main(int argc, char **argv)
+{
+    bool print = false;
+    const char *path = NULL;
+    for (int i = 1; i < argc; i++)
+    {
+        if (strcmp(argv[i], "--print") == 0)
+            print = true;
+        else
+            path = argv[i];
+    }
+    if (path == NULL)
+    {
+        fprintf(stderr, "usage: %s [--print] <recording>\n", argv[0]);
+        return 2;
+    }
+    std::vector<blackBoxRecord> records;
+    if (!readRecording(path, records))
+    {
+        return 2;
+    }
+
+    resetParams();
+    Snapshot current = {};
+    std::deque<Snapshot> history;
+    unsigned checked = 0, mismatches = 0, unverifiable = 0, gaps = 0;
+    bool leading = true;
+    unsigned startInputs = 0;
+    uint16_t lastSequence = 0;
+
+    for (const blackBoxRecord &r : records)
+    {
+        if (print)
+        {
+            printRecord(r);
+        }
+        // the parameter values at the start of the recording come first and carry no sequence
+        if (leading && r.type == BB_PARAM)
+        {
+            setParam(r.arg, r.param.newValue);
+            continue;
+        }
+        // then the inputs as of the oldest record, all with the sequence of the last input before it
+        bool input = r.type == BB_TAG || r.type == BB_US;
+        if (leading && input && (startInputs == 0 || r.sequence == lastSequence))
+        {
+            startInputs++;
+        }
+        else
+        {
+            if (!leading && r.sequence != (uint16_t)(lastSequence + 1))
+            {
+                gaps++;
+            }
+            leading = false;
+        }
+        lastSequence = r.sequence;
+
+        switch (r.type)
+        {
+        case BB_PARAM:
+            setParam(r.arg, r.param.newValue);
+            break;
+        case BB_TAG:
+        case BB_US:
+            if (r.type == BB_TAG)
+            {
+                current.inputs.tagCenter = r.tag.center;
+                current.inputs.tagSize = r.tag.size;
+                current.known |= 1;
+            }
+            else if (r.arg < NUM_SENSORS)
+            {
+                current.inputs.us[r.arg] = r.distance;
+                current.known |= 1 << (r.arg + 1);
+            }
+            current.sequence = r.sequence;
+            history.push_back(current);
+            if (history.size() > HISTORY)
+                history.pop_front();
+            break;
+        case BB_DECISION:
+        {
+            const Snapshot *seen = NULL;
+            for (const Snapshot &s : history)
+            {
+                if (s.sequence == r.decision.inputs)
+                    seen = &s;
+            }
+            if (seen == NULL || seen->known != ALL_KNOWN)
+            {
+                unverifiable++;
+                break;
+            }
+            FollowState state = stateFromFlags(r.decision.before);
+            FollowDecision decision = followDecide(seen->inputs, state);
+            checked++;
+            if (decision.action != r.arg || decision.stop != (r.decision.stop != 0) ||
+                blackBoxStateFlags(state) != r.decision.after)
+            {
+                mismatches++;
+                printf("MISMATCH at %.3fs sequence %u: robot %s stop=%d after=%u, replay %s stop=%d after=%u\n",
+                       r.time / 1000.0, r.sequence, followActionName(r.arg), r.decision.stop, r.decision.after,
+                       followActionName(decision.action), decision.stop, blackBoxStateFlags(state));
+            }
+            break;
+        }
+        default:
+            break;
+        }
+    }
+
+    printf("%zu records, %u gaps, %u decisions checked, %u differ, %u unverifiable\n",
+           records.size(), gaps, checked, mismatches, unverifiable);
+    return mismatches ? 1 : 0;
+}
\ No newline at end of file
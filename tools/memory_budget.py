@@ -0,0 +1,124 @@
+#!/usr/bin/env python3
+"""Report the static RAM of the firmware per subsystem and check it against the budgets.
+
+platformio.ini runs this script after linking (extra_scripts), the build fails
+when a subsystem or the whole image uses more static RAM than BUDGETS allows.
+It can also be run on a build directory by hand:
+
+    tools/memory_budget.py .pio/build/lolin32_lite --nm xtensa-esp32-elf-nm
+
+A subsystem is one source file of src/, its static RAM is the sum of the
+.data and .bss symbols of its object file. The task stacks are static arrays
+of tasks.cpp (include/tasks.hpp), so they are counted there. "other" is the
+framework and the libraries: the DRAM sections of the image minus src/.
+
+The heap is not known at build time, the firmware checks the heap low water
+mark against HEAP_MIN_FREE at runtime ("mem" over telnet).
+"""
+import argparse
+import os
+import subprocess
+import sys
+
+# bytes of static RAM per source file, files without an entry get DEFAULT_BUDGET
+BUDGETS = {
+    "april_tag": 4 * 1024,
+    "black_box": 36 * 1024,
+    "route_planner": 40 * 1024,
+    "tasks": 40 * 1024,
+    "log": 16 * 1024,
+    "trace": 10 * 1024,
+    "task_profiler": 4 * 1024,
+}
+DEFAULT_BUDGET = 2 * 1024
+# all DRAM sections of the image including the framework, the rest of the 320 KB is heap
+IMAGE_BUDGET = 160 * 1024
+
+STATIC_TYPES = set("bBdDsSvV")
+
+
+def symbol_sizes(nm, path):
+    """Sum of the sizes of the data and bss symbols of an object file."""
+    output = subprocess.run([nm, "-S", path], check=True, capture_output=True, text=True).stdout
+    total = 0
+    for line in output.splitlines():
+        fields = line.split()
+        if len(fields) == 4 and fields[2] in STATIC_TYPES:
+            total += int(fields[1], 16)
+    return total
+
+
+def image_dram(size, elf):
+    """Size of the DRAM sections of the linked image."""
+    output = subprocess.run([size, "-A", elf], check=True, capture_output=True, text=True).stdout
+    total = 0
+    for line in output.splitlines():
+        fields = line.split()
+        if len(fields) >= 2 and fields[0].startswith(".dram0"):
+            total += int(fields[1])
+    return total
+
+
+def report(build_dir, nm, size):
+    """Print the report, returns the number of exceeded budgets."""
+    src = os.path.join(build_dir, "src")
+    subsystems = []
+    for name in sorted(os.listdir(src)):
+        if name.endswith(".o"):
+            subsystem = name.split(".")[0]
+            subsystems.append((subsystem, symbol_sizes(nm, os.path.join(src, name))))
+
+    exceeded = 0
+    print("static RAM budget")
+    print("%-20s %8s %8s" % ("subsystem", "bytes", "budget"))
+    for subsystem, used in subsystems:
+        budget = BUDGETS.get(subsystem, DEFAULT_BUDGET)
+        over = used > budget
+        exceeded += over
+        print("%-20s %8d %8d%s" % (subsystem, used, budget, "  EXCEEDED" if over else ""))
+    firmware = sum(used for _, used in subsystems)
+
+    elf = os.path.join(build_dir, "firmware.elf")
+    if os.path.exists(elf):
+        image = image_dram(size, elf)
+        over = image > IMAGE_BUDGET
+        exceeded += over
+        print("%-20s %8d" % ("other", max(image - firmware, 0)))
+        print("%-20s %8d %8d%s" % ("image", image, IMAGE_BUDGET, "  EXCEEDED" if over else ""))
+    else:
+        print("%-20s %8d" % ("src total", firmware))
+    return exceeded
+
+
+def tool(env, name):
+    """The binutils tool of the toolchain that compiles the firmware."""
+    cc = env.subst("$CC")
+    return cc[: -len("gcc")] + name if cc.endswith("gcc") else name
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("build_dir", help="PlatformIO build directory with src/*.o and firmware.elf")
+    parser.add_argument("--nm", default="nm", help="nm of the toolchain")
+    parser.add_argument("--size", default="size", help="size of the toolchain")
+    args = parser.parse_args()
+    exceeded = report(args.build_dir, args.nm, args.size)
+    if exceeded:
+        print("%d memory budgets exceeded" % exceeded, file=sys.stderr)
+    return 1 if exceeded else 0
+
+
+try:
+    Import("env")  # noqa: F821, defined when PlatformIO runs the script
+except NameError:
+    if __name__ == "__main__":
+        sys.exit(main())
+else:
+
+    def check_budget(source, target, env):
+        exceeded = report(env.subst("$BUILD_DIR"), tool(env, "nm"), tool(env, "size"))
+        if exceeded:
+            print("%d memory budgets exceeded" % exceeded, file=sys.stderr)
+        return 1 if exceeded else 0
+
+    env.AddPostAction("$BUILD_DIR/${PROGNAME}.elf", check_budget)  # noqa: F821
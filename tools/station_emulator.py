@@ -0,0 +1,426 @@
+#!/usr/bin/env python3
+"""Emulate the stations of the cell for end-to-end mission timing.
+
+Speaks the station side of the protocol in include/station_protocol.hpp on
+UDP_COMM_PORT: acknowledges every robot message, hands out the station slots
+in request order and answers a docked robot with STATION_WORKING followed by
+STATION_IDLE after the working duration. Connect to the AGV access point and
+run for example
+
+    tools/station_emulator.py --stations 1,2,3 --working 3 --working 2=8 \\
+        --mission get_gummy:1 --mission deliver:2 --csv missions.csv
+
+Every station visit is logged with the host time of
+    request   the robot asked for the slot
+    granted   the slot was granted (later than request if the robot queued)
+    arrived   the robot reported it stopped at the station
+    working   the station sent STATION_WORKING
+    idle      the station sent STATION_IDLE
+    left      the robot released the slot or reported another status
+and appended to the CSV file when the robot left.
+
+--loss and --reorder inject packet loss and delayed (reordered) delivery in
+both directions to exercise the retransmission and duplicate detection. All
+simulated stations share one session and sequence space towards a robot, as
+the robot tells senders apart by their ip.
+"""
+import argparse
+import asyncio
+import csv
+import random
+import signal
+import struct
+import sys
+import time
+
+PREAMBLE = b"AGV"
+VERSION = 3
+HEADER = struct.Struct("<3sBBBBH")
+CRC = struct.Struct("<H")
+
+AGV_STATUS, STATION_STATUS, MISSION, ACK, SLOT_REQUEST, SLOT_RELEASE, SLOT_STATE, PARAM_SET = range(1, 9)
+PAYLOADS = {
+    AGV_STATUS: struct.Struct("<BBBB"),  # station, robotStatus, cargo, request
+    STATION_STATUS: struct.Struct("<BB"),  # station, stationStatus
+    MISSION: struct.Struct("<BB"),  # mission, station
+    ACK: struct.Struct("<B"),  # ackedType
+    SLOT_REQUEST: struct.Struct("<BBB"),  # station, state, position
+    SLOT_RELEASE: struct.Struct("<BBB"),
+    SLOT_STATE: struct.Struct("<BBB"),
+    PARAM_SET: struct.Struct("<Bf"),  # index, value
+}
+ROBOT_STOPPED_NEAR_STATION = 2
+STATION_IDLE, STATION_WORKING = 0, 1
+SLOT_GRANTED, SLOT_QUEUED = 2, 3
+MISSIONS = {"deliver": 1, "get_gummy": 2, "get_cotton": 3, "get_ball": 4}
+ANY_STATION = 0xFF
+
+RETRY_MIN = 0.04  # COMM_RETRY_MIN, doubles up to COMM_RETRY_MAX
+RETRY_MAX = 0.64
+MAX_RETRIES = 8
+REPLAY_WINDOW = 32  # COMM_REPLAY_WINDOW
+
+EVENTS = ["request", "granted", "arrived", "working", "idle", "left"]
+
+
+def crc16(data):
+    """CRC-16/CCITT-FALSE as commCrc"""
+    crc = 0xFFFF
+    for byte in data:
+        crc ^= byte << 8
+        for _ in range(8):
+            crc = ((crc << 1) ^ 0x1021) if crc & 0x8000 else crc << 1
+            crc &= 0xFFFF
+    return crc
+
+
+def seal(msg_type, robot, session, sequence, *fields):
+    body = HEADER.pack(PREAMBLE, VERSION, msg_type, robot, session, sequence) + PAYLOADS[msg_type].pack(*fields)
+    return body + CRC.pack(crc16(body))
+
+
+def parse(data):
+    """Returns (type, robot, session, sequence, fields) of a valid message or None, like commCheck."""
+    if len(data) < HEADER.size:
+        return None
+    preamble, version, msg_type, robot, session, sequence = HEADER.unpack_from(data)
+    if preamble != PREAMBLE or version != VERSION or msg_type not in PAYLOADS:
+        return None
+    size = HEADER.size + PAYLOADS[msg_type].size + CRC.size
+    if len(data) < size or CRC.unpack_from(data, size - CRC.size)[0] != crc16(data[:size - CRC.size]):
+        return None
+    return msg_type, robot, session, sequence, PAYLOADS[msg_type].unpack_from(data, HEADER.size)
+
+
+class Robot:
+    """Per robot state: address, duplicate detection (CommReceiver) and the reliable sender (CommSender)."""
+
+    def __init__(self, robot_id, address):
+        self.id = robot_id
+        self.address = address
+        self.session = None
+        self.last_sequence = None
+        # bit n is set if last_sequence - n was accepted
+        self.window = 0
+        self.next_sequence = 0
+        # key -> [message, sequence, type, backoff, retries, timer]
+        self.pending = {}
+        self.station = None
+        self.status = None
+        # station -> time of the first slot request of the current visit
+        self.requested = {}
+        self.missions = []
+
+    def accept(self, session, sequence):
+        """Like commReceiverAccept: a late message is accepted once within REPLAY_WINDOW of the newest one."""
+        if self.session != session:
+            self.session = session
+            self.last_sequence = sequence
+            self.window = 1
+            return True
+        ahead = (sequence - self.last_sequence) & 0xFFFF
+        if 0 < ahead < 0x8000:
+            self.window = ((self.window << ahead) | 1) & 0xFFFFFFFF if ahead < REPLAY_WINDOW else 1
+            self.last_sequence = sequence
+            return True
+        age = (self.last_sequence - sequence) & 0xFFFF
+        if age >= REPLAY_WINDOW or self.window & (1 << age):
+            return False
+        self.window |= 1 << age
+        return True
+
+
+class Visit:
+    def __init__(self, station, robot):
+        self.station = station
+        self.robot = robot
+        self.times = {}
+
+
+class Emulator(asyncio.DatagramProtocol):
+    def __init__(self, args):
+        self.args = args
+        self.start = time.monotonic()
+        self.session = random.randrange(256)
+        self.robots = {}
+        self.stations = {s: {"holder": None, "queue": [], "status": STATION_IDLE, "visit": None}
+                         for s in args.stations}
+        self.visits = []
+        self.stats = {"received": 0, "invalid": 0, "duplicates": 0, "sent": 0, "retransmits": 0,
+                      "replaced": 0, "unacked": 0, "lost": 0, "reordered": 0}
+        self.transport = None
+        self.csv = None
+        if args.csv:
+            self.csv_file = open(args.csv, "a", newline="")
+            self.csv = csv.writer(self.csv_file)
+            if self.csv_file.tell() == 0:
+                self.csv.writerow(["station", "robot"] + EVENTS + ["queued_ms", "handover_ms", "departure_ms"])
+
+    def now(self):
+        return time.monotonic() - self.start
+
+    def log(self, text):
+        print("%9.3f %s" % (self.now(), text), flush=True)
+
+    # link with loss and reorder injection
+
+    def impaired(self, action):
+        if random.random() < self.args.loss:
+            self.stats["lost"] += 1
+            return
+        if random.random() < self.args.reorder:
+            self.stats["reordered"] += 1
+            asyncio.get_running_loop().call_later(random.uniform(0.01, self.args.reorder_delay), action)
+            return
+        action()
+
+    def transmit(self, data, address):
+        self.impaired(lambda: self.transport.sendto(data, address))
+
+    def connection_made(self, transport):
+        self.transport = transport
+        self.log("listening on port %d, stations %s, session %d" %
+                 (self.args.port, ",".join(map(str, self.args.stations)), self.session))
+
+    def datagram_received(self, data, address):
+        self.impaired(lambda: self.handle(data, address))
+
+    # reliable sending to a robot
+
+    def send(self, robot, key, msg_type, *fields):
+        """Send the latest message for key until the robot acknowledges it, an older one is replaced."""
+        old = robot.pending.pop(key, None)
+        if old:
+            old[5].cancel()
+            self.stats["replaced"] += 1
+        sequence = robot.next_sequence
+        robot.next_sequence = (sequence + 1) & 0xFFFF
+        entry = [seal(msg_type, robot.id, self.session, sequence, *fields), sequence, msg_type, RETRY_MIN, 0, None]
+        robot.pending[key] = entry
+        self.stats["sent"] += 1
+        self.retransmit(robot, key)
+
+    def retransmit(self, robot, key):
+        entry = robot.pending.get(key)
+        if entry is None:
+            return
+        if entry[4] > MAX_RETRIES:
+            del robot.pending[key]
+            self.stats["unacked"] += 1
+            self.log("robot %d: no ack for %s, giving up" % (robot.id, key))
+            return
+        if entry[4] > 0:
+            self.stats["retransmits"] += 1
+        entry[4] += 1
+        self.transmit(entry[0], robot.address)
+        entry[5] = asyncio.get_running_loop().call_later(entry[3], self.retransmit, robot, key)
+        entry[3] = min(entry[3] * 2, RETRY_MAX)
+
+    def acked(self, robot, session, sequence, acked_type):
+        if session != self.session:
+            return
+        for key, entry in list(robot.pending.items()):
+            if entry[1] == sequence and entry[2] == acked_type:
+                entry[5].cancel()
+                del robot.pending[key]
+                if key[0] == "mission":
+                    self.send_next_mission(robot)
+
+    # station behaviour
+
+    def handle(self, data, address):
+        message = parse(data)
+        if message is None:
+            self.stats["invalid"] += 1
+            return
+        msg_type, robot_id, session, sequence, fields = message
+        if msg_type not in (AGV_STATUS, SLOT_REQUEST, SLOT_RELEASE, ACK):
+            return
+        self.stats["received"] += 1
+        robot = self.robots.get(robot_id)
+        if robot is None:
+            robot = self.robots[robot_id] = Robot(robot_id, address)
+            self.log("robot %d at %s:%d" % (robot_id, address[0], address[1]))
+            self.send_missions(robot)
+        robot.address = address
+        if msg_type == ACK:
+            self.acked(robot, session, sequence, fields[0])
+            return
+        self.transport.sendto(seal(ACK, robot_id, session, sequence, msg_type), address)
+        if not robot.accept(session, sequence):
+            self.stats["duplicates"] += 1
+            return
+        if msg_type == AGV_STATUS:
+            self.on_status(robot, *fields)
+        elif msg_type == SLOT_REQUEST:
+            self.on_slot_request(robot, fields[0])
+        else:
+            self.on_slot_release(robot, fields[0])
+
+    def visit_event(self, station, robot, event):
+        state = self.stations[station]
+        visit = state["visit"]
+        if visit is None or visit.robot != robot.id or event in visit.times:
+            return
+        visit.times[event] = self.now()
+        self.log("station %d robot %d %s" % (station, robot.id, event))
+        if event == "left":
+            self.finish(visit)
+            state["visit"] = None
+
+    def grant(self, station, robot):
+        state = self.stations[station]
+        state["holder"] = robot.id
+        if state["visit"] is None or state["visit"].robot != robot.id:
+            state["visit"] = Visit(station, robot.id)
+            state["visit"].times["request"] = robot.requested.get(station, self.now())
+        self.send(robot, ("slot", station), SLOT_STATE, station, SLOT_GRANTED, 0)
+        self.visit_event(station, robot, "granted")
+
+    def on_slot_request(self, robot, station):
+        if station not in self.stations:
+            return
+        state = self.stations[station]
+        robot.requested.setdefault(station, self.now())
+        if state["holder"] in (None, robot.id):
+            self.log("station %d robot %d request" % (station, robot.id))
+            self.grant(station, robot)
+            return
+        if robot.id not in state["queue"]:
+            state["queue"].append(robot.id)
+            self.log("station %d robot %d request, queued behind robot %d" % (station, robot.id, state["holder"]))
+        position = state["queue"].index(robot.id) + 1
+        self.send(robot, ("slot", station), SLOT_STATE, station, SLOT_QUEUED, position)
+
+    def on_slot_release(self, robot, station):
+        if station not in self.stations:
+            return
+        state = self.stations[station]
+        if robot.id in state["queue"]:
+            state["queue"].remove(robot.id)
+        if state["holder"] != robot.id:
+            return
+        self.visit_event(station, robot, "left")
+        robot.requested.pop(station, None)
+        state["holder"] = None
+        state["status"] = STATION_IDLE
+        if state["queue"]:
+            self.grant(station, self.robots[state["queue"].pop(0)])
+            for position, waiting in enumerate(state["queue"], 1):
+                self.send(self.robots[waiting], ("slot", station), SLOT_STATE, station, SLOT_QUEUED, position)
+
+    def on_status(self, robot, station, status, cargo, request):
+        previous = robot.status
+        robot.status = status
+        robot.station = station
+        if station not in self.stations or self.stations[station]["holder"] != robot.id:
+            return
+        visit = self.stations[station]["visit"]
+        if visit is None:
+            return
+        if status == ROBOT_STOPPED_NEAR_STATION and previous != status and "arrived" not in visit.times:
+            self.visit_event(station, robot, "arrived")
+            loop = asyncio.get_running_loop()
+            loop.call_later(self.args.start_delay, self.set_status, station, robot, STATION_WORKING)
+            loop.call_later(self.args.start_delay + self.working(station), self.set_status, station, robot,
+                            STATION_IDLE)
+        elif previous == ROBOT_STOPPED_NEAR_STATION and status != previous:
+            self.visit_event(station, robot, "left")
+
+    def working(self, station):
+        return self.args.working_per_station.get(station, self.args.working)
+
+    def set_status(self, station, robot, status):
+        state = self.stations[station]
+        visit = state["visit"]
+        if visit is None or visit.robot != robot.id or "left" in visit.times:
+            return
+        state["status"] = status
+        self.send(robot, ("status", station), STATION_STATUS, station, status)
+        self.visit_event(station, robot, "working" if status == STATION_WORKING else "idle")
+
+    def send_missions(self, robot):
+        robot.missions = list(self.args.missions)
+        self.send_next_mission(robot)
+
+    def send_next_mission(self, robot):
+        """One mission at a time so the legs are queued in order."""
+        if robot.missions:
+            self.send(robot, ("mission",), MISSION, *robot.missions.pop(0))
+
+    def finish(self, visit):
+        self.visits.append(visit)
+        if self.csv is None:
+            return
+        t = visit.times
+
+        def ms(a, b):
+            return "%.0f" % ((t[b] - t[a]) * 1000) if a in t and b in t else ""
+
+        self.csv.writerow([visit.station, visit.robot] + ["%.3f" % t[e] if e in t else "" for e in EVENTS] +
+                          [ms("request", "granted"), ms("arrived", "working"), ms("idle", "left")])
+        self.csv_file.flush()
+
+    def summary(self):
+        print("packets: " + " ".join("%s=%d" % item for item in self.stats.items()), file=sys.stderr)
+        for a, b, name in [("request", "arrived", "approach"), ("arrived", "working", "handover"),
+                           ("idle", "left", "departure")]:
+            spans = [v.times[b] - v.times[a] for v in self.visits if a in v.times and b in v.times]
+            if spans:
+                print("%-9s n=%d mean=%.0fms min=%.0fms max=%.0fms" %
+                      (name, len(spans), 1000 * sum(spans) / len(spans), 1000 * min(spans), 1000 * max(spans)),
+                      file=sys.stderr)
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("--port", type=int, default=7708, help="UDP_COMM_PORT")
+    parser.add_argument("--stations", default="1,2,3", help="comma separated tag ids of the simulated stations")
+    parser.add_argument("--working", action="append", default=[],
+                        help="working duration in s, or station=s for one station, default 3")
+    parser.add_argument("--start-delay", type=float, default=0.5, help="s from arrival to STATION_WORKING")
+    parser.add_argument("--mission", action="append", default=[],
+                        help="queue mission:station on every robot that shows up, station any for ANY_STATION")
+    parser.add_argument("--loss", type=float, default=0.0, help="probability to drop a packet")
+    parser.add_argument("--reorder", type=float, default=0.0, help="probability to delay a packet")
+    parser.add_argument("--reorder-delay", type=float, default=0.3, help="maximum delay of a reordered packet in s")
+    parser.add_argument("--csv", help="append one row per station visit")
+    parser.add_argument("--seed", type=int, help="random seed of the loss and reorder injection")
+    args = parser.parse_args()
+
+    args.stations = [int(s) for s in args.stations.split(",")]
+    args.working_per_station = {}
+    working = 3.0
+    for w in args.working:
+        if "=" in w:
+            station, seconds = w.split("=")
+            args.working_per_station[int(station)] = float(seconds)
+        else:
+            working = float(w)
+    args.working = working
+    missions = []
+    for m in args.mission:
+        name, _, station = m.partition(":")
+        if name not in MISSIONS:
+            parser.error("unknown mission %s, one of %s" % (name, ", ".join(MISSIONS)))
+        missions.append((MISSIONS[name], ANY_STATION if station in ("", "any") else int(station)))
+    args.missions = missions
+    if args.seed is not None:
+        random.seed(args.seed)
+
+    async def run():
+        loop = asyncio.get_running_loop()
+        stop = asyncio.Event()
+        loop.add_signal_handler(signal.SIGINT, stop.set)
+        loop.add_signal_handler(signal.SIGTERM, stop.set)
+        transport, emulator = await loop.create_datagram_endpoint(
+            lambda: Emulator(args), local_addr=("0.0.0.0", args.port), allow_broadcast=True)
+        await stop.wait()
+        transport.close()
+        emulator.summary()
+
+    asyncio.run(run())
+
+
+if __name__ == "__main__":
+    main()
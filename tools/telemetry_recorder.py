@@ -0,0 +1,134 @@
+#!/usr/bin/env python3
+"""Record and decode the binary telemetry stream of the robot.
+
+The robot broadcasts telemetryState records (include/telemetry.hpp) on
+UDP_TELEMETRY_PORT. Connect to the AGV access point and run
+
+    tools/telemetry_recorder.py --csv run.csv --raw run.bin
+
+to write one CSV row per record until Ctrl-C. The raw file keeps the packets
+with their receive time, so a run can be decoded again later with
+
+    tools/telemetry_recorder.py --input run.bin --csv run.csv
+
+State records only carry the fields that changed, the decoder forward fills
+the others. After a lost record (sequence gap) the rows are dropped until the
+next record that carries every field, which is at least every
+TELEMETRY_KEYFRAME_INTERVAL records. Profile records are ignored.
+"""
+import argparse
+import csv
+import socket
+import struct
+import sys
+import time
+
+PREAMBLE = b"AGV"
+TELEMETRY_STATE = 2
+HEADER = struct.Struct("<3sBIHB")
+RAW_HEADER = struct.Struct("<dH")
+
+# (mask bit, struct, column names) in the order of telemetryStateField
+FIELDS = [
+    (1 << 0, struct.Struct("<5H"), ["us_left_mm", "us_frontl_mm", "us_frontc_mm", "us_frontr_mm", "us_right_mm"]),
+    (1 << 1, struct.Struct("<HHH"), ["tag_center", "tag_size_centi", "tag_frame"]),
+    (1 << 2, struct.Struct("<BIi"), ["stepper_state", "stepper_steps", "heading_steps"]),
+    (1 << 3, struct.Struct("<hhh"), ["x_mm", "y_mm", "heading_mrad"]),
+    (1 << 4, struct.Struct("<BBBBBB"), ["mission", "robot_status", "cargo", "request", "station", "queued"]),
+    (1 << 5, struct.Struct("<II"), ["loop_period_us", "loop_misses"]),
+]
+ALL_FIELDS = (1 << len(FIELDS)) - 1
+COLUMNS = ["host_time", "uptime_ms", "sequence"] + [name for _, _, names in FIELDS for name in names]
+
+
+class Decoder:
+    def __init__(self):
+        self.values = {}
+        self.sequence = None
+        self.synced = False
+        self.lost = 0
+
+    def decode(self, host_time, packet):
+        """Returns a CSV row for a state record or None."""
+        if len(packet) < HEADER.size or packet[:3] != PREAMBLE or packet[3] != TELEMETRY_STATE:
+            return None
+        _, _, uptime, sequence, fields = HEADER.unpack_from(packet)
+        if self.sequence is not None and sequence != (self.sequence + 1) & 0xFFFF:
+            self.lost += (sequence - self.sequence - 1) & 0xFFFF
+            self.synced = False
+        self.sequence = sequence
+        offset = HEADER.size
+        for bit, layout, names in FIELDS:
+            if fields & bit:
+                self.values.update(zip(names, layout.unpack_from(packet, offset)))
+                offset += layout.size
+        if fields == ALL_FIELDS:
+            self.synced = True
+        if not self.synced:
+            return None
+        row = {"host_time": "%.3f" % host_time, "uptime_ms": uptime, "sequence": sequence}
+        row.update(self.values)
+        return row
+
+
+def read_raw(path):
+    with open(path, "rb") as f:
+        while True:
+            header = f.read(RAW_HEADER.size)
+            if len(header) < RAW_HEADER.size:
+                return
+            host_time, length = RAW_HEADER.unpack(header)
+            yield host_time, f.read(length)
+
+
+def receive(port, raw, duration):
+    sock = socket.socket(socket.AF_INET, socket.SOCK_DGRAM)
+    sock.setsockopt(socket.SOL_SOCKET, socket.SO_REUSEADDR, 1)
+    sock.bind(("", port))
+    sock.settimeout(0.5)
+    end = time.time() + duration if duration else None
+    while end is None or time.time() < end:
+        try:
+            packet = sock.recv(2048)
+        except socket.timeout:
+            continue
+        host_time = time.time()
+        if raw:
+            raw.write(RAW_HEADER.pack(host_time, len(packet)) + packet)
+        yield host_time, packet
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("--csv", help="decoded output, default stdout")
+    parser.add_argument("--raw", help="also store the received packets")
+    parser.add_argument("--input", help="decode a raw file instead of listening")
+    parser.add_argument("--port", type=int, default=7710, help="UDP_TELEMETRY_PORT")
+    parser.add_argument("--duration", type=float, help="stop recording after this many seconds")
+    args = parser.parse_args()
+
+    out = open(args.csv, "w", newline="") if args.csv else sys.stdout
+    raw = open(args.raw, "ab") if args.raw and not args.input else None
+    writer = csv.DictWriter(out, COLUMNS)
+    writer.writeheader()
+    decoder = Decoder()
+    rows = 0
+    packets = read_raw(args.input) if args.input else receive(args.port, raw, args.duration)
+    try:
+        for host_time, packet in packets:
+            row = decoder.decode(host_time, packet)
+            if row:
+                writer.writerow(row)
+                rows += 1
+    except KeyboardInterrupt:
+        pass
+    finally:
+        if raw:
+            raw.close()
+        if out is not sys.stdout:
+            out.close()
+    print("%d rows, %d records lost" % (rows, decoder.lost), file=sys.stderr)
+
+
+if __name__ == "__main__":
+    main()
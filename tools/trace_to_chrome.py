@@ -0,0 +1,141 @@
+#!/usr/bin/env python3
+"""Convert a latency trace of the robot into Chrome trace JSON.
+
+Capture the trace over telnet into a log file, e.g. with
+
+    { echo "trace dump"; sleep 3; } | nc 192.168.4.1 23 > run.log
+
+and convert it with
+
+    tools/trace_to_chrome.py run.log -o run.json
+
+Open run.json in chrome://tracing or https://ui.perfetto.dev. Every stage from a
+camera frame to the wheels is one track, a slice per frame spans from the event
+that starts the stage to the event that ends it:
+
+    parse      UDP receive in udpOnPck -> parse done in parseApril
+    control    parse done -> control decision in followTag/searchForTag
+    command    control decision -> motor command in stepperStart*
+    step       motor command -> first step pulse
+    frame      UDP receive -> first step pulse
+
+Frames without a decision (the control loop used a newer frame) only show up on
+the parse track. The latency per stage is printed as a summary.
+"""
+import argparse
+import json
+import sys
+
+TRACE_UDP_RECEIVE = 1
+TRACE_TAG_PARSED = 2
+TRACE_DECISION = 3
+TRACE_MOTOR_COMMAND = 4
+TRACE_FIRST_STEP = 5
+
+# (track name, start event, end event)
+STAGES = [
+    ("parse", TRACE_UDP_RECEIVE, TRACE_TAG_PARSED),
+    ("control", TRACE_TAG_PARSED, TRACE_DECISION),
+    ("command", TRACE_DECISION, TRACE_MOTOR_COMMAND),
+    ("step", TRACE_MOTOR_COMMAND, TRACE_FIRST_STEP),
+    ("frame", TRACE_UDP_RECEIVE, TRACE_FIRST_STEP),
+]
+
+
+def read_records(path):
+    """The "tr <micros> <event> <correlation> <core>" lines of a telnet log, micros unwrapped."""
+    records = []
+    offset = 0
+    previous = None
+    with open(path, errors="replace") as f:
+        for line in f:
+            fields = line.split()
+            if len(fields) != 5 or fields[0] != "tr":
+                continue
+            try:
+                time, event, correlation, core = (int(x) for x in fields[1:])
+            except ValueError:
+                continue
+            if previous is not None and time + offset < previous - (1 << 31):
+                offset += 1 << 32
+            previous = time + offset
+            records.append((time + offset, event, correlation, core))
+    return records
+
+
+def group_frames(records):
+    """First time of every event per frame, a frame starts with its UDP receive."""
+    frames = []
+    current = {}
+    for time, event, correlation, core in records:
+        if event == TRACE_UDP_RECEIVE:
+            frame = {"id": correlation, TRACE_UDP_RECEIVE: time}
+            frames.append(frame)
+            current[correlation] = frame
+            continue
+        frame = current.get(correlation)
+        if frame is None:
+            # the receive was overwritten in the ring
+            frame = {"id": correlation}
+            frames.append(frame)
+            current[correlation] = frame
+        frame.setdefault(event, time)
+    return frames
+
+
+def percentile(values, p):
+    return values[min(len(values) - 1, int(len(values) * p))]
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("log", help="telnet log with the output of \"trace dump\"")
+    parser.add_argument("-o", "--output", default="trace.json", help="Chrome trace JSON to write")
+    args = parser.parse_args()
+
+    records = read_records(args.log)
+    if not records:
+        print("no trace records in %s" % args.log, file=sys.stderr)
+        return 1
+    frames = group_frames(records)
+    start = min(r[0] for r in records)
+
+    events = [{"name": "process_name", "ph": "M", "pid": 1, "args": {"name": "robot"}}]
+    for tid, (name, _, _) in enumerate(STAGES):
+        events.append({"name": "thread_name", "ph": "M", "pid": 1, "tid": tid, "args": {"name": name}})
+        events.append({"name": "thread_sort_index", "ph": "M", "pid": 1, "tid": tid, "args": {"sort_index": tid}})
+
+    latencies = {name: [] for name, _, _ in STAGES}
+    for frame in frames:
+        for tid, (name, begin, end) in enumerate(STAGES):
+            if begin in frame and end in frame and frame[end] >= frame[begin]:
+                duration = frame[end] - frame[begin]
+                latencies[name].append(duration)
+                events.append({
+                    "name": "frame %d" % frame["id"],
+                    "cat": name,
+                    "ph": "X",
+                    "pid": 1,
+                    "tid": tid,
+                    "ts": frame[begin] - start,
+                    "dur": duration,
+                })
+
+    with open(args.output, "w") as f:
+        json.dump({"traceEvents": events, "displayTimeUnit": "ms"}, f)
+
+    print("%d records, %d frames -> %s" % (len(records), len(frames), args.output))
+    print("%-8s %6s %9s %9s %9s %9s" % ("stage", "n", "mean ms", "p50 ms", "p95 ms", "max ms"))
+    for name, _, _ in STAGES:
+        values = sorted(latencies[name])
+        if not values:
+            print("%-8s %6d" % (name, 0))
+            continue
+        print("%-8s %6d %9.2f %9.2f %9.2f %9.2f" % (
+            name, len(values), sum(values) / len(values) / 1000, percentile(values, 0.5) / 1000,
+            percentile(values, 0.95) / 1000, values[-1] / 1000))
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
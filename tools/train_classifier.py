@@ -0,0 +1,163 @@
+#!/usr/bin/env python3
+"""Train the cargo classifier centroids from logged color samples.
+
+Capture samples over telnet with "color log <label> <n>" for every cargo type
+(and "none" for the empty container), save the telnet output to files and run
+
+    tools/train_classifier.py capture1.txt capture2.txt
+
+Lines that do not start with "sample," are ignored. The tool prints the
+leave-one-out accuracy, the confusion matrix, the number of frames (and ms)
+a sequential decision needs per class and the telnet commands that install
+the trained centroids on the robot.
+"""
+import argparse
+import math
+import sys
+from collections import defaultdict
+
+# RecognitedObject values in object_recognition.hpp
+CLASS_IDS = {"error": 0, "none": 1, "gummy": 2, "ball": 3, "cotton": 4}
+MIN_STDDEV = 0.005
+
+
+def features(lit, ambient, full_scale):
+    """Same features as cargoFeatures() in src/cargo_classifier.cpp."""
+    rgbc = [max(l - a, 0) for l, a in zip(lit, ambient)]
+    total = rgbc[0] + rgbc[1] + rgbc[2]
+    if total == 0:
+        return [0.0, 0.0, rgbc[3] / full_scale]
+    return [rgbc[0] / total, rgbc[1] / total, rgbc[3] / full_scale]
+
+
+def read_samples(paths):
+    samples = defaultdict(list)
+    full_scale = None
+    frame_ms = None
+    for path in paths:
+        with open(path, errors="replace") as f:
+            for line in f:
+                line = line.strip()
+                if not line.startswith("sample,"):
+                    continue
+                fields = line.split(",")
+                # older captures have no integration time
+                if len(fields) not in (12, 13):
+                    continue
+                label = fields[1]
+                ms = int(fields[2])
+                values = [int(v) for v in fields[3:11]]
+                full_scale = float(fields[11])
+                if len(fields) == 13:
+                    frame_ms = float(fields[12])
+                samples[label].append((ms, features(values[:4], values[4:], full_scale)))
+    for label in samples:
+        samples[label].sort()
+    return samples, frame_ms
+
+
+def fit(points):
+    n = len(points)
+    mean = [sum(p[i] for p in points) / n for i in range(3)]
+    var = [sum((p[i] - mean[i]) ** 2 for p in points) / max(n - 1, 1) for i in range(3)]
+    return mean, [max(math.sqrt(v), MIN_STDDEV) for v in var]
+
+
+def log_likelihood(x, model):
+    mean, stddev = model
+    return -sum(0.5 * ((x[i] - mean[i]) / stddev[i]) ** 2 + math.log(stddev[i]) for i in range(3))
+
+
+def classify(x, models):
+    return max(models, key=lambda label: log_likelihood(x, models[label]))
+
+
+def leave_one_out(samples):
+    labels = sorted(samples)
+    confusion = {a: {b: 0 for b in labels} for a in labels}
+    for label in labels:
+        for i, (_, x) in enumerate(samples[label]):
+            models = {}
+            for other in labels:
+                points = [p for j, (_, p) in enumerate(samples[other]) if other != label or j != i]
+                if len(points) >= 2:
+                    models[other] = fit(points)
+            confusion[label][classify(x, models)] += 1
+    return labels, confusion
+
+
+def sequential_latency(samples, models, threshold):
+    """Frames until the posterior of the accumulated evidence passes the threshold."""
+    result = {}
+    for label, series in samples.items():
+        needed = []
+        correct = 0
+        start = 0
+        while start < len(series):
+            ll = {m: 0.0 for m in models}
+            frames = 0
+            decision = None
+            for _, x in series[start:]:
+                frames += 1
+                for m in models:
+                    ll[m] += log_likelihood(x, models[m])
+                best = max(ll, key=ll.get)
+                posterior = 1 / sum(math.exp(ll[m] - ll[best]) for m in ll)
+                if posterior >= threshold:
+                    decision = best
+                    break
+            if decision is None:
+                break
+            needed.append(frames)
+            correct += decision == label
+            start += frames
+        result[label] = (needed, correct)
+    return result
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("captures", nargs="+", help="telnet captures containing sample lines")
+    parser.add_argument("--threshold", type=float, default=0.95, help="posterior for a sequential decision")
+    args = parser.parse_args()
+
+    samples, frame_ms = read_samples(args.captures)
+    samples = {label: s for label, s in samples.items() if len(s) >= 3}
+    if len(samples) < 2:
+        sys.exit("need at least 3 samples of at least 2 labels")
+
+    labels, confusion = leave_one_out(samples)
+    total = sum(sum(row.values()) for row in confusion.values())
+    hits = sum(confusion[label][label] for label in labels)
+    print(f"leave-one-out accuracy: {hits}/{total} = {100.0 * hits / total:.1f}%")
+    width = max(len(label) for label in labels) + 2
+    print("confusion (rows: true, columns: predicted)")
+    print(" " * width + "".join(label.rjust(width) for label in labels))
+    for label in labels:
+        print(label.ljust(width) + "".join(str(confusion[label][p]).rjust(width) for p in labels))
+
+    models = {label: fit([x for _, x in samples[label]]) for label in labels}
+    print(f"sequential decisions at posterior >= {args.threshold}:")
+    for label, (needed, correct) in sorted(sequential_latency(samples, models, args.threshold).items()):
+        if needed:
+            mean = sum(needed) / len(needed)
+            latency = f" ({mean * frame_ms:.0f} ms)" if frame_ms else ""
+            print(f"  {label}: {len(needed)} decisions, {correct} correct, "
+                  f"mean {mean:.2f} frames{latency}, max {max(needed)} frames")
+        else:
+            print(f"  {label}: never confident")
+
+    print("telnet commands:")
+    for label in labels:
+        if label == "none":
+            continue
+        if label not in CLASS_IDS and not label.isdigit():
+            print(f"# unknown label {label}, use a RecognitedObject number", file=sys.stderr)
+            continue
+        mean, stddev = models[label]
+        print("color set {} {:.4f} {:.4f} {:.4f} {:.4f} {:.4f} {:.4f}".format(label, *mean, *stddev))
+    print("color save")
+
+
+if __name__ == "__main__":
+    main()